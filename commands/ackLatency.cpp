@@ -0,0 +1,270 @@
+// ---------------------- Command Acknowledgement -----------------
+// How long after a command is written does telemetry show its effect? Each
+// byte the transmit thread writes is reported here with its steady-clock write
+// time. If ackRules has an entry for it, the command waits for the first frame
+// that confirms it, and the time from write to that frame goes into a
+// per-command histogram.
+//
+// A rule either waits for the first frame of a packet type (turning a packet
+// on) or for a field to move by at least minChange from its value in the last
+// frame before the command. The monitors are logged as raw ADC volts, so the
+// rules look for a change rather than a rail voltage. A command that is not
+// confirmed within ackTimeoutMs counts as a timeout; one overtaken by another
+// command on the same field before confirming counts as superseded.
+//
+// A frame is timed from its timestampMs, when its last field was decoded: it is
+// only dispatched once the next frame's sync arrives, up to a packet period
+// later (about 100 ms for HK). What is left is how long the bytes waited in
+// mylog.0 for the main loop to read them, at most one pass of the loop.
+//
+// Every confirmation is written to logs/Commands/Acks <date time>.csv and the
+// histograms are printed, and appended to that file, on quit.
+#ifndef COMMANDS_ACK_LATENCY_CPP
+#define COMMANDS_ACK_LATENCY_CPP
+
+#include <sys/stat.h>
+#include <cstdio>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <mutex>
+#include "../frames/frame.cpp"
+#include "commandNames.cpp"
+#include "commandQueue.cpp"
+
+using namespace std;
+
+const int64_t ackTimeoutMs = 10 * 1000;
+const int ackBuckets = 18; // Bucket 0 is under 1 ms, bucket i is [2^(i-1), 2^i) ms
+
+struct AckRule
+{
+    unsigned char command;
+    int type;         // Packet that shows the effect
+    const char *field; // nullptr: any frame of type confirms
+    double minChange;
+};
+
+// Tune minChange to the instrument; the values are in logged units
+const AckRule ackRules[] = {
+    {0x0D, PMT_FRAME, nullptr, 0},
+    {0x0E, ERPA_FRAME, nullptr, 0},
+    {0x0F, HK_FRAME, nullptr, 0},
+    {0x00, HK_FRAME, "busimon", 0.05},
+    {0x13, HK_FRAME, "busimon", 0.05},
+    {0x01, HK_FRAME, "n800vmon", 0.1},
+    {0x14, HK_FRAME, "n800vmon", 0.1},
+    {0x02, HK_FRAME, "5vmon", 0.1},
+    {0x15, HK_FRAME, "5vmon", 0.1},
+    {0x03, HK_FRAME, "n200vmon", 0.1},
+    {0x16, HK_FRAME, "n200vmon", 0.1},
+    {0x04, HK_FRAME, "3v3mon", 0.1},
+    {0x17, HK_FRAME, "3v3mon", 0.1},
+    {0x05, HK_FRAME, "n5vmon", 0.1},
+    {0x18, HK_FRAME, "n5vmon", 0.1},
+    {0x06, HK_FRAME, "15vmon", 0.1},
+    {0x19, HK_FRAME, "15vmon", 0.1},
+    {0x07, HK_FRAME, "n3v3mon", 0.1},
+    {0x1A, HK_FRAME, "n3v3mon", 0.1},
+    {0x1B, ERPA_FRAME, "SWPMON", 0.1},
+    {0x1C, ERPA_FRAME, "SWPMON", 0.1},
+};
+const int ackRuleCount = sizeof(ackRules) / sizeof(ackRules[0]);
+
+struct PendingAck
+{
+    int rule;
+    int column; // -1 for any frame
+    double baseline;
+    chrono::steady_clock::time_point sentAt;
+};
+
+struct AckHistogram
+{
+    unsigned long long buckets[ackBuckets];
+    unsigned long long confirmed;
+    unsigned long long timedOut;
+    unsigned long long superseded;
+    unsigned long long noBaseline; // Sent before any frame of its type arrived
+    double totalMs;
+    double minMs;
+    double maxMs;
+};
+
+std::mutex ackMutex; // Guards everything below; the transmit thread and the frame loop both come here
+vector<PendingAck> pendingAcks;
+AckHistogram ackHistograms[256] = {};
+Frame lastAckFrames[4] = {};
+bool haveAckFrame[4] = {false, false, false, false};
+FILE *ackLog = nullptr;
+
+int ackRuleFor(unsigned char command)
+{
+    for (int i = 0; i < ackRuleCount; i++)
+    {
+        if (ackRules[i].command == command)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int ackBucket(double ms)
+{
+    int bucket = 0;
+    while (bucket < ackBuckets - 1 && ms >= (double)(1LL << bucket))
+    {
+        bucket++;
+    }
+    return bucket;
+}
+
+// Called by the transmit thread for every byte written, see commandSentHandler
+void commandSent(unsigned char command, chrono::steady_clock::time_point sentAt)
+{
+    int rule = ackRuleFor(command);
+    if (rule == -1)
+    {
+        return;
+    }
+    const AckRule &ack = ackRules[rule];
+    PendingAck pending = {rule, ack.field == nullptr ? -1 : frameFieldIndex(ack.type, ack.field), 0, sentAt};
+    std::lock_guard<std::mutex> lock(ackMutex);
+    if (pending.column >= 0)
+    {
+        if (!haveAckFrame[ack.type])
+        {
+            ackHistograms[command].noBaseline++;
+            return;
+        }
+        pending.baseline = lastAckFrames[ack.type].values[pending.column];
+    }
+    for (size_t i = 0; i < pendingAcks.size();)
+    {
+        const AckRule &other = ackRules[pendingAcks[i].rule];
+        if (other.type == ack.type && pendingAcks[i].column == pending.column)
+        {
+            ackHistograms[other.command].superseded++;
+            pendingAcks.erase(pendingAcks.begin() + i);
+        }
+        else
+        {
+            i++;
+        }
+    }
+    pendingAcks.push_back(pending);
+}
+
+// Called for every frame
+void ackFrame(const Frame &frame)
+{
+    int64_t ageMs = max<int64_t>(0, currentTimeMs() - frame.timestampMs); // Waiting for the next sync
+    chrono::steady_clock::time_point now = chrono::steady_clock::now() - chrono::milliseconds(ageMs);
+    std::lock_guard<std::mutex> lock(ackMutex);
+    lastAckFrames[frame.type] = frame;
+    haveAckFrame[frame.type] = true;
+    for (size_t i = 0; i < pendingAcks.size();)
+    {
+        const PendingAck &pending = pendingAcks[i];
+        const AckRule &ack = ackRules[pending.rule];
+        AckHistogram &histogram = ackHistograms[ack.command];
+        double ms = chrono::duration<double, milli>(now - pending.sentAt).count();
+        bool confirmed = ack.type == frame.type && (pending.column == -1 || (pending.column < frame.count && fabs(frame.values[pending.column] - pending.baseline) >= ack.minChange));
+        if (confirmed)
+        {
+            histogram.buckets[ackBucket(ms)]++;
+            histogram.minMs = histogram.confirmed == 0 ? ms : min(histogram.minMs, ms);
+            histogram.maxMs = max(histogram.maxMs, ms);
+            histogram.totalMs += ms;
+            histogram.confirmed++;
+            if (ackLog != nullptr)
+            {
+                char row[128];
+                int length = formatLogTimestamp(frame.timestampMs, row);
+                snprintf(row + length, sizeof(row) - length, ", %s, %s, %.1f\n", commandDescription(ack.command).c_str(),
+                         ack.field == nullptr ? frameTypeNames[ack.type] : ack.field, ms);
+                fputs(row, ackLog);
+            }
+        }
+        else if (ms > ackTimeoutMs)
+        {
+            histogram.timedOut++;
+        }
+        else
+        {
+            i++;
+            continue;
+        }
+        pendingAcks.erase(pendingAcks.begin() + i);
+    }
+}
+
+void startAckLatency(const string &logName)
+{
+    std::lock_guard<std::mutex> lock(ackMutex);
+    mkdir(COMMAND_DIRECTORY, 0755);
+    ackLog = fopen((string(COMMAND_DIRECTORY) + "/Acks " + logName + ".csv").c_str(), "w");
+    if (ackLog != nullptr)
+    {
+        fprintf(ackLog, "date, time, command, confirmed by, latency ms\n");
+    }
+    commandSentHandler = commandSent;
+}
+
+// One line per command seen: counts, min/mean/max and the histogram
+string ackLatencyReport()
+{
+    std::lock_guard<std::mutex> lock(ackMutex);
+    string report;
+    char line[512];
+    for (int command = 0; command < 256; command++)
+    {
+        const AckHistogram &histogram = ackHistograms[command];
+        if (histogram.confirmed + histogram.timedOut + histogram.superseded + histogram.noBaseline == 0)
+        {
+            continue;
+        }
+        int length = snprintf(line, sizeof(line), "%-14s confirmed %llu, timed out %llu, superseded %llu, no baseline %llu",
+                              commandDescription(command).c_str(), histogram.confirmed, histogram.timedOut, histogram.superseded, histogram.noBaseline);
+        if (histogram.confirmed > 0)
+        {
+            length += snprintf(line + length, sizeof(line) - length, "; ms min %.1f mean %.1f max %.1f;",
+                               histogram.minMs, histogram.totalMs / histogram.confirmed, histogram.maxMs);
+            for (int bucket = 0; bucket < ackBuckets; bucket++)
+            {
+                if (histogram.buckets[bucket] > 0)
+                {
+                    length += snprintf(line + length, sizeof(line) - length, " <%lld:%llu", 1LL << bucket, histogram.buckets[bucket]);
+                }
+            }
+        }
+        report += string(line) + "\n";
+    }
+    return report;
+}
+
+void stopAckLatency()
+{
+    commandSentHandler = nullptr;
+    string report = ackLatencyReport();
+    if (!report.empty())
+    {
+        std::cout << "Command acknowledgement latency:\n" << report;
+    }
+    std::lock_guard<std::mutex> lock(ackMutex);
+    if (ackLog != nullptr)
+    {
+        size_t start = 0;
+        for (size_t end = report.find('\n'); end != string::npos; start = end + 1, end = report.find('\n', start))
+        {
+            fprintf(ackLog, "# %s\n", report.substr(start, end - start).c_str());
+        }
+        fclose(ackLog);
+        ackLog = nullptr;
+    }
+}
+
+#endif
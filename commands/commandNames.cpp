@@ -0,0 +1,91 @@
+// ----------------------- Command Names ------------------------
+// The single-byte commands the firmware understands, by the names used on the
+// CONTROLS panel. Switches have an on and an off byte; the other commands only
+// "on". Used wherever commands are written or read by people: scripts, logs.
+#ifndef COMMANDS_COMMAND_NAMES_CPP
+#define COMMANDS_COMMAND_NAMES_CPP
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+using namespace std;
+
+struct CommandName
+{
+    const char *name;
+    const char *pin; // GPIO on the CONTROLS panel, "" for none
+    int on;
+    int off; // -1 for commands that are not switches
+};
+
+const CommandName commandNames[] = {
+    {"pmt", "", 0x0D, 0x10},
+    {"erpa", "", 0x0E, 0x11},
+    {"hk", "", 0x0F, 0x12},
+    {"sys_on", "PB5", 0x00, 0x13},
+    {"800v_en", "PB6", 0x01, 0x14},
+    {"5v_en", "PC10", 0x02, 0x15},
+    {"n200v_en", "PC13", 0x03, 0x16},
+    {"3v3_en", "PC7", 0x04, 0x17},
+    {"n5v_en", "PC8", 0x05, 0x18},
+    {"15v_en", "PC9", 0x06, 0x19},
+    {"n3v3_en", "PC6", 0x07, 0x1A},
+    {"sdn1", "", 0x0B, 0x0A},
+    {"sdn2", "", 0x08, 0x09},
+    {"step_up", "", 0x1B, -1},
+    {"step_down", "", 0x1C, -1},
+    {"auto_sweep", "", 0x1D, -1},
+    {"factor_up", "", 0x24, -1},
+    {"factor_down", "", 0x25, -1},
+    {"sleep", "", 0x0C, -1},
+    {"wake", "", 0x5B, -1},
+};
+const int commandNameCount = sizeof(commandNames) / sizeof(commandNames[0]);
+
+// "15v_en" or "PC9" with "on"/"off" (or "high"/"low"), or a byte such as "0x06";
+// -1 if there is no such command
+int commandByte(const string &name, const string &state = "")
+{
+    if (name.size() > 2 && name[0] == '0' && (name[1] == 'x' || name[1] == 'X'))
+    {
+        char *end;
+        long value = strtol(name.c_str() + 2, &end, 16);
+        return *end == '\0' && value >= 0 && value <= 0xFF && state.empty() ? (int)value : -1;
+    }
+    bool off = state == "off" || state == "low";
+    if (!off && !state.empty() && state != "on" && state != "high")
+    {
+        return -1;
+    }
+    for (int i = 0; i < commandNameCount; i++)
+    {
+        if (name == commandNames[i].name || (commandNames[i].pin[0] != '\0' && name == commandNames[i].pin))
+        {
+            return off ? commandNames[i].off : commandNames[i].on;
+        }
+    }
+    return -1;
+}
+
+// "15v_en on", "step_up", or "0x42" for a byte without a name
+string commandDescription(unsigned char command)
+{
+    for (int i = 0; i < commandNameCount; i++)
+    {
+        if (commandNames[i].on == command || commandNames[i].off == command)
+        {
+            string name = commandNames[i].name;
+            if (commandNames[i].off == -1)
+            {
+                return name;
+            }
+            return name + (commandNames[i].on == command ? " on" : " off");
+        }
+    }
+    char hex[8];
+    snprintf(hex, sizeof(hex), "0x%02X", command);
+    return hex;
+}
+
+#endif
@@ -0,0 +1,328 @@
+// ----------------------- Command Queue -------------------------
+// Commands to the instrument (in viewer mode, to the acquiring GUI) are single
+// bytes. They are not written from the UI thread: queueCommands() appends them
+// to a bounded queue and returns, and a transmit thread writes them out, as many
+// as are pending in one write(). A slow or stuck UART only ever holds up that
+// thread; if the queue fills up, new commands are dropped and counted rather
+// than waiting for room.
+//
+// The bytes of one queueCommands() call stay together, so a group such as the
+// twelve wake-up bytes is never interleaved with a command forwarded from a
+// viewer. A call can ask for a gap before each of its bytes, e.g. the startup
+// reset sequence: the thread then sleeps until that long after the previous
+// write instead of the caller sleeping.
+//
+// Every byte written goes to logs/Commands with the time it was sent, how long
+// it waited in the queue and how many bytes shared its write().
+//
+// Nothing is written while the port still holds more than commandPortLimit
+// unsent bytes, so a backlog waits here, where safe mode can drop it, rather
+// than in the driver's buffer ahead of the safe mode bytes.
+#ifndef COMMANDS_COMMAND_QUEUE_CPP
+#define COMMANDS_COMMAND_QUEUE_CPP
+
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <poll.h>
+#include <unistd.h>
+#include <termios.h>
+#include <signal.h>
+#include <cerrno>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include "../frames/frame.cpp"
+#include "../logging/rotatingLog.cpp"
+
+using namespace std;
+
+#define COMMAND_DIRECTORY "logs/Commands"
+#define COMMAND_HEADER "date, time, command, wait ms, batch"
+
+const size_t commandQueueLimit = 4096; // Bytes waiting to be sent before new ones are dropped
+const size_t commandBatchLimit = 64;   // Bytes per write()
+const int commandDrainMs = 1000;       // How long quitting waits for the queue to be sent
+const int commandPortLimit = 64;       // Unsent bytes the port may hold before the next write, about 11 ms at 57600 baud
+
+struct QueuedCommand
+{
+    unsigned char command;
+    int gapMs; // Least time since the previous write, 0 to go out with it
+    chrono::steady_clock::time_point queuedAt;
+};
+
+struct CommandQueueStats
+{
+    size_t depth;    // Bytes waiting now
+    size_t maxDepth; // Most ever waiting at once
+    unsigned long long sent;
+    unsigned long long writes;
+    unsigned long long dropped; // Queue full
+    unsigned long long cleared; // Dropped on purpose by safe mode, or refused while it held the queue
+    unsigned long long failed;  // write() errors, the bytes are not retried
+    double maxWaitMs;           // Longest a byte waited between queueing and being written
+};
+
+int commandFd = -1;
+std::thread commandThread;
+std::mutex commandMutex; // Guards the queue, the stats and commandStopping
+std::condition_variable commandWake;
+deque<QueuedCommand> commandQueue;
+CommandQueueStats commandStats = {};
+bool commandStopping = false;
+bool commandsHeld = false; // Safe mode: nothing is queued until it has been followed
+bool commandThreadDone = false;
+std::atomic<bool> commandPortAbandoned(false); // Quitting with a stuck port: stop writing
+RotatingLog commandLog; // Only written by the transmit thread once it runs
+std::atomic<void (*)(unsigned char, chrono::steady_clock::time_point)> commandSentHandler(nullptr); // Told of every byte written, on the transmit thread; set from the UI thread
+
+// Writes all of data, waiting for a non-blocking fd to take more; false on an
+// error or once the port has been given up on
+bool writeCommandBytes(int fd, const unsigned char *data, size_t length)
+{
+    while (length > 0)
+    {
+        if (commandPortAbandoned)
+        {
+            return false;
+        }
+        ssize_t written = write(fd, data, length);
+        if (written > 0)
+        {
+            data += written;
+            length -= written;
+        }
+        else if (written == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            struct pollfd ready = {fd, POLLOUT, 0};
+            poll(&ready, 1, 100);
+        }
+        else if (written == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        else
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Bytes written to fd that have not gone out yet (TIOCOUTQ), 0 if the fd
+// cannot tell, e.g. a pseudo-terminal
+int portPendingBytes(int fd)
+{
+    int pending = 0;
+    return ioctl(fd, TIOCOUTQ, &pending) == 0 ? pending : 0;
+}
+
+void logSentCommands(const QueuedCommand *batch, size_t count, chrono::steady_clock::time_point sentAt)
+{
+    char row[96];
+    int64_t now = currentTimeMs();
+    for (size_t i = 0; i < count; i++)
+    {
+        int length = formatLogTimestamp(now, row);
+        double waitMs = chrono::duration<double, milli>(sentAt - batch[i].queuedAt).count();
+        length += snprintf(row + length, sizeof(row) - length, ", 0x%02X, %.1f, %zu\n", batch[i].command, waitMs, count);
+        writeRotatingLog(commandLog, row, length);
+    }
+}
+
+void runCommandQueue()
+{
+    QueuedCommand batch[commandBatchLimit];
+    chrono::steady_clock::time_point lastWriteAt;
+    std::unique_lock<std::mutex> lock(commandMutex);
+    while (true)
+    {
+        if (!commandWake.wait_for(lock, chrono::milliseconds(logBlockMs), []
+                                  { return commandStopping || !commandQueue.empty(); }))
+        {
+            lock.unlock();
+            tickRotatingLog(commandLog, currentTimeMs()); // Idle, the last rows still go out
+            lock.lock();
+            continue;
+        }
+        if (commandQueue.empty())
+        {
+            break; // Stopping, and everything queued has been sent
+        }
+        chrono::steady_clock::time_point due = lastWriteAt + chrono::milliseconds(commandQueue.front().gapMs);
+        if (chrono::steady_clock::now() < due)
+        {
+            commandWake.wait_until(lock, due);
+            continue;
+        }
+        if (portPendingBytes(commandFd) > commandPortLimit)
+        {
+            commandWake.wait_for(lock, chrono::milliseconds(1));
+            continue;
+        }
+        // Everything pending up to the next byte that has to wait
+        size_t count = 0;
+        unsigned char bytes[commandBatchLimit];
+        while (count < commandBatchLimit && !commandQueue.empty() && (count == 0 || commandQueue.front().gapMs == 0))
+        {
+            batch[count] = commandQueue.front();
+            bytes[count] = batch[count].command;
+            commandQueue.pop_front();
+            count++;
+        }
+        commandStats.depth = commandQueue.size();
+        lock.unlock();
+
+        bool ok = writeCommandBytes(commandFd, bytes, count);
+        chrono::steady_clock::time_point sentAt = chrono::steady_clock::now();
+        lastWriteAt = sentAt;
+        if (ok)
+        {
+            logSentCommands(batch, count, sentAt);
+            void (*sentHandler)(unsigned char, chrono::steady_clock::time_point) = commandSentHandler;
+            for (size_t i = 0; sentHandler != nullptr && i < count; i++)
+            {
+                sentHandler(batch[i].command, sentAt);
+            }
+        }
+        else if (!commandPortAbandoned)
+        {
+            std::cerr << "Error writing to the serial port." << std::endl;
+        }
+
+        lock.lock();
+        if (ok)
+        {
+            commandStats.sent += count;
+            commandStats.writes++;
+            commandStats.maxWaitMs = max(commandStats.maxWaitMs, chrono::duration<double, milli>(sentAt - batch[0].queuedAt).count());
+        }
+        else
+        {
+            commandStats.failed += count;
+        }
+    }
+    lock.unlock();
+    closeRotatingLog(commandLog);
+    lock.lock();
+    commandThreadDone = true;
+    commandWake.notify_all();
+}
+
+// Starts the transmit thread for fd, the serial port or the telemetry socket;
+// logName is the session name, as in the other logs
+void startCommandQueue(int fd, const string &logName)
+{
+    if (fd == -1 || commandThread.joinable())
+    {
+        return;
+    }
+    mkdir(COMMAND_DIRECTORY, 0755);
+    openRotatingLog(commandLog, string(COMMAND_DIRECTORY) + "/Commands " + logName, COMMAND_HEADER);
+    commandFd = fd;
+    commandThread = std::thread(runCommandQueue);
+}
+
+// Sends what is still queued, then stops the thread. A port that takes no
+// bytes for commandDrainMs is given up on, so quitting cannot hang: the rest of
+// the queue is dropped and a write() stuck on the port is woken up, by
+// discarding the tty's pending output or shutting down the viewer's socket.
+void stopCommandQueue()
+{
+    std::unique_lock<std::mutex> lock(commandMutex);
+    commandStopping = true;
+    commandWake.notify_all();
+    if (!commandThread.joinable())
+    {
+        return;
+    }
+    if (commandWake.wait_for(lock, chrono::milliseconds(commandDrainMs), []
+                             { return commandThreadDone; }))
+    {
+        lock.unlock();
+        commandThread.join();
+    }
+    else
+    {
+        std::cerr << commandQueue.size() << " commands were not sent, the serial port is not taking any." << std::endl;
+        commandQueue.clear();
+        commandPortAbandoned = true;
+        lock.unlock();
+        signal(SIGPIPE, SIG_IGN);     // The shut down socket would raise it
+        tcflush(commandFd, TCOFLUSH); // Fails harmlessly on a socket,
+        shutdown(commandFd, SHUT_WR); // and this on a tty
+        commandThread.join();
+    }
+}
+
+// Never blocks on the port. With gapMs, each byte is written at least that long
+// after the one before it. False if the commands were dropped: no port (a
+// replay), stopping, held after safe mode, or the queue is full.
+bool queueCommands(const unsigned char *commands, size_t count, int gapMs = 0)
+{
+    chrono::steady_clock::time_point now = chrono::steady_clock::now();
+    {
+        std::lock_guard<std::mutex> lock(commandMutex);
+        if (commandsHeld)
+        {
+            commandStats.cleared += count;
+            return false;
+        }
+        if (!commandThread.joinable() || commandStopping || commandQueue.size() + count > commandQueueLimit)
+        {
+            if (commandThread.joinable())
+            {
+                commandStats.dropped += count;
+            }
+            return false;
+        }
+        for (size_t i = 0; i < count; i++)
+        {
+            QueuedCommand queued = {commands[i], gapMs, now};
+            commandQueue.push_back(queued);
+        }
+        commandStats.depth = commandQueue.size();
+        commandStats.maxDepth = max(commandStats.maxDepth, commandStats.depth);
+    }
+    commandWake.notify_one();
+    return true;
+}
+
+bool queueCommand(unsigned char command)
+{
+    return queueCommands(&command, 1);
+}
+
+// Drops every byte still waiting, e.g. after safe mode (commands/safeMode.cpp);
+// returns how many. A write() already under way still goes out.
+size_t dropQueuedCommands()
+{
+    std::lock_guard<std::mutex> lock(commandMutex);
+    size_t count = commandQueue.size();
+    commandStats.cleared += count;
+    commandQueue.clear();
+    commandStats.depth = 0;
+    return count;
+}
+
+// While held, queueCommands() refuses everything, see commands/safeMode.cpp
+void holdCommands(bool hold)
+{
+    std::lock_guard<std::mutex> lock(commandMutex);
+    commandsHeld = hold;
+}
+
+CommandQueueStats commandQueueStats()
+{
+    std::lock_guard<std::mutex> lock(commandMutex);
+    return commandStats;
+}
+
+#endif
@@ -0,0 +1,167 @@
+// ----------------------- Control Journal -------------------------
+// The Controls log as a journal of events instead of 13-column rows that are
+// almost all empty. logs/Controls/Controls<date time>.jsonl holds one JSON
+// object per line:
+//
+//   {"t":1711644697756,"controls":["pmt","erpa",...,"sdn2"],"state":7}
+//   {"t":1711644703792,"c":"erpa","v":0,"cmd":"0x11"}
+//   {"t":1711644705120,"c":"wake","cmd":"0x5B","n":12}
+//
+// The first line is the state at startup as a mask over the listed controls
+// (bit i is controls[i]); every later line is one control c changing to v,
+// with the byte cmd that was queued for it. The step, factor, sleep and wake
+// commands have no v, and n when the byte was sent more than once. t is Unix
+// time in ms. build/controlsAt replays the journal into the full state table
+// at any instant, logging/controlsLog.cpp reads it back. A session in which no
+// control changes leaves no file.
+//
+// The lines are formatted by the caller and written out by a background
+// thread, which also opens the file, so journalling a change never waits on
+// the disk.
+#ifndef COMMANDS_CONTROL_JOURNAL_CPP
+#define COMMANDS_CONTROL_JOURNAL_CPP
+
+#include <stdint.h>
+#include <sys/stat.h>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "../frames/frame.cpp"
+#include "commandNames.cpp"
+
+using namespace std;
+
+#define CONTROL_JOURNAL_DIRECTORY "logs/Controls"
+
+string controlJournalPath;
+string controlJournalStart; // The first line, queued with the first change (UI thread)
+FILE *controlJournal = nullptr; // Only touched by the journal thread
+std::thread controlJournalThread;
+std::mutex controlJournalMutex; // Guards the queue and controlJournalStopping
+std::condition_variable controlJournalWake;
+deque<string> controlJournalQueue;
+bool controlJournalStopping = false;
+
+void runControlJournal()
+{
+    std::unique_lock<std::mutex> lock(controlJournalMutex);
+    while (true)
+    {
+        controlJournalWake.wait(lock, []
+                                { return controlJournalStopping || !controlJournalQueue.empty(); });
+        if (controlJournalQueue.empty())
+        {
+            break; // Stopping, and everything queued has been written
+        }
+        deque<string> lines;
+        lines.swap(controlJournalQueue);
+        lock.unlock();
+        if (controlJournal == nullptr && (controlJournal = fopen(controlJournalPath.c_str(), "w")) == nullptr)
+        {
+            std::cerr << "Could not open " << controlJournalPath << ", control changes are not logged." << std::endl;
+            lock.lock();
+            controlJournalStopping = true;
+            controlJournalQueue.clear();
+            break;
+        }
+        for (size_t i = 0; i < lines.size(); i++)
+        {
+            fputs(lines[i].c_str(), controlJournal);
+        }
+        fflush(controlJournal);
+        lock.lock();
+    }
+    if (controlJournal != nullptr)
+    {
+        fclose(controlJournal);
+        controlJournal = nullptr;
+    }
+}
+
+void queueJournalLine(const char *line)
+{
+    {
+        std::lock_guard<std::mutex> lock(controlJournalMutex);
+        if (!controlJournalThread.joinable() || controlJournalStopping)
+        {
+            return;
+        }
+        if (!controlJournalStart.empty())
+        {
+            controlJournalQueue.push_back(controlJournalStart);
+            controlJournalStart.clear();
+        }
+        controlJournalQueue.push_back(line);
+    }
+    controlJournalWake.notify_one();
+}
+
+// Opens the journal for this session and records the starting state of the
+// first count controls of commandNames
+void openControlJournal(const string &logName, uint32_t state, int count)
+{
+    if (controlJournalThread.joinable())
+    {
+        return;
+    }
+    mkdir(CONTROL_JOURNAL_DIRECTORY, 0755);
+    controlJournalPath = string(CONTROL_JOURNAL_DIRECTORY) + "/Controls" + logName + ".jsonl";
+    controlJournalStart = "{\"t\":" + to_string(currentTimeMs()) + ",\"controls\":[";
+    for (int control = 0; control < count; control++)
+    {
+        controlJournalStart += string(control == 0 ? "\"" : ",\"") + commandNames[control].name + "\"";
+    }
+    controlJournalStart += "],\"state\":" + to_string(state) + "}\n";
+    controlJournalThread = std::thread(runControlJournal);
+}
+
+// One switch changing; these are called from the UI thread only
+void journalControl(int64_t timestampMs, int control, bool on, unsigned char command)
+{
+    char line[96];
+    snprintf(line, sizeof(line), "{\"t\":%lld,\"c\":\"%s\",\"v\":%d,\"cmd\":\"0x%02X\"}\n",
+             (long long)timestampMs, commandNames[control].name, on ? 1 : 0, command);
+    queueJournalLine(line);
+}
+
+// A command that is not a switch, sent count times
+void journalCommand(int64_t timestampMs, unsigned char command, int count = 1)
+{
+    const char *name = "";
+    for (int i = 0; i < commandNameCount; i++)
+    {
+        if (commandNames[i].on == command)
+        {
+            name = commandNames[i].name;
+            break;
+        }
+    }
+    char line[96];
+    int length = snprintf(line, sizeof(line), "{\"t\":%lld,\"c\":\"%s\",\"cmd\":\"0x%02X\"", (long long)timestampMs, name, command);
+    if (count > 1)
+    {
+        length += snprintf(line + length, sizeof(line) - length, ",\"n\":%d", count);
+    }
+    snprintf(line + length, sizeof(line) - length, "}\n");
+    queueJournalLine(line);
+}
+
+// Writes what is still queued and closes the journal
+void closeControlJournal()
+{
+    {
+        std::lock_guard<std::mutex> lock(controlJournalMutex);
+        controlJournalStopping = true;
+    }
+    controlJournalWake.notify_one();
+    if (controlJournalThread.joinable())
+    {
+        controlJournalThread.join();
+    }
+}
+
+#endif
@@ -0,0 +1,198 @@
+// ------------------------ Control State -------------------------
+// The packet toggles and the CONTROLS panel as one bitmask: bit i is
+// commandNames[i], i.e. pmt, erpa, hk, sys_on, the seven rail enables, sdn1
+// and sdn2. setControl() is the one way a control changes. It enforces the
+// sys_on gating (a rail cannot come on without sys_on, and sys_on off turns
+// every rail off), queues the command bytes and journals every control that
+// changed (commands/controlJournal.cpp). The widgets call it from their
+// callbacks and are then redrawn from the mask, so nothing polls them. The
+// exceptions are safe mode, which writes its own bytes and then records the
+// rails it turned off with noteControlOff(), and scripts, whose commands are
+// followed by followScriptCommands() once they have been queued.
+//
+// The sweep is kept here too: the step the instrument was last told to go to,
+// the factor and whether an auto sweep is running. commands/reconcile.cpp
+// checks the step and the controls against telemetry.
+//
+// UI thread only.
+#ifndef COMMANDS_CONTROL_STATE_CPP
+#define COMMANDS_CONTROL_STATE_CPP
+
+#include <stdint.h>
+#include <string>
+#include <algorithm>
+#include "../frames/frame.cpp"
+#include "commandNames.cpp"
+#include "commandQueue.cpp"
+#include "controlJournal.cpp"
+#include "sequencer.cpp"
+
+using namespace std;
+
+#define CONTROL_PMT 0
+#define CONTROL_ERPA 1
+#define CONTROL_HK 2
+#define CONTROL_SYS_ON 3
+#define CONTROL_800V 4
+#define CONTROL_5V 5
+#define CONTROL_N200V 6
+#define CONTROL_3V3 7
+#define CONTROL_N5V 8
+#define CONTROL_15V 9
+#define CONTROL_N3V3 10
+#define CONTROL_SDN1 11
+#define CONTROL_SDN2 12
+
+const int controlCount = 13;
+const uint32_t railControls = 0x7F << CONTROL_800V; // Gated by sys_on
+const uint32_t packetControls = 0x7 << CONTROL_PMT;
+
+const int sweepSteps = 8;
+const double sweepStepVolts[sweepSteps] = {0, 0.5, 1, 1.5, 2, 2.5, 3, 3.3}; // SWPMON at each step
+const int sweepFactorMax = 32;
+
+uint32_t controlState = 0;
+int64_t controlChangedMs[controlCount] = {}; // When each control was last set
+int sweepStep = 0;
+int sweepFactor = 1;
+bool sweepAuto = false; // From auto_sweep until the next step command
+int64_t sweepChangedMs = 0;
+
+bool controlOn(int control)
+{
+    return (controlState >> control) & 1;
+}
+
+// What the controls are at startup, nothing is sent. Starts the journal for
+// logName with this state.
+void initControlState(uint32_t state, const string &logName)
+{
+    controlState = state;
+    openControlJournal(logName, state, controlCount);
+}
+
+// False if nothing changed: already in that state, or a rail without sys_on
+bool setControl(int control, bool on)
+{
+    uint32_t bit = 1u << control;
+    if (controlOn(control) == on || (on && (bit & railControls) && !controlOn(CONTROL_SYS_ON)))
+    {
+        return false;
+    }
+    int64_t now = currentTimeMs();
+    if (control == CONTROL_SYS_ON && !on)
+    {
+        // sys_on off, then every enable it gates, in one write
+        const unsigned char allOff[8] = {0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1A};
+        queueCommands(allOff, sizeof(allOff));
+        journalControl(now, control, false, allOff[0]);
+        for (int rail = CONTROL_800V; rail <= CONTROL_N3V3; rail++)
+        {
+            if (controlOn(rail))
+            {
+                journalControl(now, rail, false, commandNames[rail].off);
+            }
+            controlChangedMs[rail] = now;
+        }
+        controlState &= ~(bit | railControls);
+    }
+    else
+    {
+        unsigned char command = on ? commandNames[control].on : commandNames[control].off;
+        queueCommand(command);
+        journalControl(now, control, on, command);
+        controlState ^= bit;
+    }
+    controlChangedMs[control] = now;
+    return true;
+}
+
+// A control that something else has already turned off with command, e.g.
+// safe mode (commands/safeMode.cpp): journalled, nothing is sent
+void noteControlOff(int control, unsigned char command, int64_t timestampMs)
+{
+    if (!controlOn(control))
+    {
+        return;
+    }
+    controlState &= ~(1u << control);
+    controlChangedMs[control] = timestampMs;
+    journalControl(timestampMs, control, false, command);
+}
+
+// UI thread: applies what scripts have sent to the controls and the sweep, as
+// the buttons would have, and journals it. Nothing is sent. True if a control
+// changed.
+bool followScriptCommands()
+{
+    static vector<pair<int64_t, unsigned char>> sent;
+    takeScriptCommands(sent);
+    bool changed = false;
+    for (size_t i = 0; i < sent.size(); i++)
+    {
+        int64_t timestampMs = sent[i].first;
+        unsigned char command = sent[i].second;
+        int control = 0;
+        while (control < controlCount && command != commandNames[control].on && command != commandNames[control].off)
+        {
+            control++;
+        }
+        if (control < controlCount)
+        {
+            bool on = command == commandNames[control].on;
+            if (controlOn(control) != on)
+            {
+                controlState ^= 1u << control;
+                journalControl(timestampMs, control, on, command);
+                changed = true;
+            }
+            controlChangedMs[control] = timestampMs; // Left alone by the reconciliation for a while
+            continue;
+        }
+        if (command == 0x1B || command == 0x1C)
+        {
+            sweepStep = command == 0x1B ? min(sweepStep + 1, sweepSteps - 1) : max(sweepStep - 1, 0);
+            sweepAuto = false;
+            sweepChangedMs = timestampMs;
+        }
+        else if (command == 0x1D)
+        {
+            sweepAuto = true;
+            sweepChangedMs = timestampMs;
+        }
+        else if (command == 0x24 || command == 0x25)
+        {
+            sweepFactor = command == 0x24 ? min(sweepFactor * 2, sweepFactorMax) : max(sweepFactor / 2, 1);
+        }
+        journalCommand(timestampMs, command);
+    }
+    return changed;
+}
+
+// Step up or down one step, clamped to the table
+void stepSweep(bool up)
+{
+    queueCommand(up ? 0x1B : 0x1C);
+    sweepStep = up ? min(sweepStep + 1, sweepSteps - 1) : max(sweepStep - 1, 0);
+    sweepAuto = false;
+    sweepChangedMs = currentTimeMs();
+    journalCommand(sweepChangedMs, up ? 0x1B : 0x1C);
+}
+
+void startAutoSweep()
+{
+    queueCommand(0x1D);
+    sweepAuto = true;
+    sweepChangedMs = currentTimeMs();
+    journalCommand(sweepChangedMs, 0x1D);
+}
+
+// Doubles or halves the factor, 1 to sweepFactorMax
+void scaleSweepFactor(bool up)
+{
+    queueCommand(up ? 0x24 : 0x25);
+    sweepFactor = up ? min(sweepFactor * 2, sweepFactorMax) : max(sweepFactor / 2, 1);
+    journalCommand(currentTimeMs(), up ? 0x24 : 0x25);
+}
+
+#endif
@@ -0,0 +1,291 @@
+// -------------------------- Host Sweep --------------------------
+// Auto Sweep (0x1D) leaves the sweep to the firmware, so the GUI never knows
+// which step an ERPA frame was taken at. A host sweep steps from here instead,
+// with step_up and step_down (stepSweep in commands/controlState.cpp): from
+// step 0 up to the last step, each held for hostSweepDwellMs, then straight
+// back down to 0 for the next sweep. The frames of the first
+// hostSweepSettleMs after a step command are logged but kept out of the
+// step's statistics while SWPMON settles.
+//
+// logs/Sweeps/Sweep <date time>.csv gets every ERPA frame of the sweep with
+// the sweep number, the step it was commanded to and the ms since that
+// command. "Sweep <date time> steps.csv" gets one row per step of every
+// sweep: frames kept and discarded, mean and standard deviation of SWPMON and
+// adc, and the settling time, from the command to the first frame whose
+// SWPMON is at the step (nearestSweepStep in commands/reconcile.cpp). Kept
+// frames that were not at the step count as unsettled, i.e. the discard is
+// too short. A frame is stamped when the next one starts arriving, so one
+// taken just before a step command can be tagged with the new step; the
+// discard covers that too. Sweeps per minute and the settling of each step
+// are printed, and appended to the steps file, when the sweep stops.
+//
+// UI thread only: hostSweepFrame() is called from dispatchFrame and
+// hostSweepTick() from the main loop. A step command from anywhere else, e.g.
+// the Step Up button, stops the sweep.
+#ifndef COMMANDS_HOST_SWEEP_CPP
+#define COMMANDS_HOST_SWEEP_CPP
+
+#include <sys/stat.h>
+#include <cstdio>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <algorithm>
+#include "../frames/frame.cpp"
+#include "controlState.cpp"
+#include "reconcile.cpp"
+
+using namespace std;
+
+#define SWEEP_DIRECTORY "logs/Sweeps"
+
+struct SweepStepStats
+{
+    int kept;
+    int discarded;     // Taken while settling
+    int unsettled;     // Kept, but SWPMON was not at the step
+    double swpmonSum;
+    double swpmonSquares;
+    double adcSum;
+    double adcSquares;
+    int64_t settleMs;  // -1 until SWPMON reaches the step
+};
+
+struct SweepStepTotals
+{
+    int sweeps;
+    int kept;
+    int unsettled;
+    int settled;       // Sweeps in which SWPMON reached the step
+    double settleSumMs;
+    int64_t settleMaxMs;
+};
+
+int64_t hostSweepDwellMs = 1000; // --sweep-dwell
+int64_t hostSweepSettleMs = 200; // --sweep-settle
+int hostSweepLimit = 0;          // --sweeps, 0 runs until stopped
+
+bool hostSweepRunning = false;
+int hostSweepNumber = 0;         // Sweeps completed
+int64_t hostSweepStartedMs = 0;
+int64_t hostSweepStepMs = 0;     // When the current step was commanded
+SweepStepStats hostSweepStats;   // Of the current step
+SweepStepTotals hostSweepTotals[sweepSteps];
+FILE *hostSweepFrameLog = nullptr;
+FILE *hostSweepStepLog = nullptr;
+int hostSweepSwpmonColumn = -1;
+int hostSweepAdcColumn = -1;
+
+double standardDeviation(double sum, double squares, int count)
+{
+    if (count < 2)
+    {
+        return 0;
+    }
+    double mean = sum / count;
+    return sqrt(max(squares / count - mean * mean, 0.0));
+}
+
+// Sends as many step_up or step_down as it takes to get to step
+void commandSweepStep(int step)
+{
+    int from = sweepStep;
+    for (int i = 0; i < abs(step - from); i++)
+    {
+        stepSweep(step > from);
+    }
+    if (step == from)
+    {
+        sweepChangedMs = currentTimeMs(); // Already there, the step starts now
+    }
+    hostSweepStepMs = sweepChangedMs;
+    SweepStepStats stats = {0, 0, 0, 0, 0, 0, 0, -1};
+    hostSweepStats = stats;
+}
+
+void finishSweepStep()
+{
+    const SweepStepStats &stats = hostSweepStats;
+    SweepStepTotals &totals = hostSweepTotals[sweepStep];
+    totals.sweeps++;
+    totals.kept += stats.kept;
+    totals.unsettled += stats.unsettled;
+    if (stats.settleMs != -1)
+    {
+        totals.settled++;
+        totals.settleSumMs += stats.settleMs;
+        totals.settleMaxMs = max(totals.settleMaxMs, stats.settleMs);
+    }
+    if (hostSweepStepLog != nullptr)
+    {
+        char row[256];
+        int length = formatLogTimestamp(hostSweepStepMs, row);
+        double count = max(stats.kept, 1);
+        snprintf(row + length, sizeof(row) - length, ", %d, %d, %.2f, %d, %d, %d, %.4f, %.4f, %.4f, %.4f, %lld\n",
+                 hostSweepNumber, sweepStep, sweepStepVolts[sweepStep], stats.kept, stats.discarded, stats.unsettled,
+                 stats.swpmonSum / count, standardDeviation(stats.swpmonSum, stats.swpmonSquares, stats.kept),
+                 stats.adcSum / count, standardDeviation(stats.adcSum, stats.adcSquares, stats.kept), (long long)stats.settleMs);
+        fputs(row, hostSweepStepLog);
+    }
+}
+
+// Starts from step 0; logName names the two logs
+void startHostSweep(const string &logName)
+{
+    if (hostSweepRunning)
+    {
+        return;
+    }
+    if (hostSweepSettleMs >= hostSweepDwellMs)
+    {
+        std::cerr << "The sweep settle time is not shorter than the dwell, no frames will be kept." << std::endl;
+    }
+    mkdir(SWEEP_DIRECTORY, 0755);
+    string path = string(SWEEP_DIRECTORY) + "/Sweep " + logName;
+    hostSweepFrameLog = fopen((path + ".csv").c_str(), "w");
+    hostSweepStepLog = fopen((path + " steps.csv").c_str(), "w");
+    if (hostSweepFrameLog != nullptr)
+    {
+        fprintf(hostSweepFrameLog, "date, time, sweep, step, step volts, ms since step, settling, SWPMON, adc\n");
+    }
+    if (hostSweepStepLog != nullptr)
+    {
+        fprintf(hostSweepStepLog, "date, time, sweep, step, step volts, kept, discarded, unsettled, SWPMON mean, SWPMON sd, adc mean, adc sd, settle ms\n");
+    }
+    hostSweepSwpmonColumn = frameFieldIndex(ERPA_FRAME, "SWPMON");
+    hostSweepAdcColumn = frameFieldIndex(ERPA_FRAME, "adc");
+    for (int step = 0; step < sweepSteps; step++)
+    {
+        SweepStepTotals totals = {0, 0, 0, 0, 0, 0};
+        hostSweepTotals[step] = totals;
+    }
+    if (sweepAuto)
+    {
+        sweepStep = sweepSteps - 1; // Anywhere; enough step_down for any of them
+    }
+    hostSweepNumber = 0;
+    hostSweepRunning = true;
+    commandSweepStep(0);
+    hostSweepStartedMs = hostSweepStepMs;
+}
+
+// Prints and logs the summary, closes the logs
+void stopHostSweep(const string &outcome)
+{
+    if (!hostSweepRunning)
+    {
+        return;
+    }
+    hostSweepRunning = false;
+    double minutes = (currentTimeMs() - hostSweepStartedMs) / 60000.0;
+    char line[256];
+    snprintf(line, sizeof(line), "Host sweep %s: %d sweeps in %.2f min, %.2f sweeps per minute (dwell %lld ms, at most %.2f)",
+             outcome.c_str(), hostSweepNumber, minutes, minutes > 0 ? hostSweepNumber / minutes : 0,
+             (long long)hostSweepDwellMs, 60000.0 / (hostSweepDwellMs * sweepSteps));
+    string report = string(line) + "\n";
+    for (int step = 0; step < sweepSteps; step++)
+    {
+        const SweepStepTotals &totals = hostSweepTotals[step];
+        if (totals.sweeps == 0)
+        {
+            continue;
+        }
+        int length = snprintf(line, sizeof(line), "step %d: %d frames kept, %d unsettled, settled in %d of %d",
+                              step, totals.kept, totals.unsettled, totals.settled, totals.sweeps);
+        if (totals.settled > 0)
+        {
+            snprintf(line + length, sizeof(line) - length, ", %.0f ms on average, %lld ms at most (discarding %lld ms)",
+                     totals.settleSumMs / totals.settled, (long long)totals.settleMaxMs, (long long)hostSweepSettleMs);
+        }
+        report += string(line) + "\n";
+    }
+    std::cout << report;
+    if (hostSweepStepLog != nullptr)
+    {
+        size_t start = 0;
+        for (size_t end = report.find('\n'); end != string::npos; start = end + 1, end = report.find('\n', start))
+        {
+            fprintf(hostSweepStepLog, "# %s\n", report.substr(start, end - start).c_str());
+        }
+        fclose(hostSweepStepLog);
+        hostSweepStepLog = nullptr;
+    }
+    if (hostSweepFrameLog != nullptr)
+    {
+        fclose(hostSweepFrameLog);
+        hostSweepFrameLog = nullptr;
+    }
+}
+
+// Moves on once the step has been held for the dwell
+void hostSweepTick(int64_t now)
+{
+    if (!hostSweepRunning)
+    {
+        return;
+    }
+    if (sweepChangedMs != hostSweepStepMs)
+    {
+        stopHostSweep("stopped by another step command");
+        return;
+    }
+    if (now - hostSweepStepMs < hostSweepDwellMs)
+    {
+        return;
+    }
+    finishSweepStep();
+    if (sweepStep < sweepSteps - 1)
+    {
+        commandSweepStep(sweepStep + 1);
+        return;
+    }
+    hostSweepNumber++;
+    if (hostSweepLimit > 0 && hostSweepNumber >= hostSweepLimit)
+    {
+        stopHostSweep("finished");
+        return;
+    }
+    commandSweepStep(0);
+}
+
+// Called for every frame; tags and counts the ERPA frames
+void hostSweepFrame(const Frame &frame)
+{
+    if (!hostSweepRunning || frame.type != ERPA_FRAME || hostSweepSwpmonColumn == -1)
+    {
+        return;
+    }
+    SweepStepStats &stats = hostSweepStats;
+    int64_t sinceStepMs = frame.timestampMs - hostSweepStepMs;
+    bool settling = sinceStepMs < hostSweepSettleMs;
+    double swpmon = frame.values[hostSweepSwpmonColumn];
+    double adc = frame.values[hostSweepAdcColumn];
+    bool atStep = nearestSweepStep(swpmon) == sweepStep;
+    if (atStep && stats.settleMs == -1)
+    {
+        stats.settleMs = sinceStepMs;
+    }
+    if (settling)
+    {
+        stats.discarded++;
+    }
+    else
+    {
+        stats.kept++;
+        stats.unsettled += !atStep;
+        stats.swpmonSum += swpmon;
+        stats.swpmonSquares += swpmon * swpmon;
+        stats.adcSum += adc;
+        stats.adcSquares += adc * adc;
+    }
+    if (hostSweepFrameLog != nullptr)
+    {
+        char row[160];
+        int length = formatLogTimestamp(frame.timestampMs, row);
+        snprintf(row + length, sizeof(row) - length, ", %d, %d, %.2f, %lld, %d, %.4f, %.4f\n", hostSweepNumber, sweepStep,
+                 sweepStepVolts[sweepStep], (long long)sinceStepMs, settling ? 1 : 0, swpmon, adc);
+        fputs(row, hostSweepFrameLog);
+    }
+}
+
+#endif
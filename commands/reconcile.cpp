@@ -0,0 +1,286 @@
+// --------------------- State Reconciliation ---------------------
+// The control mask and the sweep step in commands/controlState.cpp are what
+// the GUI has told the instrument, including what scripts have sent (see
+// followScriptCommands). A dropped byte or a reset makes them wrong without
+// anyone noticing. Here every frame
+// is read for what the instrument is actually doing:
+//  - a packet is on while its frames arrive, off after packetSilenceMs without one
+//  - the sweep step is the entry of sweepStepVolts nearest SWPMON
+//  - a rail is on when its HK monitor is past its level in railMonitors
+// A reading counts once reconcileFrames frames in a row agree. When it differs
+// from the GUI's state for a control that was not commanded in the last
+// reconcileSettleMs, the control is flagged and the command is sent again,
+// at most reconcileRetries times reconcileRetryMs apart. Nothing is sent again
+// while a Controls log replays (commands/sequencer.cpp), whose commands the
+// buttons do not follow.
+//
+// The rail monitors are logged as raw ADC volts and their levels depend on the
+// instrument, so no rail is checked until its level is given with
+// --rail-level "15v_en > 2.2". The factor does not show in telemetry and is
+// not checked; neither is the step during an auto sweep.
+//
+// UI thread only: reconcileFrame() is called from dispatchFrame, and
+// reconcileControls() also from the main loop so that silence is noticed.
+#ifndef COMMANDS_RECONCILE_CPP
+#define COMMANDS_RECONCILE_CPP
+
+#include <cmath>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include "../frames/frame.cpp"
+#include "commandNames.cpp"
+#include "commandQueue.cpp"
+#include "controlState.cpp"
+#include "sequencer.cpp"
+
+using namespace std;
+
+const int reconcileFrames = 3;          // Frames in a row that must agree before a reading counts
+const int64_t reconcileSettleMs = 3000; // How long after a command its control is left alone
+const int64_t reconcileRetryMs = 5000;  // Least time between re-sends for one control
+const int reconcileRetries = 3;         // Re-sends before giving up until the next command
+const int64_t packetSilenceMs = 3000;   // A packet that sends nothing for this long is off
+const double sweepStepTolerance = 0.12; // Volts from a step's SWPMON, under half the 3 to 3.3 V spacing
+const int reconcileStep = controlCount; // Item index of the sweep step, after the controls
+
+struct RailMonitor
+{
+    int control;
+    const char *field; // HK monitor
+    bool onAbove;      // On above level, or on below it
+    double level;      // NAN: not given, the rail is not checked
+};
+
+RailMonitor railMonitors[] = {
+    {CONTROL_SYS_ON, "busimon", true, NAN},
+    {CONTROL_800V, "n800vmon", true, NAN},
+    {CONTROL_5V, "5vmon", true, NAN},
+    {CONTROL_N200V, "n200vmon", true, NAN},
+    {CONTROL_3V3, "3v3mon", true, NAN},
+    {CONTROL_N5V, "n5vmon", true, NAN},
+    {CONTROL_15V, "15vmon", true, NAN},
+    {CONTROL_N3V3, "n3v3mon", true, NAN},
+};
+const int railMonitorCount = sizeof(railMonitors) / sizeof(railMonitors[0]);
+
+struct ReconciledItem
+{
+    int reading;  // Latest reading, -1 for none
+    int agreeing; // Frames in a row with that reading
+    int observed; // Settled reading, -1 while unknown
+    int retries;
+    int64_t resentMs;
+};
+
+// One per control, then the sweep step
+ReconciledItem reconciledItems[controlCount + 1];
+int64_t lastPacketMs[4] = {0, 0, 0, 0};
+int railColumns[railMonitorCount];
+int swpmonColumn = -1;
+bool reconcileResend = true; // False: only flag, --no-resend and viewers
+bool reconcilePaused = false; // While the instrument is asleep nothing is compared
+uint32_t reconcileDiverged = 0; // Bit i: item i differs from the GUI's state
+unsigned reconcileVersion = 0;  // Bumped whenever reconcileDiverged or reconcileSummary changes
+string reconcileSummary = "in sync";
+
+// "15v_en > 2.2" or "PC9 > 2.2"
+bool setRailLevel(const string &spec)
+{
+    istringstream words(spec);
+    string name, condition;
+    double level;
+    words >> name >> condition;
+    if (!(words >> level) || (condition != ">" && condition != "<"))
+    {
+        std::cerr << "Rail level \"" << spec << "\": expected a rail, > or < and a level in volts." << std::endl;
+        return false;
+    }
+    for (int i = 0; i < railMonitorCount; i++)
+    {
+        const CommandName &command = commandNames[railMonitors[i].control];
+        if (name == command.name || name == command.pin)
+        {
+            railMonitors[i].onAbove = condition == ">";
+            railMonitors[i].level = level;
+            return true;
+        }
+    }
+    std::cerr << "Rail level \"" << spec << "\": unknown rail." << std::endl;
+    return false;
+}
+
+void startReconcile(bool resend)
+{
+    reconcileResend = resend;
+    for (int item = 0; item <= controlCount; item++)
+    {
+        ReconciledItem state = {-1, 0, -1, 0, 0};
+        reconciledItems[item] = state;
+    }
+    for (int i = 0; i < railMonitorCount; i++)
+    {
+        railColumns[i] = frameFieldIndex(HK_FRAME, railMonitors[i].field);
+    }
+    swpmonColumn = frameFieldIndex(ERPA_FRAME, "SWPMON");
+    int64_t now = currentTimeMs();
+    lastPacketMs[PMT_FRAME] = lastPacketMs[ERPA_FRAME] = lastPacketMs[HK_FRAME] = now; // Packets get packetSilenceMs to start
+    for (int control = 0; control < controlCount; control++)
+    {
+        controlChangedMs[control] = max(controlChangedMs[control], now);
+    }
+    sweepChangedMs = max(sweepChangedMs, now);
+}
+
+void observeItem(int item, int reading)
+{
+    ReconciledItem &state = reconciledItems[item];
+    if (reading != state.reading)
+    {
+        state.reading = reading;
+        state.agreeing = 0;
+    }
+    if (state.agreeing < reconcileFrames && ++state.agreeing == reconcileFrames)
+    {
+        state.observed = reading;
+    }
+}
+
+int nearestSweepStep(double volts)
+{
+    for (int step = 0; step < sweepSteps; step++)
+    {
+        if (fabs(volts - sweepStepVolts[step]) <= sweepStepTolerance)
+        {
+            return step;
+        }
+    }
+    return -1; // Between steps, e.g. while it moves
+}
+
+string describeItem(int item, int value)
+{
+    if (item == reconcileStep)
+    {
+        return "step " + to_string(value);
+    }
+    return string(commandNames[item].name) + (value ? " on" : " off");
+}
+
+// Sends what the GUI has for item again
+void resendItem(int item, int observed, int64_t now)
+{
+    if (item == reconcileStep)
+    {
+        unsigned char steps[sweepSteps];
+        int count = abs(sweepStep - observed);
+        for (int i = 0; i < count; i++)
+        {
+            steps[i] = sweepStep > observed ? 0x1B : 0x1C;
+        }
+        queueCommands(steps, count);
+        return;
+    }
+    unsigned char command = controlOn(item) ? commandNames[item].on : commandNames[item].off;
+    queueCommand(command);
+    journalControl(now, item, controlOn(item), command);
+}
+
+// Compares every settled reading with the GUI's state, flags and re-sends
+void reconcileControls(int64_t now)
+{
+    for (int control = CONTROL_PMT; control <= CONTROL_HK; control++)
+    {
+        int type = control == CONTROL_PMT ? PMT_FRAME : control == CONTROL_ERPA ? ERPA_FRAME : HK_FRAME;
+        if (now - lastPacketMs[type] <= packetSilenceMs)
+        {
+            continue;
+        }
+        reconciledItems[control].observed = 0;
+        reconciledItems[control].reading = -1;
+        // Readings taken from its frames are stale
+        if (type == ERPA_FRAME)
+        {
+            reconciledItems[reconcileStep].observed = -1;
+        }
+        for (int i = 0; type == HK_FRAME && i < railMonitorCount; i++)
+        {
+            reconciledItems[railMonitors[i].control].observed = -1;
+        }
+    }
+
+    uint32_t diverged = 0;
+    for (int item = 0; !reconcilePaused && item <= controlCount; item++)
+    {
+        ReconciledItem &state = reconciledItems[item];
+        int wanted = item == reconcileStep ? (sweepAuto ? -1 : sweepStep) : (int)controlOn(item);
+        int64_t commandedMs = item == reconcileStep ? sweepChangedMs : controlChangedMs[item];
+        if (commandedMs > state.resentMs)
+        {
+            state.retries = 0; // A new command, a new set of retries
+        }
+        if (state.observed == -1 || wanted == -1 || state.observed == wanted || now - commandedMs < reconcileSettleMs)
+        {
+            continue;
+        }
+        diverged |= 1u << item;
+        if (reconcileResend && replaysRunning == 0 && state.retries < reconcileRetries && now - state.resentMs >= reconcileRetryMs)
+        {
+            std::cerr << "Telemetry shows " << describeItem(item, state.observed) << ", sending "
+                      << describeItem(item, wanted) << " again." << std::endl;
+            resendItem(item, state.observed, now);
+            state.retries++;
+            state.resentMs = now;
+            if (state.retries == reconcileRetries)
+            {
+                std::cerr << describeItem(item, wanted) << " has been sent again " << reconcileRetries << " times, no more until the next command." << std::endl;
+            }
+        }
+    }
+
+    if (diverged == 0 && reconcileDiverged == 0)
+    {
+        return;
+    }
+    string summary = "in sync";
+    for (int item = 0; diverged != 0 && item <= controlCount; item++)
+    {
+        if ((diverged >> item) & 1)
+        {
+            summary = (summary == "in sync" ? "" : summary + ", ") + describeItem(item, reconciledItems[item].observed);
+        }
+    }
+    if (diverged != reconcileDiverged || summary != reconcileSummary)
+    {
+        reconcileDiverged = diverged;
+        reconcileSummary = summary;
+        reconcileVersion++;
+    }
+}
+
+// Called for every frame
+void reconcileFrame(const Frame &frame)
+{
+    int64_t now = currentTimeMs();
+    lastPacketMs[frame.type] = now;
+    observeItem(frame.type == PMT_FRAME ? CONTROL_PMT : frame.type == ERPA_FRAME ? CONTROL_ERPA : CONTROL_HK, 1);
+    if (frame.type == ERPA_FRAME && swpmonColumn != -1)
+    {
+        observeItem(reconcileStep, nearestSweepStep(frame.values[swpmonColumn]));
+    }
+    else if (frame.type == HK_FRAME)
+    {
+        for (int i = 0; i < railMonitorCount; i++)
+        {
+            const RailMonitor &rail = railMonitors[i];
+            if (!std::isnan(rail.level) && railColumns[i] != -1)
+            {
+                double value = frame.values[railColumns[i]];
+                observeItem(rail.control, rail.onAbove ? value > rail.level : value < rail.level);
+            }
+        }
+    }
+    reconcileControls(now);
+}
+
+#endif
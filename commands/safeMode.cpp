@@ -0,0 +1,232 @@
+// -------------------------- Safe Mode ---------------------------
+// The emergency lane: 800v_en off (0x14), n200v_en off (0x16), then sleep
+// (0x0C), written straight to the serial port by a thread that does nothing
+// else. It does not go through the command queue, so it never waits behind
+// queued commands or the UI:
+//  - the queue is held: it takes no new commands until followSafeMode() has
+//    brought the controls in line, so nothing re-enables a rail behind the
+//    safe bytes
+//  - running scripts are stopped, so none has a step half queued
+//  - the bytes in the command queue are dropped, since they were meant for
+//    before the emergency, so the transmit thread cannot refill the port
+//  - output still in the kernel's buffer is discarded (tcflush)
+//  - the three bytes are written, and the thread waits until they are out
+// What the transmit thread has already handed to the port, at most
+// commandPortLimit plus one write of commandBatchLimit bytes, can still go
+// out first.
+//
+// requestSafeMode() only writes a few bytes to a pipe, which is
+// async-signal-safe, so it is called from the SAFE MODE button and its
+// shortcut, from limits armed with --safe-on "HK temp1 > 60"
+// (triggers/trigger.cpp) and from the SIGUSR1 handler (kill -USR1 <pid>).
+// The thread asks for SCHED_FIFO and keeps the normal priority if that is not
+// allowed.
+//
+// Every run is written to logs/Commands/Safe <date time>.csv with how long it
+// took from the request to the bytes being written and to them being sent,
+// and the worst case is printed on quit. followSafeMode() then brings the
+// controls, the journal and the host sweep in line on the UI thread.
+#ifndef COMMANDS_SAFE_MODE_CPP
+#define COMMANDS_SAFE_MODE_CPP
+
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sched.h>
+#include <termios.h>
+#include <cerrno>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include "../frames/frame.cpp"
+#include "../triggers/trigger.cpp"
+#include "commandNames.cpp"
+#include "commandQueue.cpp"
+#include "controlState.cpp"
+#include "sequencer.cpp"
+#include "hostSweep.cpp"
+
+using namespace std;
+
+#define SAFE_FROM_BUTTON 1
+#define SAFE_FROM_LIMIT 2
+#define SAFE_FROM_SIGNAL 3
+
+const char *safeModeSources[4] = {"", "button", "limit", "signal"};
+const unsigned char safeModeCommands[3] = {0x14, 0x16, 0x0C}; // HV rails off before the MCU sleeps
+
+struct SafeModeRequest
+{
+    int source;
+    int64_t requestedNs; // steady_clock
+};
+
+int safeModeFd = -1;
+int safeModePipe[2] = {-1, -1};
+std::thread safeModeThread;
+std::atomic<unsigned> safeModeCount(0);  // Runs so far; followSafeMode() compares
+std::atomic<int64_t> safeModeLastMs(0);  // Wall clock of the last run
+FILE *safeModeLog = nullptr;             // Only the safe mode thread touches these
+double safeModeMaxWrittenUs = 0;
+double safeModeMaxSentUs = 0;
+bool safeModeRealtime = false;
+unsigned safeModeFollowed = 0;           // UI thread
+
+// Async-signal-safe
+void requestSafeMode(int source)
+{
+    SafeModeRequest request = {source, (int64_t)chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count()};
+    if (safeModePipe[1] != -1)
+    {
+        ssize_t written = write(safeModePipe[1], &request, sizeof(request));
+        (void)written; // If the pipe is full, runs are already waiting
+    }
+}
+
+void safeModeSignal(int)
+{
+    int savedErrno = errno;
+    requestSafeMode(SAFE_FROM_SIGNAL);
+    errno = savedErrno;
+}
+
+void safeModeLimit(const Trigger &)
+{
+    requestSafeMode(SAFE_FROM_LIMIT);
+}
+
+void runSafeMode()
+{
+    SafeModeRequest request;
+    while (true)
+    {
+        ssize_t got = read(safeModePipe[0], &request, sizeof(request));
+        if (got == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (got != sizeof(request))
+        {
+            break; // The write end was closed, quitting
+        }
+        holdCommands(true);
+        stopScripts("stopped, safe mode"); // Returns once no script is queueing
+        size_t dropped = dropQueuedCommands();
+        tcflush(safeModeFd, TCOFLUSH); // Fails harmlessly on a socket or a pipe
+        bool ok = writeCommandBytes(safeModeFd, safeModeCommands, sizeof(safeModeCommands));
+        chrono::steady_clock::time_point writtenAt = chrono::steady_clock::now();
+        tcdrain(safeModeFd);
+        chrono::steady_clock::time_point sentAt = chrono::steady_clock::now();
+        int64_t now = currentTimeMs();
+        safeModeLastMs = now;
+        safeModeCount++;
+
+        chrono::steady_clock::time_point requestedAt{chrono::duration_cast<chrono::steady_clock::duration>(chrono::nanoseconds(request.requestedNs))};
+        double writtenUs = chrono::duration<double, micro>(writtenAt - requestedAt).count();
+        double sentUs = chrono::duration<double, micro>(sentAt - requestedAt).count();
+        safeModeMaxWrittenUs = max(safeModeMaxWrittenUs, writtenUs);
+        safeModeMaxSentUs = max(safeModeMaxSentUs, sentUs);
+        const char *source = request.source >= 1 && request.source <= 3 ? safeModeSources[request.source] : "?";
+        if (safeModeLog != nullptr)
+        {
+            char row[128];
+            int length = formatLogTimestamp(now, row);
+            snprintf(row + length, sizeof(row) - length, ", %s, %s, %.0f, %.0f, %zu\n", source, ok ? "ok" : "write failed", writtenUs, sentUs, dropped);
+            fputs(row, safeModeLog);
+            fflush(safeModeLog);
+        }
+        std::cerr << "Safe mode (" << source << "): " << (ok ? "HV rails off and asleep" : "writing to the serial port failed")
+                  << ", " << (int)writtenUs << " us after the request; " << dropped << " queued commands dropped." << std::endl;
+    }
+}
+
+// Starts the thread for fd, the serial port, and installs the SIGUSR1 handler
+// and the limit handler; logName is the session name, as in the other logs
+void startSafeMode(int fd, const string &logName)
+{
+    if (fd == -1 || safeModeThread.joinable() || pipe(safeModePipe) != 0)
+    {
+        return;
+    }
+    fcntl(safeModePipe[1], F_SETFL, O_NONBLOCK); // A request never blocks, not even in a signal handler
+    safeModeFd = fd;
+    mkdir(COMMAND_DIRECTORY, 0755);
+    safeModeLog = fopen((string(COMMAND_DIRECTORY) + "/Safe " + logName + ".csv").c_str(), "w");
+    if (safeModeLog != nullptr)
+    {
+        fprintf(safeModeLog, "date, time, source, result, written us, sent us, dropped\n");
+        fflush(safeModeLog);
+    }
+    safeModeThread = std::thread(runSafeMode);
+    struct sched_param priority = {};
+    priority.sched_priority = sched_get_priority_max(SCHED_FIFO);
+    safeModeRealtime = pthread_setschedparam(safeModeThread.native_handle(), SCHED_FIFO, &priority) == 0;
+
+    struct sigaction action = {};
+    action.sa_handler = safeModeSignal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGUSR1, &action, nullptr);
+    triggerSafeModeHandler = safeModeLimit;
+}
+
+// UI thread: after a run, marks the rails off, journals the run, pauses the
+// reconciliation as Sleep does, stops the host sweep and lets commands be
+// queued again. True if there was one.
+bool followSafeMode()
+{
+    unsigned count = safeModeCount;
+    if (count == safeModeFollowed)
+    {
+        return false;
+    }
+    safeModeFollowed = count;
+    int64_t timestampMs = safeModeLastMs;
+    noteControlOff(CONTROL_800V, safeModeCommands[0], timestampMs);
+    noteControlOff(CONTROL_N200V, safeModeCommands[1], timestampMs);
+    journalCommand(timestampMs, safeModeCommands[2]);
+    reconcilePaused = true;
+    stopHostSweep("stopped, safe mode");
+    holdCommands(false);
+    return true;
+}
+
+// Prints the worst latency and stops the thread
+void stopSafeMode()
+{
+    if (!safeModeThread.joinable())
+    {
+        return;
+    }
+    signal(SIGUSR1, SIG_IGN);
+    triggerSafeModeHandler = nullptr;
+    int writeEnd = safeModePipe[1];
+    safeModePipe[1] = -1;
+    close(writeEnd); // Runs already requested are still made
+    safeModeThread.join();
+    if (safeModeCount > 0)
+    {
+        char summary[160];
+        snprintf(summary, sizeof(summary), "Safe mode ran %u times, written at most %.0f us and sent at most %.0f us after the request (%s priority).",
+                 (unsigned)safeModeCount, safeModeMaxWrittenUs, safeModeMaxSentUs, safeModeRealtime ? "real-time" : "normal");
+        std::cout << summary << std::endl;
+        if (safeModeLog != nullptr)
+        {
+            fprintf(safeModeLog, "# %s\n", summary);
+        }
+    }
+    if (safeModeLog != nullptr)
+    {
+        fclose(safeModeLog);
+        safeModeLog = nullptr;
+    }
+    close(safeModePipe[0]);
+    safeModePipe[0] = -1;
+}
+
+#endif
@@ -0,0 +1,650 @@
+// ---------------------- Command Sequencer ----------------------
+// Runs command scripts, e.g. a power-up procedure, off the UI thread. A script
+// is a text file with one step per line:
+//
+//   # Rails up, slowest first
+//   send sys_on on              by name (commands/commandNames.cpp) or as 0x00
+//   wait 200 ms                 or "wait 1.5 s"
+//   send 3v3_en on
+//   until HK 3v3mon > 3.2 within 2 s
+//   repeat 8                    up to the matching "end", may be nested
+//       send step_up
+//       wait 1 s
+//   end
+//   print rails are up
+//
+// Waits are measured from when the previous wait was due, not from when the
+// thread got round to it, so a script of waits does not drift. "until" waits
+// for the first frame meeting a condition (>, <, >=, <=, ==, != on any field,
+// as in the triggers) and stops the script if none comes within the timeout.
+//
+// Due steps are kept on a timing wheel of 1 ms slots that one thread turns;
+// it sleeps until the next occupied slot. Every step is written to
+// logs/Scripts with when it was due and how late it actually ran.
+//
+// What a script sends is also kept in scriptCommandsSent, with when it was
+// queued, for the UI thread to bring the controls in line with
+// (followScriptCommands in commands/controlState.cpp).
+//
+// A Controls log (.jsonl, .csv or .csv.gz, see logging/controlsLog.cpp) runs
+// as a script too: every command it recorded, at its original time from the
+// first one divided by controlsReplaySpeed. How late each step ran is then its
+// drift from the recorded session.
+#ifndef COMMANDS_SEQUENCER_CPP
+#define COMMANDS_SEQUENCER_CPP
+
+#include <sys/stat.h>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include "../frames/frame.cpp"
+#include "commandNames.cpp"
+#include "commandQueue.cpp"
+#include "../logging/controlsLog.cpp"
+
+using namespace std;
+
+#define SCRIPT_DIRECTORY "logs/Scripts"
+
+#define STEP_SEND 1
+#define STEP_WAIT 2
+#define STEP_UNTIL 3
+#define STEP_REPEAT 4
+#define STEP_END 5
+#define STEP_PRINT 6
+
+const int wheelSlots = 1024;               // One revolution is about a second
+const chrono::microseconds wheelTick(1000); // Slot width
+
+struct ScriptStep
+{
+    int kind;
+    int line;
+    unsigned char command;
+    chrono::microseconds duration; // wait, or the until timeout
+    int type;                      // until: packet and field to watch
+    int column;
+    string comparison;
+    double threshold;
+    int count;   // repeat
+    size_t jump; // repeat: the matching end; end: the repeat
+    string text; // The line as written
+};
+
+struct Script
+{
+    string name;
+    vector<ScriptStep> steps;
+    size_t next;                // Step to run when the timer fires
+    vector<int> loopsLeft;      // One per open repeat
+    chrono::steady_clock::time_point startedAt;
+    chrono::steady_clock::time_point dueAt; // When the step waited for was due
+    unsigned generation;        // Timers of an older generation are stale
+    bool watching;              // Blocked in an until
+    bool conditionMet;
+    chrono::steady_clock::time_point conditionMetAt;
+    FILE *log;
+    int stepsRun;
+    double totalLateUs;
+    double maxLateUs;
+    bool finished;
+    bool replay; // Loaded from a Controls log
+};
+
+struct WheelTimer
+{
+    Script *script;
+    unsigned generation;
+    int64_t dueTick;
+    chrono::steady_clock::time_point dueAt;
+};
+
+std::thread sequencerThread;
+std::mutex sequencerMutex; // Guards everything below
+std::condition_variable sequencerWake;
+vector<WheelTimer> wheel[wheelSlots];
+int64_t wheelTickNow = 0; // Tick the wheel was last turned to
+chrono::steady_clock::time_point wheelEpoch;
+vector<Script *> scripts;
+bool sequencerStopping = false;
+std::atomic<int> scriptsWatching(0); // Lets frames skip the lock when nobody waits on telemetry
+std::atomic<int> replaysRunning(0);  // Controls logs being replayed
+vector<pair<int64_t, unsigned char>> scriptCommandsSent; // Not by replays, taken by the UI thread
+double controlsReplaySpeed = 1;      // --controls-speed: 10 replays ten times faster, 0 without the waits
+
+// ------------------------- Parsing ---------------------------
+// "200 ms", "200ms", "1.5 s"
+bool parseDuration(istringstream &words, chrono::microseconds &duration)
+{
+    double amount;
+    string unit;
+    if (!(words >> amount) || amount < 0)
+    {
+        return false;
+    }
+    words >> unit;
+    if (unit == "ms")
+    {
+        duration = chrono::microseconds((int64_t)llround(amount * 1000));
+    }
+    else if (unit == "s")
+    {
+        duration = chrono::microseconds((int64_t)llround(amount * 1000000));
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+// Splits "200ms" into "200 ms" so durations can be written either way
+string spaceUnits(const string &line)
+{
+    string spaced;
+    for (size_t i = 0; i < line.size(); i++)
+    {
+        spaced += line[i];
+        if (isdigit((unsigned char)line[i]) && i + 1 < line.size() && (line[i + 1] == 'm' || line[i + 1] == 's'))
+        {
+            spaced += ' ';
+        }
+    }
+    return spaced;
+}
+
+bool scriptError(const string &path, int line, const string &message)
+{
+    std::cerr << path << ":" << line << ": " << message << std::endl;
+    return false;
+}
+
+bool loadScript(const string &path, Script &script)
+{
+    ifstream file(path);
+    if (!file.is_open())
+    {
+        std::cerr << "Cannot open the script " << path << "." << std::endl;
+        return false;
+    }
+    size_t slash = path.find_last_of('/');
+    script.name = path.substr(slash == string::npos ? 0 : slash + 1);
+    vector<size_t> open; // Indices of repeats without their end yet
+    string text;
+    for (int line = 1; getline(file, text); line++)
+    {
+        size_t hash = text.find('#');
+        string code = text.substr(0, hash);
+        istringstream words(code);
+        string keyword;
+        if (!(words >> keyword))
+        {
+            continue;
+        }
+        ScriptStep step = ScriptStep();
+        step.line = line;
+        step.text = code.substr(code.find_first_not_of(" \t"));
+        step.text.erase(step.text.find_last_not_of(" \t\r") + 1);
+        if (keyword == "send")
+        {
+            string name, state, extra;
+            words >> name >> state >> extra;
+            int command = commandByte(name, state);
+            if (command == -1 || !extra.empty())
+            {
+                return scriptError(path, line, "unknown command \"" + name + (state.empty() ? "" : " " + state) + "\"");
+            }
+            step.kind = STEP_SEND;
+            step.command = (unsigned char)command;
+        }
+        else if (keyword == "wait")
+        {
+            istringstream rest(spaceUnits(code.substr(code.find("wait") + 4)));
+            step.kind = STEP_WAIT;
+            if (!parseDuration(rest, step.duration))
+            {
+                return scriptError(path, line, "expected \"wait <number> ms\" or \"wait <number> s\"");
+            }
+        }
+        else if (keyword == "until")
+        {
+            string typeName, field, within;
+            words >> typeName >> field >> step.comparison >> step.threshold >> within;
+            step.kind = STEP_UNTIL;
+            step.type = frameTypeFromName(typeName);
+            step.column = step.type == 0 ? -1 : frameFieldIndex(step.type, field);
+            const char *comparisons[] = {">", "<", ">=", "<=", "==", "!="};
+            if (step.column == -1 || find(comparisons, comparisons + 6, step.comparison) == comparisons + 6 || !words)
+            {
+                return scriptError(path, line, "expected \"until <packet> <field> <comparison> <value> within <time>\"");
+            }
+            string rest;
+            getline(words, rest);
+            istringstream timeout(spaceUnits(rest));
+            if (within != "within" || !parseDuration(timeout, step.duration))
+            {
+                return scriptError(path, line, "an until needs \"within <time>\"");
+            }
+        }
+        else if (keyword == "repeat")
+        {
+            step.kind = STEP_REPEAT;
+            if (!(words >> step.count) || step.count < 1)
+            {
+                return scriptError(path, line, "expected \"repeat <count>\"");
+            }
+            open.push_back(script.steps.size());
+        }
+        else if (keyword == "end")
+        {
+            if (open.empty())
+            {
+                return scriptError(path, line, "end without repeat");
+            }
+            step.kind = STEP_END;
+            step.jump = open.back();
+            script.steps[open.back()].jump = script.steps.size();
+            open.pop_back();
+        }
+        else if (keyword == "print")
+        {
+            step.kind = STEP_PRINT;
+        }
+        else
+        {
+            return scriptError(path, line, "unknown step \"" + keyword + "\"");
+        }
+        script.steps.push_back(step);
+    }
+    if (!open.empty())
+    {
+        return scriptError(path, script.steps[open.back()].line, "repeat without end");
+    }
+    return true;
+}
+
+bool isControlsLog(const string &path)
+{
+    const char *endings[] = {".jsonl", ".csv", ".csv.gz"};
+    for (int i = 0; i < 3; i++)
+    {
+        size_t length = strlen(endings[i]);
+        if (path.size() > length && path.compare(path.size() - length, length, endings[i]) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// The commands of a Controls log as send steps, with waits for the time
+// between them. The starting states are not sent: the acquiring GUI starts with
+// everything off, as the reset leaves the instrument.
+bool loadControlsLog(const string &path, Script &script)
+{
+    vector<ControlsLogEvent> events;
+    if (!readControlsLog(path.c_str(), events))
+    {
+        return false;
+    }
+    size_t slash = path.find_last_of('/');
+    script.name = path.substr(slash == string::npos ? 0 : slash + 1);
+    script.replay = true;
+    int64_t firstMs = -1;
+    int64_t previousMs = -1;
+    for (size_t i = 0; i < events.size(); i++)
+    {
+        const ControlsLogEvent &event = events[i];
+        if (event.name == -1)
+        {
+            continue;
+        }
+        if (firstMs == -1)
+        {
+            firstMs = previousMs = event.timestampMs;
+        }
+        if (event.timestampMs > previousMs && controlsReplaySpeed > 0)
+        {
+            ScriptStep wait = ScriptStep();
+            wait.kind = STEP_WAIT;
+            wait.line = event.line;
+            wait.duration = chrono::microseconds((int64_t)llround((event.timestampMs - previousMs) * 1000 / controlsReplaySpeed));
+            wait.text = "wait " + to_string(wait.duration.count() / 1000) + " ms";
+            script.steps.push_back(wait);
+        }
+        previousMs = max(previousMs, event.timestampMs);
+        char text[64];
+        snprintf(text, sizeof(text), "send %s%s at %.3f s", commandNames[event.name].name,
+                 event.value == -1 ? "" : event.value ? " on" : " off", (event.timestampMs - firstMs) / 1000.0);
+        for (int sent = 0; sent < event.count; sent++)
+        {
+            ScriptStep step = ScriptStep();
+            step.kind = STEP_SEND;
+            step.line = event.line;
+            step.command = event.command;
+            step.text = text;
+            script.steps.push_back(step);
+        }
+    }
+    if (script.steps.empty())
+    {
+        std::cerr << "No commands in the Controls log " << path << "." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// ------------------------ Timing Wheel -----------------------
+int64_t tickOf(chrono::steady_clock::time_point time)
+{
+    return (time - wheelEpoch) / wheelTick;
+}
+
+// Caller holds sequencerMutex
+void scheduleScript(Script *script, chrono::steady_clock::time_point dueAt)
+{
+    WheelTimer timer = {script, script->generation, max(tickOf(dueAt), wheelTickNow), dueAt};
+    wheel[timer.dueTick % wheelSlots].push_back(timer);
+    sequencerWake.notify_one();
+}
+
+// Earliest time anything on the wheel is due, looking one revolution ahead
+bool nextWheelTime(chrono::steady_clock::time_point &next)
+{
+    for (int64_t tick = wheelTickNow; tick < wheelTickNow + wheelSlots; tick++)
+    {
+        const vector<WheelTimer> &slot = wheel[tick % wheelSlots];
+        bool found = false;
+        for (size_t i = 0; i < slot.size(); i++)
+        {
+            if (slot[i].dueTick == tick && (!found || slot[i].dueAt < next))
+            {
+                next = slot[i].dueAt;
+                found = true;
+            }
+        }
+        if (found)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// ------------------------- Running ---------------------------
+void logStep(Script &script, const ScriptStep &step, chrono::steady_clock::time_point dueAt, chrono::steady_clock::time_point ranAt, const string &note)
+{
+    double dueMs = chrono::duration<double, milli>(dueAt - script.startedAt).count();
+    double lateUs = chrono::duration<double, micro>(ranAt - dueAt).count();
+    script.stepsRun++;
+    script.totalLateUs += lateUs;
+    script.maxLateUs = max(script.maxLateUs, lateUs);
+    if (script.log != nullptr)
+    {
+        fprintf(script.log, "%d, %d, %s, %.3f, %.0f, %s\n", script.stepsRun, step.line, step.text.c_str(), dueMs, lateUs, note.c_str());
+    }
+}
+
+void finishScript(Script &script, const string &outcome)
+{
+    script.finished = true;
+    script.generation++;
+    if (script.replay)
+    {
+        replaysRunning--;
+    }
+    if (script.watching)
+    {
+        script.watching = false;
+        scriptsWatching--;
+    }
+    double meanLateUs = script.stepsRun > 0 ? script.totalLateUs / script.stepsRun : 0;
+    std::cout << "Script " << script.name << " " << outcome << ": " << script.stepsRun << " steps, "
+              << (int)meanLateUs << " us late on average, " << (int)script.maxLateUs << " us at most." << std::endl;
+    if (script.log != nullptr)
+    {
+        fprintf(script.log, "# %s\n", outcome.c_str());
+        fclose(script.log);
+        script.log = nullptr;
+    }
+}
+
+// Runs steps from script.next until one has to wait; the timer for script.dueAt fired at now
+void advanceScript(Script &script, chrono::steady_clock::time_point now)
+{
+    if (script.watching)
+    {
+        const ScriptStep &until = script.steps[script.next];
+        script.watching = false;
+        scriptsWatching--;
+        if (!script.conditionMet)
+        {
+            logStep(script, until, script.dueAt + until.duration, now, "timed out");
+            finishScript(script, "stopped, line " + to_string(until.line) + " timed out");
+            return;
+        }
+        // The schedule carries on from the frame that met the condition
+        logStep(script, until, script.conditionMetAt, now, "met after " + to_string(chrono::duration_cast<chrono::milliseconds>(script.conditionMetAt - script.dueAt).count()) + " ms");
+        script.dueAt = script.conditionMetAt;
+        script.next++;
+    }
+    while (script.next < script.steps.size())
+    {
+        ScriptStep &step = script.steps[script.next];
+        switch (step.kind)
+        {
+        case STEP_SEND:
+            queueCommand(step.command);
+            if (!script.replay) // The buttons do not follow a replay
+            {
+                scriptCommandsSent.push_back(make_pair(currentTimeMs(), step.command));
+            }
+            logStep(script, step, script.dueAt, now, commandDescription(step.command));
+            break;
+        case STEP_PRINT:
+        {
+            size_t message = step.text.find_first_not_of(" \t", 5);
+            std::cout << script.name << ": " << (message == string::npos ? "" : step.text.substr(message)) << std::endl;
+            logStep(script, step, script.dueAt, now, "");
+            break;
+        }
+        case STEP_WAIT:
+            script.dueAt += step.duration;
+            script.next++;
+            scheduleScript(&script, script.dueAt);
+            return;
+        case STEP_UNTIL:
+            logStep(script, step, script.dueAt, now, "watching");
+            script.watching = true;
+            script.conditionMet = false;
+            scriptsWatching++;
+            scheduleScript(&script, script.dueAt + step.duration); // The timeout
+            return;
+        case STEP_REPEAT:
+            script.loopsLeft.push_back(step.count);
+            break;
+        case STEP_END:
+            if (--script.loopsLeft.back() > 0)
+            {
+                script.next = step.jump; // Back to the repeat, then on to its first step
+            }
+            else
+            {
+                script.loopsLeft.pop_back();
+            }
+            break;
+        }
+        script.next++;
+    }
+    finishScript(script, "finished");
+}
+
+void runSequencer()
+{
+    std::unique_lock<std::mutex> lock(sequencerMutex);
+    while (!sequencerStopping)
+    {
+        chrono::steady_clock::time_point next;
+        if (nextWheelTime(next))
+        {
+            sequencerWake.wait_until(lock, next);
+        }
+        else
+        {
+            sequencerWake.wait_for(lock, wheelTick * wheelSlots);
+        }
+        chrono::steady_clock::time_point now = chrono::steady_clock::now();
+        int64_t nowTick = tickOf(now);
+        // Turn the wheel to now, at most one revolution. Timers a step schedules
+        // meanwhile land on this tick or later, so the next turn finds them.
+        int64_t fromTick = wheelTickNow;
+        wheelTickNow = nowTick;
+        for (int64_t tick = fromTick; tick <= min(nowTick, fromTick + wheelSlots - 1); tick++)
+        {
+            vector<WheelTimer> &slot = wheel[tick % wheelSlots];
+            for (size_t i = 0; i < slot.size();)
+            {
+                if (slot[i].dueTick > nowTick || (slot[i].dueTick == nowTick && slot[i].dueAt > now))
+                {
+                    i++; // A later revolution, or later in this tick
+                    continue;
+                }
+                WheelTimer timer = slot[i];
+                slot[i] = slot.back();
+                slot.pop_back();
+                if (timer.generation == timer.script->generation && !timer.script->finished)
+                {
+                    timer.script->generation++;
+                    advanceScript(*timer.script, now);
+                }
+            }
+        }
+    }
+    for (size_t i = 0; i < scripts.size(); i++)
+    {
+        if (!scripts[i]->finished)
+        {
+            finishScript(*scripts[i], "stopped, quitting");
+        }
+    }
+}
+
+// ------------------------ Interface --------------------------
+// Loads and starts a script or a Controls log; false if it does not parse
+bool runScript(const string &path)
+{
+    Script *script = new Script();
+    if (!(isControlsLog(path) ? loadControlsLog(path, *script) : loadScript(path, *script)))
+    {
+        delete script;
+        return false;
+    }
+    mkdir(SCRIPT_DIRECTORY, 0755);
+    time_t seconds = time(nullptr);
+    struct tm tm;
+    localtime_r(&seconds, &tm);
+    char stamp[32];
+    strftime(stamp, sizeof(stamp), "%Y-%m-%d %H-%M-%S", &tm);
+    string logPath = string(SCRIPT_DIRECTORY) + "/" + script->name + " " + stamp + ".csv";
+    script->log = fopen(logPath.c_str(), "w");
+    if (script->log != nullptr)
+    {
+        fprintf(script->log, "step, line, action, due ms, late us, note\n");
+    }
+
+    std::lock_guard<std::mutex> lock(sequencerMutex);
+    if (!sequencerThread.joinable())
+    {
+        wheelEpoch = chrono::steady_clock::now();
+        wheelTickNow = 0;
+        sequencerThread = std::thread(runSequencer);
+    }
+    script->startedAt = chrono::steady_clock::now();
+    script->dueAt = script->startedAt;
+    scripts.push_back(script);
+    replaysRunning += script->replay;
+    scheduleScript(script, script->dueAt);
+    return true;
+}
+
+// Called for every frame; wakes scripts waiting in an until the frame satisfies
+void sequencerFrame(const Frame &frame)
+{
+    if (scriptsWatching == 0)
+    {
+        return;
+    }
+    chrono::steady_clock::time_point now = chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(sequencerMutex);
+    for (size_t i = 0; i < scripts.size(); i++)
+    {
+        Script &script = *scripts[i];
+        if (!script.watching || script.conditionMet)
+        {
+            continue;
+        }
+        const ScriptStep &until = script.steps[script.next];
+        if (until.type != frame.type || until.column >= frame.count)
+        {
+            continue;
+        }
+        double value = frame.values[until.column];
+        const string &op = until.comparison;
+        bool met = op == ">" ? value > until.threshold : op == "<" ? value < until.threshold : op == ">=" ? value >= until.threshold : op == "<=" ? value <= until.threshold : op == "==" ? value == until.threshold : value != until.threshold;
+        if (met)
+        {
+            script.conditionMet = true;
+            script.conditionMetAt = now;
+            script.generation++; // Drops the timeout
+            scheduleScript(&script, now);
+        }
+    }
+}
+
+// Moves what scripts have sent since the last call into sent
+void takeScriptCommands(vector<pair<int64_t, unsigned char>> &sent)
+{
+    sent.clear();
+    std::lock_guard<std::mutex> lock(sequencerMutex);
+    sent.swap(scriptCommandsSent);
+}
+
+// Ends every running script, the sequencer keeps running
+void stopScripts(const string &outcome)
+{
+    std::lock_guard<std::mutex> lock(sequencerMutex);
+    for (size_t i = 0; i < scripts.size(); i++)
+    {
+        if (!scripts[i]->finished)
+        {
+            finishScript(*scripts[i], outcome);
+        }
+    }
+}
+
+// Stops every running script
+void stopSequencer()
+{
+    {
+        std::lock_guard<std::mutex> lock(sequencerMutex);
+        sequencerStopping = true;
+    }
+    sequencerWake.notify_one();
+    if (sequencerThread.joinable())
+    {
+        sequencerThread.join();
+    }
+}
+
+#endif
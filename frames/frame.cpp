@@ -0,0 +1,301 @@
+// ------------------------- Frames -----------------------
+// A decoded ERPA/PMT/HK packet in a fixed binary form. Everything downstream
+// of the interpreter (telemetry server, shared memory, history, ...) passes
+// these around instead of the per-field strings the panels display.
+#ifndef FRAMES_FRAME_CPP
+#define FRAMES_FRAME_CPP
+
+#include <stdint.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <chrono>
+#include <ctime>
+#include <ostream>
+#include <algorithm>
+
+using namespace std;
+
+#define ERPA_FRAME 1
+#define PMT_FRAME 2
+#define HK_FRAME 3
+#define MAX_FRAME_FIELDS 19
+
+const int frameFieldCounts[4] = {0, 7, 3, 19};
+const char *frameTypeNames[4] = {"", "ERPA", "PMT", "HK"};
+
+// Field names in log column order (ERPA_HEADER, PMT_HEADER, HK_HEADER without date and time)
+const char *erpaFieldNames[7] = {"sync", "seq", "endMon", "SWPMON", "temp1", "temp2", "adc"};
+const char *pmtFieldNames[3] = {"sync", "seq", "adc"};
+const char *hkFieldNames[19] = {"sync", "seq", "vsense", "vrefint", "temp1", "temp2", "temp3", "temp4", "busvmon", "busimon", "2v5mon", "3v3mon", "5vmon", "n3v3mon", "n5vmon", "15vmon", "5refmon", "n200vmon", "n800vmon"};
+
+struct Frame
+{
+    uint8_t type;        // ERPA_FRAME, PMT_FRAME or HK_FRAME
+    uint8_t count;       // Number of valid entries in values
+    uint16_t reserved;
+    uint32_t reserved2;
+    int64_t timestampMs; // Wall clock, milliseconds since epoch
+    double values[MAX_FRAME_FIELDS];
+};
+
+// --------------------- Field Name Lookup ---------------------
+const char **frameFieldNames(int type)
+{
+    switch (type)
+    {
+    case ERPA_FRAME:
+        return erpaFieldNames;
+    case PMT_FRAME:
+        return pmtFieldNames;
+    case HK_FRAME:
+        return hkFieldNames;
+    }
+    return nullptr;
+}
+
+int frameFieldIndex(int type, const string &name)
+{ // Returns -1 if the packet type has no such field
+    const char **names = frameFieldNames(type);
+    for (int i = 0; names != nullptr && i < frameFieldCounts[type]; i++)
+    {
+        if (name == names[i])
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int frameTypeFromName(const string &name)
+{ // Returns 0 for an unknown packet name
+    for (int type = ERPA_FRAME; type <= HK_FRAME; type++)
+    {
+        if (name == frameTypeNames[type])
+        {
+            return type;
+        }
+    }
+    return 0;
+}
+
+int64_t currentTimeMs()
+{
+    return chrono::duration_cast<chrono::milliseconds>(chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// ------------ Build A Frame From Interpreter Strings ---------
+// columns[i] is the index in fields holding log column i
+Frame makeFrame(int type, const string *fields, const int *columns, int64_t timestampMs)
+{
+    Frame frame = {};
+    frame.type = type;
+    frame.count = frameFieldCounts[type];
+    frame.timestampMs = timestampMs;
+    for (int i = 0; i < frame.count; i++)
+    {
+        // strtod understands the "0xAAAA" sync words as well as plain numbers
+        frame.values[i] = strtod(fields[columns[i]].c_str(), nullptr);
+    }
+    return frame;
+}
+
+// ---------------------- Wire Encoding ------------------------
+// Compact form used on sockets, little-endian and packed:
+//   0  uint8    FRAME_MAGIC
+//   1  uint8    type
+//   2  uint8    count
+//   3  uint8    reserved
+//   4  int64    timestampMs
+//  12  float32  values[count]
+#define FRAME_MAGIC 0xF5
+#define FRAME_WIRE_HEADER 12
+#define MAX_FRAME_WIRE_SIZE (FRAME_WIRE_HEADER + 4 * MAX_FRAME_FIELDS)
+
+size_t frameWireSize(int count)
+{
+    return FRAME_WIRE_HEADER + 4 * count;
+}
+
+size_t encodeFrame(const Frame &frame, unsigned char *out)
+{
+    out[0] = FRAME_MAGIC;
+    out[1] = frame.type;
+    out[2] = frame.count;
+    out[3] = 0;
+    memcpy(out + 4, &frame.timestampMs, sizeof(int64_t));
+    for (int i = 0; i < frame.count; i++)
+    {
+        float value = (float)frame.values[i];
+        memcpy(out + FRAME_WIRE_HEADER + 4 * i, &value, sizeof(float));
+    }
+    return frameWireSize(frame.count);
+}
+
+// Returns the size of the encoded frame at the start of data, 0 if more bytes
+// are needed and -1 if data does not start with a valid frame
+long encodedFrameSize(const unsigned char *data, size_t length)
+{
+    if (length < 3)
+    {
+        return 0;
+    }
+    if (data[0] != FRAME_MAGIC || data[1] < ERPA_FRAME || data[1] > HK_FRAME || data[2] != frameFieldCounts[data[1]])
+    {
+        return -1;
+    }
+    size_t size = frameWireSize(data[2]);
+    return length < size ? 0 : (long)size;
+}
+
+void decodeFrame(const unsigned char *data, Frame &frame)
+{ // data must hold a complete frame (see encodedFrameSize)
+    frame = Frame();
+    frame.type = data[1];
+    frame.count = data[2];
+    memcpy(&frame.timestampMs, data + 4, sizeof(int64_t));
+    for (int i = 0; i < frame.count; i++)
+    {
+        float value;
+        memcpy(&value, data + FRAME_WIRE_HEADER + 4 * i, sizeof(float));
+        frame.values[i] = value;
+    }
+}
+
+// ---------------- Zero-Copy View Of An Encoded Frame ---------
+// Reads fields straight out of a receive buffer; the buffer must outlive the view
+struct FrameView
+{
+    const unsigned char *data;
+
+    int type() const
+    {
+        return data[1];
+    }
+    int count() const
+    {
+        return data[2];
+    }
+    int64_t timestampMs() const
+    {
+        int64_t timestamp;
+        memcpy(&timestamp, data + 4, sizeof(int64_t));
+        return timestamp;
+    }
+    double value(int column) const
+    {
+        float value;
+        memcpy(&value, data + FRAME_WIRE_HEADER + 4 * column, sizeof(float));
+        return value;
+    }
+};
+
+// ------------- Back To Interpreter Style Strings -------------
+// The panels are driven by "<letter>:<value>" strings from interpret(); these
+// tables give the letter and printf format interpret() uses for each log column
+const char *interpreterLetters[4] = {"", "abcdefg", "ijk", "lmnopqrstuvwxyzABCD"};
+
+const char *interpreterFormat(int type, int column)
+{
+    bool hk = type == HK_FRAME;
+    if (column == 0)
+    {
+        return hk ? "0x%X " : "0x%X";
+    }
+    if (column == 1)
+    {
+        return hk ? "%04d " : "%04d";
+    }
+    if (!hk && column == frameFieldCounts[type] - 1)
+    {
+        return "%08.7f"; // ERPA and PMT eADC are 16 bit
+    }
+    return "%06.5f";
+}
+
+// Prints one value exactly as interpret() does, which is also how it appears in the logs
+int formatFrameValue(int type, int column, double value, char *out, size_t size)
+{
+    if (column < 2)
+    {
+        return snprintf(out, size, interpreterFormat(type, column), (int)value);
+    }
+    return snprintf(out, size, interpreterFormat(type, column), value);
+}
+
+string interpreterString(int type, int column, double value)
+{
+    char result[64];
+    result[0] = interpreterLetters[type][column];
+    result[1] = ':';
+    formatFrameValue(type, column, value, result + 2, sizeof(result) - 2);
+    return result;
+}
+
+// -------------------- Log Row Timestamps ---------------------
+// Rows start with "MM-DD-YYYY, HH:MM:SS:ms" in local time, ms not zero padded
+// as the logs always had it. localtime_r and strftime run once per second per
+// thread; every other row copies the cached prefix and appends the ms digits.
+struct TimestampCache
+{
+    int64_t second;
+    char prefix[32];
+    int length;
+};
+
+thread_local TimestampCache timestampCache = {-1, {0}, 0};
+
+// out needs room for 32 bytes; returns the number written (no terminator)
+int formatLogTimestamp(int64_t timestampMs, char *out)
+{
+    int64_t second = timestampMs / 1000;
+    int ms = (int)(timestampMs % 1000);
+    TimestampCache &cache = timestampCache;
+    if (second != cache.second)
+    {
+        time_t seconds = second;
+        struct tm tm;
+        localtime_r(&seconds, &tm);
+        cache.length = strftime(cache.prefix, sizeof(cache.prefix), "%m-%d-%Y, %H:%M:%S:", &tm);
+        cache.second = second;
+    }
+    memcpy(out, cache.prefix, cache.length);
+    char *digit = out + cache.length;
+    if (ms >= 100)
+    {
+        *digit++ = '0' + ms / 100;
+    }
+    if (ms >= 10)
+    {
+        *digit++ = '0' + ms / 10 % 10;
+    }
+    *digit++ = '0' + ms % 10;
+    return digit - out;
+}
+
+// One CSV row as in logs/ERPA, logs/PMT and logs/HK: date, time:ms, then the
+// values. row needs room for 512 bytes; returns the length written.
+int formatFrameRow(const Frame &frame, char *row)
+{
+    const int size = 512;
+    int length = formatLogTimestamp(frame.timestampMs, row);
+    for (int i = 0; i < frame.count; i++)
+    {
+        row[length++] = ',';
+        row[length++] = ' ';
+        int room = size - length - 1; // Keep one byte for the newline
+        int written = formatFrameValue(frame.type, i, frame.values[i], row + length, room);
+        length += min(written, room - 1);
+    }
+    row[length++] = '\n';
+    return length;
+}
+
+void writeFrameRow(ostream &stream, const Frame &frame)
+{
+    char row[512];
+    stream.write(row, formatFrameRow(frame, row));
+}
+
+#endif
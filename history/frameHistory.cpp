@@ -0,0 +1,65 @@
+// --------------------- Frame History --------------------------
+// Bounded in-memory history of the most recent decoded frames, one queue per
+// packet type. Each queue is limited both by age (relative to its newest frame)
+// and by bytes, whichever is hit first. RECORD uses it to put the seconds
+// before the button was pressed at the top of the new log files.
+#ifndef HISTORY_FRAME_HISTORY_CPP
+#define HISTORY_FRAME_HISTORY_CPP
+
+#include <deque>
+#include <vector>
+#include <algorithm>
+#include "../frames/frame.cpp"
+
+using namespace std;
+
+struct FrameHistory
+{
+    deque<Frame> frames[HK_FRAME + 1]; // Indexed by packet type
+    int64_t maxAgeMs;
+    size_t maxBytes; // Per packet type
+};
+
+FrameHistory frameHistory = {{}, 30 * 1000, 16 * 1024 * 1024};
+
+void setHistoryLimits(int64_t maxAgeMs, size_t maxBytes)
+{
+    frameHistory.maxAgeMs = maxAgeMs;
+    frameHistory.maxBytes = maxBytes;
+}
+
+void recordHistory(const Frame &frame)
+{
+    if (frameHistory.maxAgeMs <= 0 || frameHistory.maxBytes < sizeof(Frame))
+    {
+        return; // History disabled
+    }
+    deque<Frame> &frames = frameHistory.frames[frame.type];
+    frames.push_back(frame);
+    size_t maxFrames = frameHistory.maxBytes / sizeof(Frame);
+    while (frames.size() > maxFrames || frames.front().timestampMs < frame.timestampMs - frameHistory.maxAgeMs)
+    {
+        frames.pop_front();
+    }
+}
+
+// Forgets every held frame, e.g. when a replay seeks
+void clearHistory()
+{
+    for (int type = ERPA_FRAME; type <= HK_FRAME; type++)
+    {
+        frameHistory.frames[type].clear();
+    }
+}
+
+// Copies out the held frames of one packet type at or after fromMs, oldest first
+vector<Frame> historySince(int type, int64_t fromMs)
+{
+    const deque<Frame> &frames = frameHistory.frames[type];
+    deque<Frame>::const_iterator first = lower_bound(frames.begin(), frames.end(), fromMs,
+                                                     [](const Frame &frame, int64_t ms)
+                                                     { return frame.timestampMs < ms; });
+    return vector<Frame>(first, frames.end());
+}
+
+#endif
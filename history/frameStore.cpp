@@ -0,0 +1,513 @@
+// ----------------------- Frame Store --------------------------
+// Compressed in-memory history of every decoded frame, for scrolling back
+// through hours of data. Per packet type the frames are collected into blocks
+// of storeBlockFrames rows; a full block is compressed column by column. The
+// timestamps, and every channel whose values in the block are all decimals
+// with at most 7 places (sync, seq and whatever interpret() printed), are
+// stored as scaled integers in delta-of-delta form. Any other channel is XOR
+// encoded against its previous value (the Gorilla scheme). Every block keeps
+// its time span and the min/max of each channel, so range scans skip whole
+// blocks and a plot can be drawn from the summaries alone. Over the memory
+// budget the oldest compressed block, of any type, is dropped. Frames are
+// expected in time order, which is how dispatchFrame() delivers them; only the
+// main thread touches the store.
+#ifndef HISTORY_FRAME_STORE_CPP
+#define HISTORY_FRAME_STORE_CPP
+
+#include <stdint.h>
+#include <cmath>
+#include <cstring>
+#include <deque>
+#include <vector>
+#include <algorithm>
+#include "../frames/frame.cpp"
+
+using namespace std;
+
+const uint32_t storeBlockFrames = 1024;
+
+// ------------------------ Bit Streams ------------------------
+struct BitStream
+{
+    vector<uint64_t> words;
+    uint64_t bits; // Number of bits written
+};
+
+// Appends the low count bits of value, 1 <= count <= 64
+void writeBits(BitStream &stream, uint64_t value, int count)
+{
+    if (count < 64)
+    {
+        value &= (1ULL << count) - 1;
+    }
+    int used = stream.bits & 63;
+    if (used == 0)
+    {
+        stream.words.push_back(value);
+    }
+    else
+    {
+        stream.words.back() |= value << used;
+        if (used + count > 64)
+        {
+            stream.words.push_back(value >> (64 - used));
+        }
+    }
+    stream.bits += count;
+}
+
+struct BitReader
+{
+    const uint64_t *words;
+    uint64_t position;
+};
+
+uint64_t readBits(BitReader &reader, int count)
+{
+    const uint64_t *word = reader.words + (reader.position >> 6);
+    int used = reader.position & 63;
+    uint64_t value = word[0] >> used;
+    if (used + count > 64)
+    {
+        value |= word[1] << (64 - used);
+    }
+    reader.position += count;
+    return count == 64 ? value : value & ((1ULL << count) - 1);
+}
+
+// ---------------------- Column Encodings ---------------------
+// previous holds the last integer, or the bits of the last double
+struct ColumnState
+{
+    int64_t previous;
+    int64_t delta;
+    int leading; // XOR window of the last value, -1 before the first
+    int trailing;
+};
+
+const ColumnState emptyColumnState = {0, 0, -1, 0};
+
+const double powersOfTen[8] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7};
+
+// value * 10^places as an integer, if dividing that by 10^places gives value back exactly
+bool scaleDecimal(double value, int places, int64_t &scaled)
+{
+    double product = value * powersOfTen[places];
+    if (!(fabs(product) < 9e15) || (value == 0 && signbit(value)))
+    {
+        return false;
+    }
+    scaled = llround(product);
+    return (double)scaled / powersOfTen[places] == value;
+}
+
+// Delta-of-delta of value * 10^places, zigzag, in buckets:
+//   0            dod == 0
+//   10 + 7 bits, 110 + 9 bits, 1110 + 12 bits, 11110 + 64 bits
+//   11111 + 64   a value that does not scale (NaN, -0, more places), as raw double bits
+void encodeDecimal(BitStream &stream, ColumnState &state, double value, int places)
+{
+    int64_t integer;
+    if (!scaleDecimal(value, places, integer))
+    {
+        uint64_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        writeBits(stream, 0x1F, 5);
+        writeBits(stream, bits, 64);
+        return;
+    }
+    int64_t delta = integer - state.previous;
+    int64_t dod = delta - state.delta;
+    uint64_t zigzag = ((uint64_t)dod << 1) ^ (uint64_t)(dod >> 63);
+    state.previous = integer;
+    state.delta = delta;
+    if (zigzag == 0)
+    {
+        writeBits(stream, 0, 1);
+    }
+    else if (zigzag < (1 << 7))
+    {
+        writeBits(stream, 0x1, 2); // Bits are written low first: 1 then 0
+        writeBits(stream, zigzag, 7);
+    }
+    else if (zigzag < (1 << 9))
+    {
+        writeBits(stream, 0x3, 3);
+        writeBits(stream, zigzag, 9);
+    }
+    else if (zigzag < (1 << 12))
+    {
+        writeBits(stream, 0x7, 4);
+        writeBits(stream, zigzag, 12);
+    }
+    else
+    {
+        writeBits(stream, 0xF, 5);
+        writeBits(stream, zigzag, 64);
+    }
+}
+
+double decodeDecimal(BitReader &reader, ColumnState &state, int places)
+{
+    int ones = 0;
+    while (ones < 5 && readBits(reader, 1) == 1)
+    {
+        ones++;
+    }
+    static const int widths[5] = {0, 7, 9, 12, 64};
+    if (ones == 5)
+    {
+        uint64_t bits = readBits(reader, 64);
+        double value;
+        memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+    uint64_t zigzag = ones == 0 ? 0 : readBits(reader, widths[ones]);
+    int64_t dod = (int64_t)(zigzag >> 1) ^ -(int64_t)(zigzag & 1);
+    state.delta += dod;
+    state.previous += state.delta;
+    return (double)state.previous / powersOfTen[places];
+}
+
+// Channels. XOR with the previous value:
+//   0                                  same value
+//   10 + meaningful bits               fits in the previous leading/trailing zero window
+//   11 + 5 bits leading zeros + 6 bits length - 1 + meaningful bits
+void encodeFloat(BitStream &stream, ColumnState &state, double value)
+{
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint64_t xorBits = bits ^ (uint64_t)state.previous;
+    state.previous = (int64_t)bits;
+    if (xorBits == 0)
+    {
+        writeBits(stream, 0, 1);
+        return;
+    }
+    int leading = min(__builtin_clzll(xorBits), 31);
+    int trailing = __builtin_ctzll(xorBits);
+    if (state.leading >= 0 && leading >= state.leading && trailing >= state.trailing)
+    {
+        writeBits(stream, 0x1, 2);
+        writeBits(stream, xorBits >> state.trailing, 64 - state.leading - state.trailing);
+        return;
+    }
+    int meaningful = 64 - leading - trailing;
+    writeBits(stream, 0x3, 2);
+    writeBits(stream, leading, 5);
+    writeBits(stream, meaningful - 1, 6);
+    writeBits(stream, xorBits >> trailing, meaningful);
+    state.leading = leading;
+    state.trailing = trailing;
+}
+
+double decodeFloat(BitReader &reader, ColumnState &state)
+{
+    if (readBits(reader, 1) == 1)
+    {
+        if (readBits(reader, 1) == 1)
+        {
+            state.leading = (int)readBits(reader, 5);
+            int meaningful = (int)readBits(reader, 6) + 1;
+            state.trailing = 64 - state.leading - meaningful;
+        }
+        int meaningful = 64 - state.leading - state.trailing;
+        state.previous ^= (int64_t)(readBits(reader, meaningful) << state.trailing);
+    }
+    double value;
+    memcpy(&value, &state.previous, sizeof(value));
+    return value;
+}
+
+// Fewest decimal places that hold every value of a column (NaN and -0 aside), -1 for none
+int decimalPlaces(const vector<Frame> &frames, int column)
+{
+    for (int places = 0; places < 8; places++)
+    {
+        bool all = true;
+        int64_t scaled;
+        for (size_t i = 0; i < frames.size() && all; i++)
+        {
+            double value = frames[i].values[column];
+            all = scaleDecimal(value, places, scaled) || value != value || value == 0;
+        }
+        if (all)
+        {
+            return places;
+        }
+    }
+    return -1;
+}
+
+double decodeColumn(BitReader &reader, ColumnState &state, int places)
+{
+    return places < 0 ? decodeFloat(reader, state) : decodeDecimal(reader, state, places);
+}
+
+// -------------------------- Blocks ---------------------------
+struct StoreBlock
+{
+    int64_t firstMs;
+    int64_t lastMs;
+    uint32_t count;
+    uint8_t fields;
+    int8_t places[MAX_FRAME_FIELDS + 1]; // Decimal places of each column, -1 for XOR; [0] is the timestamps
+    double min[MAX_FRAME_FIELDS];        // NaN values are left out of the summaries
+    double max[MAX_FRAME_FIELDS];
+    BitStream columns[MAX_FRAME_FIELDS + 1];
+};
+
+struct StoreSummary
+{
+    int64_t firstMs;
+    int64_t lastMs;
+    uint32_t count;
+    double min;
+    double max;
+};
+
+struct FrameStore
+{
+    deque<StoreBlock> blocks[HK_FRAME + 1]; // Indexed by packet type, compressed, oldest first
+    vector<Frame> open[HK_FRAME + 1];       // Frames after the last block, not compressed yet
+    size_t bytes;                           // Compressed blocks only
+    size_t maxBytes;                        // 0 disables the store
+};
+
+FrameStore frameStore = {};
+
+size_t storeBlockBytes(const StoreBlock &block)
+{
+    size_t bytes = sizeof(StoreBlock);
+    for (int c = 0; c <= block.fields; c++)
+    {
+        bytes += block.columns[c].words.capacity() * sizeof(uint64_t);
+    }
+    return bytes;
+}
+
+size_t storeBytes()
+{
+    return frameStore.bytes + 3 * storeBlockFrames * sizeof(Frame); // Open blocks at their largest
+}
+
+void setStoreBudget(size_t maxBytes)
+{
+    frameStore.maxBytes = maxBytes;
+}
+
+// Drops the oldest blocks until the store fits its budget again
+void trimFrameStore()
+{
+    while (storeBytes() > frameStore.maxBytes)
+    {
+        int oldest = 0;
+        for (int type = ERPA_FRAME; type <= HK_FRAME; type++)
+        {
+            deque<StoreBlock> &blocks = frameStore.blocks[type];
+            if (!blocks.empty() && (oldest == 0 || blocks.front().firstMs < frameStore.blocks[oldest].front().firstMs))
+            {
+                oldest = type;
+            }
+        }
+        if (oldest == 0)
+        {
+            return;
+        }
+        frameStore.bytes -= storeBlockBytes(frameStore.blocks[oldest].front());
+        frameStore.blocks[oldest].pop_front();
+    }
+}
+
+void compressStoreBlock(int type)
+{
+    vector<Frame> &frames = frameStore.open[type];
+    frameStore.blocks[type].push_back(StoreBlock());
+    StoreBlock &block = frameStore.blocks[type].back();
+    block.firstMs = frames.front().timestampMs;
+    block.lastMs = frames.back().timestampMs;
+    block.count = frames.size();
+    block.fields = frames.front().count;
+    block.places[0] = 0;
+    ColumnState state = emptyColumnState;
+    for (size_t i = 0; i < frames.size(); i++)
+    {
+        encodeDecimal(block.columns[0], state, (double)frames[i].timestampMs, 0);
+    }
+    for (int c = 0; c < block.fields; c++)
+    {
+        int places = decimalPlaces(frames, c);
+        BitStream &stream = block.columns[c + 1];
+        block.places[c + 1] = places;
+        block.min[c] = INFINITY;
+        block.max[c] = -INFINITY;
+        state = emptyColumnState;
+        for (size_t i = 0; i < frames.size(); i++)
+        {
+            double value = frames[i].values[c];
+            if (places >= 0)
+            {
+                encodeDecimal(stream, state, value, places);
+            }
+            else
+            {
+                encodeFloat(stream, state, value);
+            }
+            block.min[c] = value < block.min[c] ? value : block.min[c];
+            block.max[c] = value > block.max[c] ? value : block.max[c];
+        }
+        stream.words.shrink_to_fit();
+    }
+    block.columns[0].words.shrink_to_fit();
+    frameStore.bytes += storeBlockBytes(block);
+    frames.clear();
+    trimFrameStore();
+}
+
+void storeFrame(const Frame &frame)
+{
+    if (frameStore.maxBytes == 0)
+    {
+        return;
+    }
+    vector<Frame> &open = frameStore.open[frame.type];
+    open.push_back(frame);
+    if (open.size() == storeBlockFrames)
+    {
+        compressStoreBlock(frame.type);
+    }
+}
+
+// Empties the store, e.g. when a replay seeks; the scans expect frames in time order
+void clearFrameStore()
+{
+    for (int type = ERPA_FRAME; type <= HK_FRAME; type++)
+    {
+        frameStore.blocks[type].clear();
+        frameStore.open[type].clear();
+    }
+    frameStore.bytes = 0;
+}
+
+// ------------------------ Range Scans ------------------------
+// First block that can hold frames at or after fromMs
+deque<StoreBlock>::const_iterator firstStoreBlock(const deque<StoreBlock> &blocks, int64_t fromMs)
+{
+    return lower_bound(blocks.begin(), blocks.end(), fromMs,
+                       [](const StoreBlock &block, int64_t ms)
+                       { return block.lastMs < ms; });
+}
+
+// Appends the frames of one packet type with fromMs <= time < toMs, oldest first
+size_t scanStore(int type, int64_t fromMs, int64_t toMs, vector<Frame> &frames)
+{
+    size_t found = 0;
+    const deque<StoreBlock> &blocks = frameStore.blocks[type];
+    for (deque<StoreBlock>::const_iterator block = firstStoreBlock(blocks, fromMs); block != blocks.end() && block->firstMs < toMs; ++block)
+    {
+        BitReader readers[MAX_FRAME_FIELDS + 1];
+        ColumnState states[MAX_FRAME_FIELDS + 1];
+        for (int c = 0; c <= block->fields; c++)
+        {
+            readers[c] = {block->columns[c].words.data(), 0};
+            states[c] = emptyColumnState;
+        }
+        for (uint32_t row = 0; row < block->count; row++)
+        {
+            Frame frame = {};
+            frame.type = type;
+            frame.count = block->fields;
+            frame.timestampMs = (int64_t)decodeDecimal(readers[0], states[0], 0);
+            for (int c = 0; c < block->fields; c++)
+            {
+                frame.values[c] = decodeColumn(readers[c + 1], states[c + 1], block->places[c + 1]);
+            }
+            if (frame.timestampMs >= fromMs && frame.timestampMs < toMs)
+            {
+                frames.push_back(frame);
+                found++;
+            }
+        }
+    }
+    const vector<Frame> &open = frameStore.open[type];
+    for (size_t i = 0; i < open.size(); i++)
+    {
+        if (open[i].timestampMs >= fromMs && open[i].timestampMs < toMs)
+        {
+            frames.push_back(open[i]);
+            found++;
+        }
+    }
+    return found;
+}
+
+// Like scanStore for a single log column; only that column is decoded
+size_t scanStoreChannel(int type, int column, int64_t fromMs, int64_t toMs, vector<int64_t> &times, vector<double> &values)
+{
+    size_t found = 0;
+    const deque<StoreBlock> &blocks = frameStore.blocks[type];
+    for (deque<StoreBlock>::const_iterator block = firstStoreBlock(blocks, fromMs); block != blocks.end() && block->firstMs < toMs; ++block)
+    {
+        if (column >= block->fields)
+        {
+            continue;
+        }
+        BitReader timeReader = {block->columns[0].words.data(), 0};
+        BitReader valueReader = {block->columns[column + 1].words.data(), 0};
+        ColumnState timeState = emptyColumnState, valueState = emptyColumnState;
+        for (uint32_t row = 0; row < block->count; row++)
+        {
+            int64_t timestampMs = (int64_t)decodeDecimal(timeReader, timeState, 0);
+            double value = decodeColumn(valueReader, valueState, block->places[column + 1]);
+            if (timestampMs >= fromMs && timestampMs < toMs)
+            {
+                times.push_back(timestampMs);
+                values.push_back(value);
+                found++;
+            }
+        }
+    }
+    const vector<Frame> &open = frameStore.open[type];
+    for (size_t i = 0; i < open.size(); i++)
+    {
+        if (open[i].timestampMs >= fromMs && open[i].timestampMs < toMs && column < open[i].count)
+        {
+            times.push_back(open[i].timestampMs);
+            values.push_back(open[i].values[column]);
+            found++;
+        }
+    }
+    return found;
+}
+
+// Time span and min/max of one column for every block overlapping [fromMs, toMs).
+// Compressed blocks are not decoded; the open block is summarised as a whole.
+size_t storeSummaries(int type, int column, int64_t fromMs, int64_t toMs, vector<StoreSummary> &summaries)
+{
+    size_t found = 0;
+    const deque<StoreBlock> &blocks = frameStore.blocks[type];
+    for (deque<StoreBlock>::const_iterator block = firstStoreBlock(blocks, fromMs); block != blocks.end() && block->firstMs < toMs; ++block)
+    {
+        if (column < block->fields)
+        {
+            summaries.push_back({block->firstMs, block->lastMs, block->count, block->min[column], block->max[column]});
+            found++;
+        }
+    }
+    const vector<Frame> &open = frameStore.open[type];
+    if (!open.empty() && column < open[0].count && open.back().timestampMs >= fromMs && open[0].timestampMs < toMs)
+    {
+        StoreSummary summary = {open[0].timestampMs, open.back().timestampMs, (uint32_t)open.size(), INFINITY, -INFINITY};
+        for (size_t i = 0; i < open.size(); i++)
+        {
+            double value = open[i].values[column];
+            summary.min = value < summary.min ? value : summary.min;
+            summary.max = value > summary.max ? value : summary.max;
+        }
+        summaries.push_back(summary);
+        found++;
+    }
+    return found;
+}
+
+#endif
@@ -0,0 +1,71 @@
+// --------------------- History Flush Thread --------------------
+// Writing the held history to disk can take a while, so it is done on a thread
+// of its own and the decode loop keeps running: RECORD hands it the history
+// that goes at the top of the new logs, and a trigger the frames before it
+// fired (triggers/trigger.cpp). The tasks run one after another, in the order
+// they were handed over.
+//
+// While historyFlushing is set, whatever writes to the same files must go
+// through flushInBackground too, or its rows would land before the history.
+// The tasks are started from the UI thread only.
+#ifndef HISTORY_HISTORY_FLUSH_CPP
+#define HISTORY_HISTORY_FLUSH_CPP
+
+#include <deque>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <atomic>
+
+using namespace std;
+
+std::thread historyFlushThread;
+std::atomic<bool> historyFlushing(false);
+std::mutex historyFlushMutex;
+deque<function<void()>> historyFlushTasks;
+
+void runHistoryFlush()
+{
+    while (true)
+    {
+        function<void()> task;
+        {
+            lock_guard<mutex> lock(historyFlushMutex);
+            if (historyFlushTasks.empty())
+            {
+                historyFlushing = false;
+                return;
+            }
+            task = historyFlushTasks.front();
+            historyFlushTasks.pop_front();
+        }
+        task();
+    }
+}
+
+// Runs task on the flush thread, after the tasks it already has
+void flushInBackground(const function<void()> &task)
+{
+    lock_guard<mutex> lock(historyFlushMutex);
+    historyFlushTasks.push_back(task);
+    if (!historyFlushing)
+    {
+        if (historyFlushThread.joinable())
+        {
+            historyFlushThread.join(); // Already out of its loop
+        }
+        historyFlushing = true;
+        historyFlushThread = std::thread(runHistoryFlush);
+    }
+}
+
+// Waits until every task has been written
+void finishHistoryFlush()
+{
+    if (historyFlushThread.joinable())
+    {
+        historyFlushThread.join();
+    }
+}
+
+#endif
@@ -0,0 +1,158 @@
+// ----------------------- History Plot -------------------------
+// FLTK widget plotting one channel from its min/max pyramid: a min-max bar and
+// the mean for every pixel column, so a redraw costs O(width) whatever the
+// span. The mouse wheel zooms around the pointer, dragging pans, and a double
+// click goes back to following the newest samples.
+#ifndef HISTORY_HISTORY_PLOT_CPP
+#define HISTORY_HISTORY_PLOT_CPP
+
+#include <FL/Fl.H>
+#include <FL/Fl_Widget.H>
+#include <FL/fl_draw.H>
+#include <cstdio>
+#include <cmath>
+#include <vector>
+#include "minMaxPyramid.cpp"
+
+using namespace std;
+
+class HistoryPlot : public Fl_Widget
+{
+public:
+    MinMaxPyramid *pyramid; // Channel shown, nullptr for none
+    int64_t spanMs;
+    int64_t endMs; // Right edge, -1 to follow the newest sample
+    int dragX;
+    int64_t dragEndMs;
+    vector<PyramidBucket> columns;
+
+    HistoryPlot(int x, int y, int w, int h) : Fl_Widget(x, y, w, h), pyramid(nullptr), spanMs(10 * 60 * 1000), endMs(-1), dragX(0), dragEndMs(0)
+    {
+        color(fl_rgb_color(28, 28, 30));
+    }
+
+    int64_t rightEdgeMs() const
+    {
+        if (endMs >= 0 || pyramid == nullptr)
+        {
+            return endMs;
+        }
+        int64_t newest = pyramidEndMs(*pyramid);
+        return newest == INT64_MIN ? currentTimeMs() : newest;
+    }
+
+    void draw()
+    {
+        fl_push_clip(x(), y(), w(), h());
+        fl_rectf(x(), y(), w(), h(), color());
+        const int top = y() + 18, bottom = y() + h() - 18; // Room for the labels
+        int64_t toMs = rightEdgeMs() + 1;
+        int64_t fromMs = toMs - spanMs;
+        if (pyramid != nullptr && bottom > top)
+        {
+            pyramidColumns(*pyramid, fromMs, toMs, w(), columns);
+            double low = INFINITY, high = -INFINITY;
+            for (size_t i = 0; i < columns.size(); i++)
+            {
+                if (columns[i].count > 0)
+                {
+                    low = min(low, columns[i].min);
+                    high = max(high, columns[i].max);
+                }
+            }
+            if (low <= high)
+            {
+                double range = high > low ? high - low : 1;
+                int lastX = -1, lastY = 0;
+                for (size_t i = 0; i < columns.size(); i++)
+                {
+                    const PyramidBucket &column = columns[i];
+                    if (column.count == 0)
+                    {
+                        continue;
+                    }
+                    int px = x() + (int)i;
+                    int yMin = bottom - (int)((column.min - low) / range * (bottom - top));
+                    int yMax = bottom - (int)((column.max - low) / range * (bottom - top));
+                    int yMean = bottom - (int)((column.sum / column.count - low) / range * (bottom - top));
+                    fl_color(fl_rgb_color(60, 116, 239));
+                    fl_line(px, yMin, px, yMax);
+                    fl_color(FL_WHITE);
+                    if (lastX >= 0 && px - lastX <= 4) // Leave gaps in the data as gaps
+                    {
+                        fl_line(lastX, lastY, px, yMean);
+                    }
+                    lastX = px;
+                    lastY = yMean;
+                }
+                char label[64];
+                fl_color(fl_rgb_color(203, 207, 213));
+                fl_font(FL_HELVETICA, 11);
+                snprintf(label, sizeof(label), "%g", high);
+                fl_draw(label, x() + 4, y() + 13);
+                snprintf(label, sizeof(label), "%g", low);
+                fl_draw(label, x() + 4, y() + h() - 5);
+            }
+        }
+        char span[64];
+        double seconds = spanMs / 1000.0;
+        if (seconds < 120)
+        {
+            snprintf(span, sizeof(span), "%.3g s%s", seconds, endMs < 0 ? ", live" : "");
+        }
+        else if (seconds < 7200)
+        {
+            snprintf(span, sizeof(span), "%.3g min%s", seconds / 60, endMs < 0 ? ", live" : "");
+        }
+        else
+        {
+            snprintf(span, sizeof(span), "%.3g h%s", seconds / 3600, endMs < 0 ? ", live" : "");
+        }
+        fl_color(fl_rgb_color(203, 207, 213));
+        fl_font(FL_HELVETICA, 11);
+        fl_draw(span, x() + w() - (int)fl_width(span) - 4, y() + h() - 5);
+        fl_pop_clip();
+    }
+
+    int handle(int event)
+    {
+        switch (event)
+        {
+        case FL_ENTER:
+        case FL_FOCUS:
+            return 1;
+        case FL_MOUSEWHEEL:
+        {
+            // Zoom by two around the time under the pointer
+            int64_t right = rightEdgeMs();
+            double fraction = (double)(Fl::event_x() - x()) / max(w(), 1);
+            int64_t pointerMs = right - spanMs + (int64_t)(fraction * spanMs);
+            spanMs = Fl::event_dy() > 0 ? spanMs * 2 : spanMs / 2;
+            spanMs = max<int64_t>(1000, min<int64_t>(spanMs, 31LL * 24 * 3600 * 1000));
+            if (endMs >= 0 || Fl::event_dy() < 0)
+            {
+                endMs = pointerMs + (int64_t)((1 - fraction) * spanMs);
+            }
+            redraw();
+            return 1;
+        }
+        case FL_PUSH:
+            if (Fl::event_clicks() > 0)
+            {
+                endMs = -1; // Double click: follow the newest samples again
+                redraw();
+                return 1;
+            }
+            dragX = Fl::event_x();
+            dragEndMs = rightEdgeMs();
+            return 1;
+        case FL_DRAG:
+            endMs = dragEndMs - (int64_t)((double)(Fl::event_x() - dragX) * spanMs / max(w(), 1));
+            redraw();
+            return 1;
+        }
+        return Fl_Widget::handle(event);
+    }
+};
+
+#endif
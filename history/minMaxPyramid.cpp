@@ -0,0 +1,256 @@
+// --------------------- Min/Max Pyramid ------------------------
+// Level-of-detail summaries of one channel for zoomable plots. Level k holds
+// buckets of 2^(pyramidBaseBits + k) samples with their time span, min, max,
+// sum and count; each level is built from pairs of buckets of the level below
+// as samples arrive, so adding a sample is O(1) amortized. A plot asks for one
+// bucket per pixel column: pyramidColumns() picks the coarsest level that still
+// has about one bucket per pixel, so any zoom costs O(pixels). Zoomed in below
+// the base level it reads the raw samples from the frame store instead.
+//
+// A channel gets a pyramid once something watches it (watchChannel); the
+// pyramid is then filled from the frame store and kept up to date by
+// dispatchFrame(). Main thread only, like the store.
+#ifndef HISTORY_MIN_MAX_PYRAMID_CPP
+#define HISTORY_MIN_MAX_PYRAMID_CPP
+
+#include <stdint.h>
+#include <cmath>
+#include <deque>
+#include <vector>
+#include <algorithm>
+#include "../frames/frame.cpp"
+#include "frameStore.cpp"
+
+using namespace std;
+
+const int pyramidBaseBits = 5;            // 32 samples per base bucket
+const int pyramidLevels = 24;             // Up to 2^28 samples per bucket
+const size_t pyramidMaxBuckets = 1 << 19; // Base buckets kept, 16M samples
+
+struct PyramidBucket
+{
+    int64_t firstMs;
+    int64_t lastMs;
+    double min;
+    double max;
+    double sum;
+    uint32_t count;    // Samples
+    uint32_t children; // Buckets of the level below merged in so far, while open
+};
+
+struct MinMaxPyramid
+{
+    int type;
+    int column;
+    deque<PyramidBucket> levels[pyramidLevels];
+    PyramidBucket open[pyramidLevels]; // Bucket being filled on each level
+};
+
+vector<MinMaxPyramid *> pyramids;
+
+const PyramidBucket emptyPyramidBucket = {0, 0, INFINITY, -INFINITY, 0, 0, 0};
+
+void mergeBucket(PyramidBucket &into, const PyramidBucket &bucket)
+{
+    if (into.count == 0)
+    {
+        into.firstMs = bucket.firstMs;
+    }
+    into.lastMs = bucket.lastMs;
+    into.min = min(into.min, bucket.min);
+    into.max = max(into.max, bucket.max);
+    into.sum += bucket.sum;
+    into.count += bucket.count;
+}
+
+void addPyramidSample(MinMaxPyramid &pyramid, int64_t timestampMs, double value)
+{
+    if (value != value)
+    {
+        return; // NaN
+    }
+    PyramidBucket sample = {timestampMs, timestampMs, value, value, value, 1, 0};
+    mergeBucket(pyramid.open[0], sample);
+    if (pyramid.open[0].count < (1u << pyramidBaseBits))
+    {
+        return;
+    }
+    // Carry full buckets upwards, like incrementing a binary counter
+    for (int level = 0; level < pyramidLevels; level++)
+    {
+        PyramidBucket full = pyramid.open[level];
+        pyramid.levels[level].push_back(full);
+        pyramid.open[level] = emptyPyramidBucket;
+        if (level + 1 == pyramidLevels)
+        {
+            break;
+        }
+        mergeBucket(pyramid.open[level + 1], full);
+        if (++pyramid.open[level + 1].children < 2)
+        {
+            break;
+        }
+    }
+    if (pyramid.levels[0].size() > pyramidMaxBuckets)
+    {
+        pyramid.levels[0].pop_front();
+        int64_t oldestMs = pyramid.levels[0].front().firstMs;
+        for (int level = 1; level < pyramidLevels; level++)
+        {
+            while (!pyramid.levels[level].empty() && pyramid.levels[level].front().lastMs < oldestMs)
+            {
+                pyramid.levels[level].pop_front();
+            }
+        }
+    }
+}
+
+// Feeds a frame to every pyramid watching its packet type
+void addPyramidFrame(const Frame &frame)
+{
+    for (size_t i = 0; i < pyramids.size(); i++)
+    {
+        if (pyramids[i]->type == frame.type && pyramids[i]->column < frame.count)
+        {
+            addPyramidSample(*pyramids[i], frame.timestampMs, frame.values[pyramids[i]->column]);
+        }
+    }
+}
+
+// Empties every pyramid along with the frame store; the channels stay watched
+void clearPyramids()
+{
+    for (size_t i = 0; i < pyramids.size(); i++)
+    {
+        for (int level = 0; level < pyramidLevels; level++)
+        {
+            pyramids[i]->levels[level].clear();
+            pyramids[i]->open[level] = emptyPyramidBucket;
+        }
+    }
+}
+
+// The pyramid of a log column, made and filled from the frame store on first use
+MinMaxPyramid *watchChannel(int type, int column)
+{
+    for (size_t i = 0; i < pyramids.size(); i++)
+    {
+        if (pyramids[i]->type == type && pyramids[i]->column == column)
+        {
+            return pyramids[i];
+        }
+    }
+    MinMaxPyramid *pyramid = new MinMaxPyramid();
+    pyramid->type = type;
+    pyramid->column = column;
+    for (int level = 0; level < pyramidLevels; level++)
+    {
+        pyramid->open[level] = emptyPyramidBucket;
+    }
+    vector<int64_t> times;
+    vector<double> values;
+    scanStoreChannel(type, column, INT64_MIN, INT64_MAX, times, values);
+    for (size_t i = 0; i < times.size(); i++)
+    {
+        addPyramidSample(*pyramid, times[i], values[i]);
+    }
+    pyramids.push_back(pyramid);
+    return pyramid;
+}
+
+// Newest sample time, or INT64_MIN if there is none
+int64_t pyramidEndMs(const MinMaxPyramid &pyramid)
+{
+    if (pyramid.open[0].count > 0)
+    {
+        return pyramid.open[0].lastMs;
+    }
+    return pyramid.levels[0].empty() ? INT64_MIN : pyramid.levels[0].back().lastMs;
+}
+
+// Index of the first bucket of a level that ends at or after fromMs
+size_t firstPyramidBucket(const deque<PyramidBucket> &buckets, int64_t fromMs)
+{
+    return lower_bound(buckets.begin(), buckets.end(), fromMs,
+                       [](const PyramidBucket &bucket, int64_t ms)
+                       { return bucket.lastMs < ms; }) -
+           buckets.begin();
+}
+
+// Puts a bucket into the pixel column its middle falls in
+void addToColumns(const PyramidBucket &bucket, int64_t fromMs, int64_t toMs, vector<PyramidBucket> &columns)
+{
+    int64_t middleMs = bucket.firstMs + (bucket.lastMs - bucket.firstMs) / 2;
+    if (bucket.count == 0 || middleMs < fromMs || middleMs >= toMs)
+    {
+        return;
+    }
+    size_t column = (size_t)((double)(middleMs - fromMs) * columns.size() / (toMs - fromMs));
+    mergeBucket(columns[min(column, columns.size() - 1)], bucket);
+}
+
+// One bucket per pixel column over [fromMs, toMs); columns without samples have count 0
+void pyramidColumns(const MinMaxPyramid &pyramid, int64_t fromMs, int64_t toMs, int pixels, vector<PyramidBucket> &columns)
+{
+    columns.assign(max(pixels, 1), emptyPyramidBucket);
+    if (toMs <= fromMs)
+    {
+        return;
+    }
+    // Coarsest level with at least one bucket per pixel; below the base, the raw samples
+    int level = pyramidLevels - 1;
+    size_t first = 0, last = 0;
+    while (level >= 0)
+    {
+        const deque<PyramidBucket> &buckets = pyramid.levels[level];
+        first = firstPyramidBucket(buckets, fromMs);
+        last = firstPyramidBucket(buckets, toMs);
+        if (last - first >= (size_t)pixels)
+        {
+            break;
+        }
+        level--;
+    }
+    if (level < 0)
+    {
+        vector<int64_t> times;
+        vector<double> values;
+        scanStoreChannel(pyramid.type, pyramid.column, fromMs, toMs, times, values);
+        for (size_t i = 0; i < times.size(); i++)
+        {
+            PyramidBucket sample = {times[i], times[i], values[i], values[i], values[i], values[i] == values[i], 0};
+            addToColumns(sample, fromMs, toMs, columns);
+        }
+        if (!times.empty())
+        {
+            return;
+        }
+        level = 0; // The store is off or has dropped these samples already
+        first = firstPyramidBucket(pyramid.levels[0], fromMs);
+        last = firstPyramidBucket(pyramid.levels[0], toMs);
+    }
+    const deque<PyramidBucket> &buckets = pyramid.levels[level];
+    for (size_t i = first; i < buckets.size() && i <= last; i++)
+    {
+        addToColumns(buckets[i], fromMs, toMs, columns);
+    }
+    // Samples newer than the last bucket of this level are still in the levels below
+    int64_t coveredMs = buckets.empty() ? INT64_MIN : buckets.back().lastMs;
+    for (int below = level - 1; below >= 0; below--)
+    {
+        const deque<PyramidBucket> &lower = pyramid.levels[below];
+        size_t i = lower.size();
+        while (i > 0 && lower[i - 1].firstMs > coveredMs)
+        {
+            i--;
+        }
+        for (; i < lower.size(); i++)
+        {
+            addToColumns(lower[i], fromMs, toMs, columns);
+            coveredMs = lower[i].lastMs;
+        }
+    }
+    addToColumns(pyramid.open[0], fromMs, toMs, columns);
+}
+
+#endif
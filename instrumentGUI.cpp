@@ -10,6 +10,8 @@
 #include <FL/Fl_Button.H>
 #include <FL/Fl_Round_Button.H>
 #include <FL/Fl_Value_Slider.H>
+#include <FL/Fl_Choice.H>
+#include <FL/Fl_File_Chooser.H>
 #include <iomanip>
 #include <string>
 #include <iostream>
@@ -26,6 +28,24 @@
 #include <mutex>
 #include <sstream>
 #include "interpreter/interpreter.cpp"
+#include "frames/frame.cpp"
+#include "telemetry/telemetryServer.cpp"
+#include "telemetry/telemetryViewer.cpp"
+#include "shm/frameRing.cpp"
+#include "history/frameHistory.cpp"
+#include "history/historyFlush.cpp"
+#include "history/frameStore.cpp"
+#include "history/historyPlot.cpp"
+#include "triggers/trigger.cpp"
+#include "logging/rotatingLog.cpp"
+#include "replay/sessionReplay.cpp"
+#include "commands/commandQueue.cpp"
+#include "commands/sequencer.cpp"
+#include "commands/ackLatency.cpp"
+#include "commands/controlState.cpp"
+#include "commands/reconcile.cpp"
+#include "commands/hostSweep.cpp"
+#include "commands/safeMode.cpp"
 
 #define ERPA_HEADER "date, time, sync, seq, endMon, SWPMON, temp1, temp2, adc"
 #define PMT_HEADER "date, time, sync, seq, adc"
@@ -37,29 +57,39 @@ const float hkBPS = 5.6;
 const float pmtBPS = 48.0;
 const float tempsBPS = 2.4;
 float totalBPS = 0;
-int currentFactor = 1;
 char currentFactorBuf[8];
-int serialPort = open(portName, O_RDWR | O_NOCTTY); // Opening serial port
-int step = 0;
+int serialPort = -1; // Opened in main(); the telemetry socket in viewer mode
 string pmtLabels[3] = {"PMT sync", "PMT seq ", "PMT adc "};
 string erpaLabels[7] = {"ERPA sync", "ERPA seq", "ERPA endmon", "ERPA swp-mon", "ERPA temp1", "ERPA temp2", "ERPA adc"};
 string hkLabels[19] = {"HK sync       ", "HK seq        ", "HK busvmon   ", "HK busimon    ", "HK 3v3mon     ", "HK n150vmon   ", "HK n800vmon   ", "HK 2v5mon     ", "HK n5vmon     ", "HK 5vmon      ", "HK n3v3mon    ", "HK 5vrefmon   ", "HK 15vmon     ", "HK vsense     ", "HK vrefint    ", "TMP 1         ", "TMP 2         ", "TMP 3         ", "TMP 4         "};
 string erpaFrame[7];
 string pmtFrame[3];
 string hkFrame[19];
+// When the last field of the frame being assembled was decoded, 0 until then. A
+// frame is only dispatched once the next one's sync arrives, up to a packet
+// period later, so it is stamped with this time instead.
+int64_t erpaFrameMs = 0;
+int64_t pmtFrameMs = 0;
+int64_t hkFrameMs = 0;
+// Index into erpaFrame/pmtFrame/hkFrame for each log column
+const int erpaColumns[7] = {0, 1, 6, 3, 4, 5, 2};
+const int pmtColumns[3] = {0, 1, 2};
+const int hkColumns[19] = {0, 1, 13, 14, 15, 16, 17, 18, 2, 3, 7, 4, 9, 10, 8, 12, 11, 5, 6};
 using namespace std;
 const float tolerance = 0.01;
 bool recording = false;
 bool autoSweepStarted = false;
 bool steppingUp = true;
-string erpaLog = "";
-string pmtLog = "";
-string hkLog = "";
-string controlsLog = "";
-ofstream erpaStream;
-ofstream pmtStream;
-ofstream hkStream;
-ofstream controlsStream;
+RotatingLog erpaLog;
+RotatingLog pmtLog;
+RotatingLog hkLog;
+chrono::steady_clock::time_point startTime = chrono::steady_clock::now(); // Static init, i.e. process start
+bool firstFrameSeen = false;
+double msSinceStart()
+{
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - startTime).count();
+}
+
 // --------------------- Generate New Log Name -----------------
 string newLogName()
 {
@@ -72,48 +102,82 @@ string newLogName()
 
 
 // --------------------- Write to Event Log --------------------
-void writeToErpaLog(string sync, string seq, string endMon, string SWPMON, string temp1, string temp2, string adc)
+void writeToErpaLog(const Frame &frame)
 {
-    auto t = std::time(nullptr);
-    auto tm = *std::localtime(&t);
-
-    auto now = chrono::system_clock::now();
-    time_t now_c = chrono::system_clock::to_time_t(now);
-    auto ms = chrono::duration_cast<chrono::milliseconds>(now.time_since_epoch()) % 1000;
-    erpaStream << put_time(&tm, "%m-%d-%Y, %H:%M:%S:") << ms.count() << ", " << sync << ", " << seq << ", " << endMon << ", " << SWPMON << ", " << temp1 << ", " << temp2 << ", " << adc << "\n";
+    char row[512];
+    writeRotatingLog(erpaLog, row, formatFrameRow(frame, row), frame.timestampMs, (uint32_t)frame.values[1]);
 }
 
-void writeToPMTLog(string sync, string seq, string adc)
+void writeToPMTLog(const Frame &frame)
 {
-    auto t = std::time(nullptr);
-    auto tm = *std::localtime(&t);
-
-    auto now = chrono::system_clock::now();
-    time_t now_c = chrono::system_clock::to_time_t(now);
-    auto ms = chrono::duration_cast<chrono::milliseconds>(now.time_since_epoch()) % 1000;
-    pmtStream << put_time(&tm, "%m-%d-%Y, %H:%M:%S:") << ms.count() << ", " << sync << ", " << seq << ", " << adc << "\n";
+    char row[512];
+    writeRotatingLog(pmtLog, row, formatFrameRow(frame, row), frame.timestampMs, (uint32_t)frame.values[1]);
 }
 
-void writeToHKLog(string sync, string seq, string vsense, string vrefint, string temp1, string temp2, string temp3, string temp4, string busvmon, string busimon, string mon2v5, string mon3v3, string vmon5, string n3v3mon, string n5vmon, string vmon15, string vrefmon5, string n200vmon, string n800vmon)
+void writeToHKLog(const Frame &frame)
 {
-    auto t = std::time(nullptr);
-    auto tm = *std::localtime(&t);
+    char row[512];
+    writeRotatingLog(hkLog, row, formatFrameRow(frame, row), frame.timestampMs, (uint32_t)frame.values[1]);
+}
 
-    auto now = chrono::system_clock::now();
-    time_t now_c = chrono::system_clock::to_time_t(now);
-    auto ms = chrono::duration_cast<chrono::milliseconds>(now.time_since_epoch()) % 1000;
-    hkStream << put_time(&tm, "%m-%d-%Y, %H:%M:%S:") << ms.count() << ", " << sync << ", " << seq << ", " << vsense << ", " << vrefint << ", " << temp1 << ", " << temp2 << ", " << temp3 << ", " << temp4 << ", " << busvmon << ", " << busimon << ", " << mon2v5 << ", " << mon3v3 << ", " << vmon5 << ", " << n3v3mon << ", " << n5vmon << ", " << vmon15 << ", " << vrefmon5 << ", " << n200vmon << ", " << n800vmon << "\n";
+void writeFrameToLog(const Frame &frame)
+{
+    switch (frame.type)
+    {
+    case ERPA_FRAME:
+        writeToErpaLog(frame);
+        break;
+    case PMT_FRAME:
+        writeToPMTLog(frame);
+        break;
+    case HK_FRAME:
+        writeToHKLog(frame);
+        break;
+    }
 }
 
-void writeToControlsLog(string pmt_on, string erpa_on, string hk_on, string c_sys_on, string c_800v_en, string c_5v_en, string c_n150v_en, string c_3v3_en, string c_n5v_en, string c_15v_en, string c_n3v3_en, string c_sdn1, string c_sdn2)
+// Time to stamp a frame with when the next sync dispatches it; falls back to now
+// if its last field never arrived
+int64_t takeFrameTime(int64_t &decodedMs)
 {
-    auto t = std::time(nullptr);
-    auto tm = *std::localtime(&t);
+    int64_t timestampMs = decodedMs != 0 ? decodedMs : currentTimeMs();
+    decodedMs = 0;
+    return timestampMs;
+}
 
-    auto now = chrono::system_clock::now();
-    time_t now_c = chrono::system_clock::to_time_t(now);
-    auto ms = chrono::duration_cast<chrono::milliseconds>(now.time_since_epoch()) % 1000;
-    controlsStream << put_time(&tm, "%m-%d-%Y, %H:%M:%S:") << ms.count() << ", " << pmt_on << ", " << erpa_on << ", " << hk_on << ", " << c_sys_on << ", " << c_800v_en << ", " << c_5v_en << ", " << c_n150v_en << ", " << c_3v3_en << ", " << c_n5v_en << ", " << c_15v_en << ", " << c_n3v3_en << ", " << c_sdn1 << ", " << c_sdn2 << "\n";
+// ------------- Hand A Completed Frame To Consumers ------------
+void dispatchFrame(const Frame &frame)
+{
+    if (!firstFrameSeen)
+    {
+        firstFrameSeen = true;
+        std::cerr << "First frame " << msSinceStart() << " ms after start." << std::endl;
+    }
+    if (!triggers.empty())
+    {
+        evaluateTriggers(frame);
+    }
+    sequencerFrame(frame);
+    ackFrame(frame);
+    reconcileFrame(frame);
+    hostSweepFrame(frame);
+    recordHistory(frame);
+    storeFrame(frame);
+    addPyramidFrame(frame);
+    if (recording)
+    {
+        if (historyFlushing)
+        {
+            flushInBackground([frame]()
+                              { writeFrameToLog(frame); }); // Behind the history
+        }
+        else
+        {
+            writeFrameToLog(frame);
+        }
+    }
+    publishTelemetryFrame(frame);
+    publishFrameRing(frame);
 }
 
 // ---------------- Start Recording button event ---------------
@@ -124,61 +188,151 @@ void startRecordingCallback(Fl_Widget *widget)
     {
         recording = true;
         ((Fl_Button *)widget)->label("RECORDING @square");
-        erpaLog = "logs/ERPA/ERPA " + newLogName() + ".csv";
-        pmtLog = "logs/PMT/PMT " + newLogName() + ".csv";
-        hkLog = "logs/HK/HK " + newLogName() + ".csv";
-
-        erpaStream.open(erpaLog, ios::app);
-        pmtStream.open(pmtLog, ios::app);
-        hkStream.open(hkLog, ios::app);
-
-        //Write the headers
-        erpaStream << ERPA_HEADER << "\n";
-        pmtStream << PMT_HEADER << "\n";
-        hkStream << HK_HEADER << "\n";
+        // Opening also writes the headers
+        openRotatingLog(erpaLog, "logs/ERPA/ERPA " + newLogName(), ERPA_HEADER);
+        openRotatingLog(pmtLog, "logs/PMT/PMT " + newLogName(), PMT_HEADER);
+        openRotatingLog(hkLog, "logs/HK/HK " + newLogName(), HK_HEADER);
+
+        // The files start with what led up to pressing RECORD
+        vector<Frame> history;
+        for (int type = ERPA_FRAME; type <= HK_FRAME; type++)
+        {
+            vector<Frame> frames = historySince(type, 0);
+            history.insert(history.end(), frames.begin(), frames.end());
+        }
+        flushInBackground([history]()
+                          {
+                              for (size_t i = 0; i < history.size(); i++)
+                              {
+                                  writeFrameToLog(history[i]);
+                              } });
       }
     else
     {
         recording = false;
         ((Fl_Button *)widget)->label("RECORD @circle");
-        erpaStream.close();
-        pmtStream.close();
-        hkStream.close();
+        finishHistoryFlush();
+        closeRotatingLog(erpaLog);
+        closeRotatingLog(pmtLog);
+        closeRotatingLog(hkLog);
     }
 }
 // --------------------- Quit button event ---------------------
 void quitCallback(Fl_Widget *)
 {
-    controlsStream.close();
+    stopHostSweep("stopped, quitting");
+    stopSafeMode();
+    stopTelemetryServer();
+    stopSequencer();
+    stopCommandQueue();
+    stopTelemetryViewer(); // After the queue, which writes to the same socket
+    stopAckLatency();
+    destroyFrameRing();
+    finishHistoryFlush(); // Quitting mid-flush must not lose the pre-trigger rows
+    closeTriggers();
+    closeRotatingLog(erpaLog); // Live gzip segments are only complete once closed
+    closeRotatingLog(pmtLog);
+    closeRotatingLog(hkLog);
+    closeControlJournal();
     exit(0);
 }
 
-// ----------------- Write data to serial port -----------------
-void writeSerialData(const int &serialPort, const unsigned char data)
+// ------------- Commands Sent Back By Telemetry Viewers ---------
+void forwardRemoteCommand(unsigned char command)
 {
-    const unsigned char * ptr = &data;
-    ssize_t bytesWritten = write(serialPort, ptr, sizeof(unsigned char));
-    if (bytesWritten == -1)
-    {
-        std::cerr << "Error writing to the serial port." << std::endl;
-    }
+    queueCommand(command);
+}
+
+// ------------------- Replay Window Callbacks -----------------
+void replayPauseCallback(Fl_Widget *widget)
+{
+    replayPaused = !replayPaused;
+    ((Fl_Button *)widget)->label(replayPaused ? "@>" : "@||");
+}
+
+void replaySeekCallback(Fl_Widget *widget)
+{
+    seekReplay((int64_t)(((Fl_Value_Slider *)widget)->value() * 1000));
+}
+
+void replaySpeedCallback(Fl_Widget *widget)
+{
+    replaySpeed = max(0.0, ((Fl_Value_Input *)widget)->value());
+}
+
+// ------------------- History Window Callback -----------------
+HistoryPlot *historyPlot = nullptr;
+
+void historyChannelCallback(Fl_Widget *, void *channel)
+{ // channel is type * 32 + log column
+    int typeAndColumn = (int)(intptr_t)channel;
+    historyPlot->pyramid = watchChannel(typeAndColumn / 32, typeAndColumn % 32);
+    historyPlot->redraw();
 }
 
 // --------------------- Stop Callback -------------------------
 void stopModeCallback(Fl_Widget *)
 {
-    writeSerialData(serialPort, 0x0C);
+    queueCommand(0x0C);
+    journalCommand(currentTimeMs(), 0x0C);
+    reconcilePaused = true; // Silence is expected until Wake Up
 }
 
-// ---------------------- Wake-Up Callback ---------------------
-void exitStopModeCallback(Fl_Widget *)
+// -------------------- Safe Mode Callback ---------------------
+void safeModeCallback(Fl_Widget *)
+{
+    requestSafeMode(SAFE_FROM_BUTTON);
+}
+
+// ---------------- Control Widget Callbacks -------------------
+Fl_Button *controlButtons[controlCount]; // Indexed by CONTROL_*
+
+// The widgets follow the state model; the rails can only be used with sys_on
+void showControlState()
 {
-    for (int i = 0; i < 12; i++)
+    for (int control = 0; control < controlCount; control++)
     {
-        writeSerialData(serialPort, 0x5B);
+        controlButtons[control]->value(controlOn(control));
+        if ((railControls >> control) & 1)
+        {
+            if (controlOn(CONTROL_SYS_ON))
+            {
+                controlButtons[control]->activate();
+            }
+            else
+            {
+                controlButtons[control]->deactivate();
+            }
+        }
+    }
+    totalBPS = (controlOn(CONTROL_PMT) ? pmtBPS : 0) + (controlOn(CONTROL_ERPA) ? erpaBPS : 0) + (controlOn(CONTROL_HK) ? hkBPS + tempsBPS : 0);
+}
+
+void controlCallback(Fl_Widget *widget, void *control)
+{
+    setControl((int)(intptr_t)control, ((Fl_Button *)widget)->value());
+    showControlState();
+}
+
+// -------------------- Run Script Callback --------------------
+void runScriptCallback(Fl_Widget *)
+{
+    const char *path = fl_file_chooser("Run script or Controls log", "*.{txt,jsonl,csv,gz}", nullptr);
+    if (path != nullptr)
+    {
+        runScript(path); // Errors go to stderr with their line number
     }
 }
 
+// ---------------------- Wake-Up Callback ---------------------
+void exitStopModeCallback(Fl_Widget *)
+{
+    const unsigned char wakeUp[12] = {0x5B, 0x5B, 0x5B, 0x5B, 0x5B, 0x5B, 0x5B, 0x5B, 0x5B, 0x5B, 0x5B, 0x5B};
+    queueCommands(wakeUp, sizeof(wakeUp)); // Sent in one write
+    journalCommand(currentTimeMs(), 0x5B, sizeof(wakeUp));
+    reconcilePaused = false;
+}
+
 // ------- Continuously reads data from the serial port --------
 void readSerialData(const int &serialPort, std::atomic<bool> &stopFlag, std::ofstream &outputFile)
 {
@@ -216,35 +370,21 @@ void readSerialData(const int &serialPort, std::atomic<bool> &stopFlag, std::ofs
 // ------------------- Step Up button event --------------------
 void stepUpCallback(Fl_Widget *)
 {
-    writeSerialData(serialPort, 0x1B);
-    if (step < 7)
-    {
-        step++;
-    }
+    stepSweep(true);
 }
 
 // ------------------- Step Down button event ------------------
 void stepDownCallback(Fl_Widget *)
 {
-    writeSerialData(serialPort, 0x1C);
-    if (step > 0)
-    {
-        step--;
-    }
+    stepSweep(false);
 }
 
 void factorUpCallback(Fl_Widget *) {
-    writeSerialData(serialPort, 0x24);
-    if (currentFactor < 32) {
-        currentFactor *= 2;
-    }
+    scaleSweepFactor(true);
 }
 
 void factorDownCallback(Fl_Widget*) {
-    writeSerialData(serialPort, 0x25);
-    if (currentFactor > 1) {
-        currentFactor /= 2;
-    }
+    scaleSweepFactor(false);
 }
 
 // ------------------- 100ms Timer Callback --------------------
@@ -252,7 +392,20 @@ void factorDownCallback(Fl_Widget*) {
 
 // ------------------- Auto Sweep Callback --------------------
 void autoSweepCallback(Fl_Widget *){
-    writeSerialData(serialPort, 0x1D);
+    startAutoSweep();
+}
+
+// ------------------- Host Sweep Callback --------------------
+void hostSweepCallback(Fl_Widget *)
+{
+    if (hostSweepRunning)
+    {
+        stopHostSweep("stopped");
+    }
+    else
+    {
+        startHostSweep(newLogName());
+    }
 }
 
 
@@ -339,7 +492,6 @@ const char* findSerialPort() {
 // ------------------- Main Program Function -------------------
 int main(int argc, char **argv)
 {
-    float stepVoltages[8] = {0, 0.5, 1, 1.5, 2, 2.5, 3, 3.3};
     // ------------------ Output Field Vars --------------------
     char buffer[32];
     float pmt_sync = 0;
@@ -371,6 +523,158 @@ int main(int argc, char **argv)
     float hk_temp2 = 0;
     float hk_temp3 = 0;
     float hk_temp4 = 0;
+
+    // ------------------ Command Line Options -----------------
+    string serveAddress = "";  // --serve [host:]port
+    string serveSocket = "";   // --serve-socket path
+    string viewerAddress = ""; // --connect [host:]port or socket path
+    bool allowRemoteCommands = false;
+    vector<string> replaySources; // --replay session name or log file, repeatable
+    string ringName = "";      // --shm name, e.g. /instrumentGUI
+    double historySeconds = 30; // --history-seconds, frames kept for RECORD (0 disables)
+    double historyMB = 16;      // --history-mb, per packet type
+    double storeMB = 128;       // --store-mb, compressed history of the whole run (0 disables)
+    bool showHistoryPlot = false; // --plot
+    bool resendDiverged = true;   // --no-resend
+    vector<string> scriptPaths;   // --script file, run once the window is up, repeatable
+    bool startSweep = false;      // --host-sweep
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if (arg == "--serve" && i + 1 < argc)
+        {
+            serveAddress = argv[++i];
+        }
+        else if (arg == "--serve-socket" && i + 1 < argc)
+        {
+            serveSocket = argv[++i];
+        }
+        else if (arg == "--connect" && i + 1 < argc)
+        {
+            viewerAddress = argv[++i];
+        }
+        else if (arg == "--replay" && i + 1 < argc)
+        {
+            replaySources.push_back(argv[++i]);
+        }
+        else if (arg == "--replay-speed" && i + 1 < argc)
+        {
+            replaySpeed = atof(argv[++i]);
+        }
+        else if (arg == "--allow-remote-commands")
+        {
+            allowRemoteCommands = true;
+        }
+        else if (arg == "--shm" && i + 1 < argc)
+        {
+            ringName = argv[++i];
+        }
+        else if (arg == "--history-seconds" && i + 1 < argc)
+        {
+            historySeconds = atof(argv[++i]);
+        }
+        else if (arg == "--history-mb" && i + 1 < argc)
+        {
+            historyMB = atof(argv[++i]);
+        }
+        else if (arg == "--store-mb" && i + 1 < argc)
+        {
+            storeMB = atof(argv[++i]);
+        }
+        else if (arg == "--plot")
+        {
+            showHistoryPlot = true;
+        }
+        else if (arg == "--script" && i + 1 < argc)
+        {
+            scriptPaths.push_back(argv[++i]);
+        }
+        else if (arg == "--host-sweep")
+        {
+            startSweep = true;
+        }
+        else if (arg == "--sweep-dwell" && i + 1 < argc)
+        {
+            hostSweepDwellMs = (int64_t)(atof(argv[++i]) * 1000);
+        }
+        else if (arg == "--sweep-settle" && i + 1 < argc)
+        {
+            hostSweepSettleMs = (int64_t)(atof(argv[++i]) * 1000);
+        }
+        else if (arg == "--sweeps" && i + 1 < argc)
+        {
+            hostSweepLimit = atoi(argv[++i]);
+        }
+        else if (arg == "--controls-speed" && i + 1 < argc)
+        {
+            controlsReplaySpeed = atof(argv[++i]);
+        }
+        else if (arg == "--port" && i + 1 < argc)
+        {
+            portName = argv[++i];
+        }
+        else if (arg == "--trigger" && i + 1 < argc)
+        {
+            if (!addTrigger(argv[++i]))
+            {
+                ::exit(0);
+            }
+        }
+        else if (arg == "--safe-on" && i + 1 < argc)
+        {
+            if (!addTrigger(argv[++i], true))
+            {
+                ::exit(0);
+            }
+        }
+        else if (arg == "--rail-level" && i + 1 < argc)
+        {
+            if (!setRailLevel(argv[++i]))
+            {
+                ::exit(0);
+            }
+        }
+        else if (arg == "--no-resend")
+        {
+            resendDiverged = false;
+        }
+        else if (arg == "--trigger-pre" && i + 1 < argc)
+        {
+            triggerPreMs = (int64_t)(atof(argv[++i]) * 1000);
+        }
+        else if (arg == "--trigger-post" && i + 1 < argc)
+        {
+            triggerPostMs = (int64_t)(atof(argv[++i]) * 1000);
+        }
+        else if (arg == "--rotate-mb" && i + 1 < argc)
+        {
+            logRotateBytes = (size_t)(atof(argv[++i]) * 1024 * 1024);
+        }
+        else if (arg == "--rotate-minutes" && i + 1 < argc)
+        {
+            logRotateMs = (int64_t)(atof(argv[++i]) * 60 * 1000);
+        }
+        else if (arg == "--compress-logs")
+        {
+            compressClosedLogs = true;
+        }
+        else if (arg == "--gzip-logs")
+        {
+            liveGzipLogs = true;
+        }
+        else if (arg == "--block-logs")
+        {
+            blockLogs = true;
+        }
+        else if (arg == "--index-every" && i + 1 < argc)
+        {
+            logIndexEvery = atoi(argv[++i]);
+        }
+    }
+    if (compressClosedLogs && blockLogs)
+    {
+        std::cerr << "--compress-logs does not apply to --block-logs, the .csv.blk segments are kept as they are for verifyLog." << std::endl;
+    }
     // resolve zero issue
     // averaging on on board MCU
     // timing for different packets
@@ -378,14 +682,8 @@ int main(int argc, char **argv)
     // separate data into separate CSV's
     //
     // // sync, seq, endmon, swpmon, tmp1, tmp2,adc
-    controlsLog = "logs/Controls/Controls" + newLogName() + ".csv";
-    controlsStream.open(controlsLog, ios::app);
-    writeToControlsLog("pmt_on", "erpa_on", "hk_on", "c_sys_on", "c_800v_en", "c_5v_en", "c_n150v_en", "c_3v3_en", "c_n5v_en", "c_15v_en", "c_n3v3_en", "c_sdn1", "c_sdn2");
 
     // --------- Vars Keeping Track Of Packet States -----------
-    unsigned char valPMT;
-    unsigned char valERPA;
-    unsigned char valHK;
     int turnedOff = 0;
 
     // ------------------------ Thread Vars --------------------
@@ -396,20 +694,70 @@ int main(int argc, char **argv)
     std::ofstream outputFile("mylog.0", std::ios::out | std::ios::trunc);
 
     // -------------------- Thread/Port Setup ------------------
-    int serialPort = open(portName, O_RDWR | O_NOCTTY); // Opening serial port
-    if (serialPort == -1)
+    bool viewerMode = !viewerAddress.empty();
+    bool replayMode = !replaySources.empty();
+    std::thread readingThread;
+    if (replayMode)
     {
-        std::cerr << "Failed to open the serial port." << std::endl;
-        ::exit(0);
+        // Recorded logs instead of the instrument; serialPort stays closed
+        for (size_t i = 0; i < replaySources.size(); i++)
+        {
+            if (!addReplaySource(replaySources[i]))
+            {
+                ::exit(0);
+            }
+        }
+        startReplay();
+    }
+    else if (viewerMode)
+    {
+        // Pure viewer: frames come from another instrumentGUI, commands go back to it
+        serialPort = connectTelemetry(viewerAddress);
+        if (serialPort == -1)
+        {
+            std::cerr << "Failed to connect to the telemetry server at " << viewerAddress << "." << std::endl;
+            ::exit(0);
+        }
+        startTelemetryViewer(serialPort);
+    }
+    else
+    {
+        serialPort = open(portName, O_RDWR | O_NOCTTY); // Opening serial port
+        if (serialPort == -1)
+        {
+            std::cerr << "Failed to open the serial port." << std::endl;
+            ::exit(0);
+        }
+        tcgetattr(serialPort, &options);
+        cfsetispeed(&options, B57600);
+        cfsetospeed(&options, B57600);
+        options.c_cflag |= O_NONBLOCK;
+        tcsetattr(serialPort, TCSANOW, &options);
+
+        readingThread = std::thread([&stopFlag, &outputFile]
+                                    { return readSerialData(serialPort, std::ref(stopFlag), std::ref(outputFile)); });
     }
-    tcgetattr(serialPort, &options);
-    cfsetispeed(&options, B57600);
-    cfsetospeed(&options, B57600);
-    options.c_cflag |= O_NONBLOCK;
-    tcsetattr(serialPort, TCSANOW, &options);
 
-    std::thread readingThread([&serialPort, &stopFlag, &outputFile]
-                              { return readSerialData(serialPort, std::ref(stopFlag), std::ref(outputFile)); });
+    if (!replayMode)
+    {
+        startAckLatency(newLogName());
+        startCommandQueue(serialPort, newLogName());
+        startSafeMode(serialPort, newLogName());
+    }
+    if (allowRemoteCommands)
+    {
+        telemetryCommandHandler = forwardRemoteCommand;
+    }
+    if ((!serveAddress.empty() || !serveSocket.empty()) && !startTelemetryServer(serveAddress, serveSocket))
+    {
+        std::cerr << "Failed to start the telemetry server." << std::endl;
+    }
+    setHistoryLimits((int64_t)(historySeconds * 1000), (size_t)(historyMB * 1024 * 1024));
+    setStoreBudget((size_t)(storeMB * 1024 * 1024));
+    if (!ringName.empty() && !createFrameRing(ringName, defaultFrameRingCapacity))
+    {
+        std::cerr << "Failed to create the shared memory frame ring." << std::endl;
+    }
 
     // --------------- Main Window Elements Setup --------------
     int width = 1300; // Width and Height of Main Window
@@ -456,10 +804,23 @@ int main(int argc, char **argv)
     Fl_Round_Button *PB6 = new Fl_Round_Button(20, 430, 100, 50, "800v_en PB6");
     
     Fl_Button *autoSweep = new Fl_Button(25, 475, 110, 25, "Auto Sweep");
+    Fl_Button *hostSweep = new Fl_Button(160, 475, 110, 25, "Host Sweep");
+    hostSweep->tooltip("Step through the sweep from here, tagging every ERPA frame with its step");
+    Fl_Output *hostSweepState = new Fl_Output(160, 510, 110, 25);
+    hostSweepState->color(box);
+    hostSweepState->box(FL_FLAT_BOX);
+    hostSweepState->textcolor(output);
+    bool shownHostSweep = false;
+    int shownSweepNumber = -1;
     Fl_Button *stepUp = new Fl_Button(25, 510, 110, 25, "Step Up");
     Fl_Button *stepDown = new Fl_Button(25, 565, 110, 25, "Step Down");
     Fl_Button *enterStopMode = new Fl_Button(25, 610, 110, 35, "Sleep");
     Fl_Button *exitStopMode = new Fl_Button(25, 660, 110, 35, "Wake Up");
+    Fl_Button *safeMode = new Fl_Button(160, 610, 110, 35, "SAFE MODE");
+    safeMode->labelcolor(FL_RED);
+    safeMode->shortcut(FL_COMMAND + FL_SHIFT + 's');
+    safeMode->tooltip("HV rails off and sleep, ahead of every queued command (Ctrl/Cmd+Shift+S, or kill -USR1)");
+    safeMode->callback(safeModeCallback);
 
     Fl_Button *increaseFactor = new Fl_Button(300, 75, 110, 25, "Factor Up");
     increaseFactor->callback(factorUpCallback);
@@ -470,6 +831,25 @@ int main(int argc, char **argv)
     curFactor->value(buffer);
     curFactor->box(FL_FLAT_BOX);
     curFactor->textcolor(output);
+    // Between the CONTROLS column and the packet groups
+    Fl_Output *txQueue = new Fl_Output(160, 135, 110, 25, "TX queue");
+    txQueue->align(FL_ALIGN_TOP);
+    txQueue->color(box);
+    txQueue->box(FL_FLAT_BOX);
+    txQueue->textcolor(output);
+    txQueue->labelcolor(text);
+    txQueue->tooltip("Command bytes waiting to be sent, and the most ever waiting");
+    Fl_Button *runScriptButton = new Fl_Button(160, 85, 110, 25, "Run Script...");
+    runScriptButton->callback(runScriptCallback);
+    Fl_Output *stateCheck = new Fl_Output(160, 185, 110, 25, "Telemetry");
+    stateCheck->align(FL_ALIGN_TOP);
+    stateCheck->color(box);
+    stateCheck->box(FL_FLAT_BOX);
+    stateCheck->textcolor(output);
+    stateCheck->labelcolor(text);
+    stateCheck->value(reconcileSummary.c_str());
+    stateCheck->tooltip("Whether telemetry agrees with the controls and the sweep step");
+    unsigned shownReconcileVersion = 0;
 
 
     Fl_Button *startRecording = new Fl_Button(25, 720, 110, 35, "RECORD @circle");
@@ -477,6 +857,7 @@ int main(int argc, char **argv)
     startRecording->callback(startRecordingCallback);
 
     autoSweep->callback(autoSweepCallback);
+    hostSweep->callback(hostSweepCallback);
     stepDown->callback(stepDownCallback);
     stepUp->callback(stepUpCallback);
     stepUp->label("Step Up      @8->");
@@ -507,28 +888,6 @@ int main(int argc, char **argv)
     PC8->labelcolor(text);
     PC9->labelcolor(text);
     PC6->labelcolor(text);
-    PB6->deactivate();
-    PC10->deactivate();
-    PC13->deactivate();
-    PC7->deactivate();
-    PC8->deactivate();
-    PC9->deactivate();
-    PC6->deactivate();
-    PMT_ON->value(0);
-    ERPA_ON->value(0);
-    HK_ON->value(0);
-    unsigned char valPB6 = PB6->value();
-    unsigned char valPB5 = PB5->value();
-    unsigned char valPC10 = PC10->value();
-    unsigned char valPC13 = PC13->value();
-    unsigned char valPC7 = PC7->value();
-    unsigned char valPC8 = PC8->value();
-    unsigned char valPC9 = PC9->value();
-    unsigned char valPC6 = PC6->value();
-    valPMT = PMT_ON->value();
-    valERPA = ERPA_ON->value();
-    valHK = HK_ON->value();
-    turnedOff = 0;
 
     // -------------------- ERPA Packet Group ------------------
     Fl_Box *group2 = new Fl_Box(x_packet_offset + 295, y_packet_offset, 200, 400,
@@ -545,7 +904,6 @@ int main(int argc, char **argv)
     SDN1->color(box);
     SDN1->labelcolor(text);
     SDN1->labelsize(17);
-    unsigned char valSDN1 = SDN1->value();
 
     Fl_Light_Button *SDN2 = new Fl_Light_Button(x_packet_offset + 305, y_packet_offset + 235, 150, 50, " SDN2 HIGH");
     SDN2->selection_color(FL_GREEN);
@@ -553,7 +911,21 @@ int main(int argc, char **argv)
     SDN2->color(box);
     SDN2->labelcolor(text);
     SDN2->labelsize(17);
-    unsigned char valSDN2 = SDN2->value();
+
+    // Every control is a callback onto the state model (commands/controlState.cpp)
+    Fl_Button *controls[controlCount] = {PMT_ON, ERPA_ON, HK_ON, PB5, PB6, PC10, PC13, PC7, PC8, PC9, PC6, SDN1, SDN2};
+    for (int control = 0; control < controlCount; control++)
+    {
+        controlButtons[control] = controls[control];
+        controls[control]->callback(controlCallback, (void *)(intptr_t)control);
+    }
+    initControlState(viewerMode || replayMode ? packetControls : 0, newLogName()); // A viewer shows whatever the server streams
+    showControlState();
+    startReconcile(resendDiverged && !viewerMode && !replayMode); // Only the acquiring GUI sends to the instrument
+    if (viewerMode || replayMode)
+    {
+        hostSweep->deactivate();
+    }
 
     Fl_Box *ERPA1 = new Fl_Box(x_packet_offset + 300, y_packet_offset + 5, 50, 20, "SYNC:");
     Fl_Output *ERPAsync = new Fl_Output(x_packet_offset + 417, y_packet_offset + 5, 60, 20);
@@ -925,34 +1297,77 @@ int main(int argc, char **argv)
     HK7->labelcolor(text);
     HK7->align(FL_ALIGN_LEFT | FL_ALIGN_INSIDE);
 
-    writeSerialData(serialPort, 0x10);
-    usleep(10000);
-    writeSerialData(serialPort, 0x11);
-    usleep(10000);
-    writeSerialData(serialPort, 0x12);
-    usleep(10000);
-    writeSerialData(serialPort, 0x13);
-    usleep(10000);
-    writeSerialData(serialPort, 0x14);
-    usleep(10000);
-    writeSerialData(serialPort, 0x15);
-    usleep(10000);
-    writeSerialData(serialPort, 0x16);
-    usleep(10000);
-    writeSerialData(serialPort, 0x17);
-    usleep(10000);
-    writeSerialData(serialPort, 0x18);
-    usleep(10000);
-    writeSerialData(serialPort, 0x19);
-    usleep(10000);
-    writeSerialData(serialPort, 0x1A);
-    usleep(10000);
-    writeSerialData(serialPort, 0x0A);
-    usleep(10000);
-    writeSerialData(serialPort, 0x09);
+    window->end();
+
+    // ------------------ Replay Controls Window ----------------
+    Fl_Value_Slider *replayPosition = nullptr;
+    if (replayMode)
+    {
+        Fl_Window *replayWindow = new Fl_Window(520, 50, "Replay");
+        replayWindow->color(darkBackground);
+        Fl_Button *replayPause = new Fl_Button(10, 10, 30, 30, "@||");
+        replayPause->callback(replayPauseCallback);
+        replayPosition = new Fl_Value_Slider(50, 10, 340, 30);
+        replayPosition->type(FL_HOR_NICE_SLIDER);
+        replayPosition->bounds(0, (replayEndMs - replayStartMs) / 1000.0);
+        replayPosition->precision(1);
+        replayPosition->when(FL_WHEN_RELEASE); // Seek once the slider is let go
+        replayPosition->callback(replaySeekCallback);
+        Fl_Value_Input *replaySpeedInput = new Fl_Value_Input(450, 10, 60, 30, "speed");
+        replaySpeedInput->labelcolor(text);
+        replaySpeedInput->value(replaySpeed);
+        replaySpeedInput->tooltip("Playback speed, 0 for as fast as possible");
+        replaySpeedInput->callback(replaySpeedCallback);
+        replayWindow->end();
+        replayWindow->show();
+    }
+
+    // ------------------- History Plot Window -----------------
+    if (showHistoryPlot)
+    {
+        Fl_Window *historyWindow = new Fl_Window(800, 300, "History");
+        historyWindow->color(darkBackground);
+        Fl_Choice *historyChannel = new Fl_Choice(70, 5, 160, 25, "channel");
+        historyChannel->labelcolor(text);
+        for (int type = ERPA_FRAME; type <= HK_FRAME; type++)
+        {
+            for (int column = 0; column < frameFieldCounts[type]; column++)
+            {
+                string item = string(frameTypeNames[type]) + "/" + frameFieldNames(type)[column];
+                historyChannel->add(item.c_str(), 0, historyChannelCallback, (void *)(intptr_t)(type * 32 + column));
+            }
+        }
+        Fl_Box *historyHelp = new Fl_Box(240, 5, 550, 25, "wheel: zoom, drag: pan, double click: live");
+        historyHelp->labelcolor(text);
+        historyHelp->labelsize(11);
+        historyHelp->align(FL_ALIGN_INSIDE | FL_ALIGN_LEFT);
+        historyPlot = new HistoryPlot(5, 35, 790, 260);
+        historyWindow->resizable(historyPlot);
+        historyWindow->end();
+        historyChannel->value(frameFieldCounts[ERPA_FRAME] - 1); // ERPA/adc
+        historyChannelCallback(historyChannel, (void *)(intptr_t)(ERPA_FRAME * 32 + frameFieldCounts[ERPA_FRAME] - 1));
+        historyWindow->show();
+    }
 
     window->show(); // Opening main window before entering main loop
     Fl::check();
+    std::cerr << "Window shown " << msSinceStart() << " ms after start." << std::endl;
+
+    // Reset the instrument: every enable off, then SDN1 and SDN2 low. The
+    // transmit thread spaces the bytes, the UI is already up.
+    if (!viewerMode && !replayMode) // The instrument belongs to the acquiring GUI, never reset it from a viewer
+    {
+        const unsigned char resetSequence[13] = {0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1A, 0x0A, 0x09};
+        queueCommands(resetSequence, sizeof(resetSequence), 10);
+    }
+    for (size_t i = 0; i < scriptPaths.size(); i++)
+    {
+        runScript(scriptPaths[i]); // After the reset, the queue keeps the order
+    }
+    if (startSweep && !viewerMode && !replayMode)
+    {
+        startHostSweep(newLogName());
+    }
 
     // ---------------- MAIN PROGRAM EVENT LOOP ----------------
     while (1)
@@ -996,242 +1411,98 @@ int main(int argc, char **argv)
         // - 5vref mon
         // - vsense
         // - vrefint
-        snprintf(currentFactorBuf, sizeof(currentFactorBuf), "%d", currentFactor);
+        snprintf(currentFactorBuf, sizeof(currentFactorBuf), "%d", sweepFactor);
         curFactor->value(currentFactorBuf);
         char tempBuf[8];
-        snprintf(tempBuf, sizeof(tempBuf), "%d", step);
+        snprintf(tempBuf, sizeof(tempBuf), "%d", sweepStep);
         currStep->value(tempBuf);
 
-        snprintf(tempBuf, sizeof(tempBuf), "%f", stepVoltages[step]);
+        snprintf(tempBuf, sizeof(tempBuf), "%f", sweepStepVolts[sweepStep]);
         stepVoltage->value(tempBuf);
-
-        if (valPMT == '0' && valERPA == '0' && valHK == '0' &&
-            turnedOff == 0) // Checking if all packet data is toggled off
-        {
-            turnedOff = 1;
-        }
-        else if ((valPMT == '1' || valERPA == '1' || valHK == '1') && turnedOff == 1)
+        CommandQueueStats txStats = commandQueueStats();
+        char txBuf[48];
+        snprintf(txBuf, sizeof(txBuf), "%zu, max %zu", txStats.depth, txStats.maxDepth);
+        txQueue->value(txBuf);
+        txQueue->textcolor(txStats.dropped + txStats.failed > 0 ? FL_RED : output); // Commands were lost
+        reconcileControls(currentTimeMs());
+        if (followScriptCommands() | followSafeMode())
         {
-            turnedOff = 0;
+            showControlState();
         }
-        if (PMT_ON->value() != valPMT && PMT_ON->value() == 1) // Toggling individual packet data
+        hostSweepTick(currentTimeMs());
+        if (!historyFlushing) // Otherwise the flush thread writes the logs
         {
-            totalBPS += pmtBPS;
-            valPMT = PMT_ON->value();
-            writeSerialData(serialPort, 0x0D);
-            writeToControlsLog("1", "", "", "", "", "", "", "", "", "", "", "", "");
+            tickRotatingLog(erpaLog, currentTimeMs());
+            tickRotatingLog(pmtLog, currentTimeMs());
+            tickRotatingLog(hkLog, currentTimeMs());
         }
-        else if (PMT_ON->value() != valPMT && PMT_ON->value() == 0) // Toggling individual packet data
+        if (hostSweepRunning != shownHostSweep || hostSweepNumber != shownSweepNumber)
         {
-            totalBPS -= pmtBPS;
-            valPMT = PMT_ON->value();
-            writeSerialData(serialPort, 0x10);
-            writeToControlsLog("0", "", "", "", "", "", "", "", "", "", "", "", "");
+            char sweepBuf[32];
+            snprintf(sweepBuf, sizeof(sweepBuf), "sweep %d", hostSweepNumber + 1);
+            hostSweepState->value(hostSweepRunning ? sweepBuf : "");
+            hostSweep->label(hostSweepRunning ? "Stop Sweep" : "Host Sweep");
+            shownHostSweep = hostSweepRunning;
+            shownSweepNumber = hostSweepNumber;
         }
-        if (ERPA_ON->value() != valERPA && ERPA_ON->value() == 1)
+        if (reconcileVersion != shownReconcileVersion)
         {
-            totalBPS += erpaBPS;
-            valERPA = ERPA_ON->value();
-            writeSerialData(serialPort, 0x0E);
-            writeToControlsLog("", "1", "", "", "", "", "", "", "", "", "", "", "");
-        }
-        else if (ERPA_ON->value() != valERPA && ERPA_ON->value() == 0)
-        {
-            totalBPS -= erpaBPS;
-            valERPA = ERPA_ON->value();
-            writeSerialData(serialPort, 0x11);
-            writeToControlsLog("", "0", "", "", "", "", "", "", "", "", "", "", "");
-        }
-        if (HK_ON->value() != valHK && HK_ON->value() == 1)
-        {
-            totalBPS += hkBPS;
-            totalBPS += tempsBPS;
-            valHK = HK_ON->value();
-            writeSerialData(serialPort, 0x0F);
-            writeToControlsLog("", "", "1", "", "", "", "", "", "", "", "", "", "");
-        }
-        else if (HK_ON->value() != valHK && HK_ON->value() == 0)
-        {
-            totalBPS -= hkBPS;
-            totalBPS -= tempsBPS;
-            valHK = HK_ON->value();
-            writeSerialData(serialPort, 0x12);
-            writeToControlsLog("", "", "0", "", "", "", "", "", "", "", "", "", "");
+            stateCheck->value(reconcileSummary.c_str());
+            stateCheck->textcolor(reconcileDiverged != 0 ? FL_RED : output);
+            for (int control = 0; control < controlCount; control++)
+            {
+                controlButtons[control]->labelcolor((reconcileDiverged >> control) & 1 ? FL_RED : text);
+                controlButtons[control]->redraw();
+            }
+            currStep->textcolor((reconcileDiverged >> reconcileStep) & 1 ? FL_RED : output);
+            stateCheck->redraw();
+            shownReconcileVersion = reconcileVersion;
         }
 
-        if (PB5->value() != valPB5 &&
-            PB5->value() == 1) // Making sure sys_on (PB5) is on before activating other GPIO buttons
-        {
-            writeToControlsLog("", "", "", "1", "", "", "", "", "", "", "", "", "");
-
-            valPB5 = PB5->value();
-            writeSerialData(serialPort, 0x00);
-            PB6->activate();
-            PC10->activate();
-            PC13->activate();
-            PC7->activate();
-            PC8->activate();
-            PC9->activate();
-            PC6->activate();
-        }
-        else if (PB5->value() != valPB5 &&
-                 PB5->value() == 0)
-        {
-            writeToControlsLog("", "", "", "0", "", "", "", "", "", "", "", "", "");
-
-            valPB5 = PB5->value();
-            writeSerialData(serialPort, 0x13);
-
-            PB6->deactivate();
-            PC10->deactivate();
-            PC13->deactivate();
-            PC7->deactivate();
-            PC8->deactivate();
-            PC9->deactivate();
-            PC6->deactivate();
-
-            PB6->value(0);
-            valPB6 = PB6->value();
-            writeSerialData(serialPort, 0x14);
-            PC10->value(0);
-            valPC10 = PC10->value();
-            writeSerialData(serialPort, 0x15);
-            PC13->value(0);
-            valPC13 = PC13->value();
-            writeSerialData(serialPort, 0x16);
-            PC7->value(0);
-            valPC7 = PC7->value();
-            writeSerialData(serialPort, 0x17);
-            PC8->value(0);
-            valPC8 = PC8->value();
-            writeSerialData(serialPort, 0x18);
-            PC9->value(0);
-            valPC9 = PC9->value();
-            writeSerialData(serialPort, 0x19);
-            PC6->value(0);
-            valPC6 = PC6->value();
-            writeSerialData(serialPort, 0x1A);
-        }
-        if (PB5->value())
+        if (turnedOff == 0) // Checking if data is being received before going through packet data
         {
-            if (PB6->value() != valPB6 && PB6->value() == 1)
-            {
-                valPB6 = PB6->value();
-                writeSerialData(serialPort, 0x01);
-                writeToControlsLog("", "", "", "", "1", "", "", "", "", "", "", "", "");
-            }
-            else if (PB6->value() != valPB6 && PB6->value() == 0)
-            {
-                valPB6 = PB6->value();
-                writeSerialData(serialPort, 0x14);
-                writeToControlsLog("", "", "", "", "0", "", "", "", "", "", "", "", "");
-            }
-            if (PC10->value() != valPC10 && PC10->value() == 1)
-            {
-                valPC10 = PC10->value();
-                writeSerialData(serialPort, 0x02);
-                writeToControlsLog("", "", "", "", "", "1", "", "", "", "", "", "", "");
-            }
-            else if (PC10->value() != valPC10 && PC10->value() == 0)
-            {
-                valPC10 = PC10->value();
-                writeSerialData(serialPort, 0x15);
-                writeToControlsLog("", "", "", "", "", "0", "", "", "", "", "", "", "");
-            }
-            if (PC13->value() != valPC13 && PC13->value() == 1)
-            {
-                valPC13 = PC13->value();
-                writeSerialData(serialPort, 0x03);
-                writeToControlsLog("", "", "", "", "", "", "1", "", "", "", "", "", "");
-            }
-            else if (PC13->value() != valPC13 && PC13->value() == 0)
-            {
-                valPC13 = PC13->value();
-                writeSerialData(serialPort, 0x16);
-                writeToControlsLog("", "", "", "", "", "", "0", "", "", "", "", "", "");
-            }
-            if (PC7->value() != valPC7 && PC7->value() == 1)
-            {
-                valPC7 = PC7->value();
-                writeSerialData(serialPort, 0x04);
-                writeToControlsLog("", "", "", "", "", "", "", "1", "", "", "", "", "");
-            }
-            else if (PC7->value() != valPC7 && PC7->value() == 0)
-            {
-                valPC7 = PC7->value();
-                writeSerialData(serialPort, 0x17);
-                writeToControlsLog("", "", "", "", "", "", "", "0", "", "", "", "", "");
-            }
-            if (PC8->value() != valPC8 && PC8->value() == 1)
-            {
-                valPC8 = PC8->value();
-                writeSerialData(serialPort, 0x05);
-                writeToControlsLog("", "", "", "", "", "", "", "", "1", "", "", "", "");
-            }
-            else if (PC8->value() != valPC8 && PC8->value() == 0)
-            {
-                valPC8 = PC8->value();
-                writeSerialData(serialPort, 0x18);
-                writeToControlsLog("", "", "", "", "", "", "", "", "0", "", "", "", "");
-            }
-            if (PC9->value() != valPC9 && PC9->value() == 1)
+            vector<string> strings;
+            if (viewerMode)
             {
-                valPC9 = PC9->value();
-                writeSerialData(serialPort, 0x06);
-                writeToControlsLog("", "", "", "", "", "", "", "", "", "1", "", "", "");
+                strings = takeTelemetryStrings();
             }
-            else if (PC9->value() != valPC9 && PC9->value() == 0)
+            else if (replayMode)
             {
-                valPC9 = PC9->value();
-                writeSerialData(serialPort, 0x19);
-                writeToControlsLog("", "", "", "", "", "", "", "", "", "0", "", "", "");
-            }
-            if (PC6->value() != valPC6 && PC6->value() == 1)
-            {
-                valPC6 = PC6->value();
-                writeSerialData(serialPort, 0x07);
-                writeToControlsLog("", "", "", "", "", "", "", "", "", "", "1", "", "");
+                // Dispatched as recorded, timestamps included; the strings only fill the panels
+                bool seeked;
+                vector<Frame> frames = takeReplayFrames(seeked);
+                if (seeked)
+                {
+                    // The history, the store and the pyramids only take frames in time order
+                    clearHistory();
+                    clearFrameStore();
+                    clearPyramids();
+                }
+                for (size_t f = 0; f < frames.size(); f++)
+                {
+                    const Frame &frame = frames[f];
+                    Fl_Button *on = frame.type == ERPA_FRAME ? ERPA_ON : frame.type == PMT_FRAME ? PMT_ON : HK_ON;
+                    if (on->value())
+                    {
+                        dispatchFrame(frame);
+                    }
+                    for (int column = 0; column < frame.count; column++)
+                    {
+                        strings.push_back(interpreterString(frame.type, column, frame.values[column]));
+                    }
+                }
             }
-            if (PC6->value() != valPC6 && PC6->value() == 0)
+            else
             {
-                valPC6 = PC6->value();
-                writeSerialData(serialPort, 0x1A);
-                writeToControlsLog("", "", "", "", "", "", "", "", "", "", "0", "", "");
+                outputFile.flush();
+                strings = interpret("mylog.0");
             }
-        }
-
-        if (SDN1->value() != valSDN1 && SDN1->value() == 1)
-        {
-            valSDN1 = SDN1->value();
-            writeSerialData(serialPort, 0x0B);
-            writeToControlsLog("", "", "", "", "", "", "", "", "", "", "", "1", "");
-        }
-        else if (SDN1->value() != valSDN1 && SDN1->value() == 0)
-        {
-            valSDN1 = SDN1->value();
-            writeSerialData(serialPort, 0x0A);
-            writeToControlsLog("", "", "", "", "", "", "", "", "", "", "", "0", "");
-        }
-        if (SDN2->value() != valSDN2 && SDN2->value() == 1)
-        {
-            valSDN2 = SDN2->value();
-            writeSerialData(serialPort, 0x08);
-            writeToControlsLog("", "", "", "", "", "", "", "", "", "", "", "", "1");
-        }
-        else if (SDN2->value() != valSDN2 && SDN2->value() == 0)
-        {
-            valSDN2 = SDN2->value();
-            writeSerialData(serialPort, 0x09);
-            writeToControlsLog("", "", "", "", "", "", "", "", "", "", "", "", "0");
-        }
-
-        if (turnedOff == 0) // Checking if data is being received before going through packet data
-        {
-            outputFile.flush();
-            vector<string> strings = interpret("mylog.0");
             if (!strings.empty())
             {
-                truncate("mylog.0", 0);
+                if (!viewerMode && !replayMode)
+                {
+                    truncate("mylog.0", 0);
+                }
                 for (int i = 0; i < strings.size(); i++)
                 {
                     //cout << strings[i] << endl;
@@ -1243,9 +1514,9 @@ int main(int argc, char **argv)
                         {
                         case 'a':
                         {
-                            if (recording)
+                            if (!replayMode && !erpaFrame[0].empty())
                             {
-                                writeToErpaLog(erpaFrame[0], erpaFrame[1], erpaFrame[6], erpaFrame[3], erpaFrame[4], erpaFrame[5], erpaFrame[2]);
+                                dispatchFrame(makeFrame(ERPA_FRAME, erpaFrame, erpaColumns, takeFrameTime(erpaFrameMs)));
                             }
                             snprintf(buffer, sizeof(buffer), "%s", strings[i].c_str());
                             ERPAsync->value(buffer);
@@ -1299,6 +1570,7 @@ int main(int argc, char **argv)
                             ERPAadc->value(buffer);
                             string logMsg(buffer);
                             erpaFrame[2] = logMsg;
+                            erpaFrameMs = currentTimeMs(); // Last field of the frame
                             break;
                         }
                         }
@@ -1309,9 +1581,9 @@ int main(int argc, char **argv)
                         {
                         case 'i':
                         {
-                            if (recording)
+                            if (!replayMode && !pmtFrame[0].empty())
                             {
-                                writeToPMTLog(pmtFrame[0], pmtFrame[1], pmtFrame[2]);
+                                dispatchFrame(makeFrame(PMT_FRAME, pmtFrame, pmtColumns, takeFrameTime(pmtFrameMs)));
                             }
                             snprintf(buffer, sizeof(buffer), "%s", strings[i].c_str());
                             PMTsync->value(buffer);
@@ -1333,6 +1605,7 @@ int main(int argc, char **argv)
                             PMTadc->value(buffer);
                             string logMsg(buffer);
                             pmtFrame[2] = logMsg;
+                            pmtFrameMs = currentTimeMs(); // Last field of the frame
                             break;
                         }
                         }
@@ -1343,9 +1616,9 @@ int main(int argc, char **argv)
                         {
                         case 'l':
                         {
-                            if (recording)
+                            if (!replayMode && !hkFrame[0].empty())
                             {
-                                writeToHKLog(hkFrame[0], hkFrame[1], hkFrame[13], hkFrame[14], hkFrame[15], hkFrame[16], hkFrame[17], hkFrame[18], hkFrame[2], hkFrame[3], hkFrame[7], hkFrame[4], hkFrame[9], hkFrame[10], hkFrame[8], hkFrame[12], hkFrame[11], hkFrame[5], hkFrame[6]);
+                                dispatchFrame(makeFrame(HK_FRAME, hkFrame, hkColumns, takeFrameTime(hkFrameMs)));
                             }
                             snprintf(buffer, sizeof(buffer), "%s", strings[i].c_str());
                             HKsync->value(buffer);
@@ -1496,6 +1769,7 @@ int main(int argc, char **argv)
                             HKn800vmon->value(buffer);
                             string logMsg(buffer);
                             hkFrame[6] = logMsg;
+                            hkFrameMs = currentTimeMs(); // Last field of the frame
                             break;
                         }
                         }
@@ -1503,13 +1777,24 @@ int main(int argc, char **argv)
                 }
             }
         }
+        if (replayPosition != nullptr && !replayPosition->changed()) // changed() while being dragged
+        {
+            replayPosition->value((replayPositionMs - replayStartMs) / 1000.0);
+        }
+        if (historyPlot != nullptr && historyPlot->endMs < 0)
+        {
+            historyPlot->redraw(); // Follows the newest samples
+        }
         window->redraw(); // Refreshing main window with new data every loop
         Fl::check();
     }
 
     // ------------------------ Cleanup ------------------------
     stopFlag = true;
-    readingThread.join();
+    if (readingThread.joinable())
+    {
+        readingThread.join();
+    }
     outputFile << '\0';
     outputFile.flush();
     outputFile.close();
@@ -0,0 +1,183 @@
+// ---------------------- Controls Log Reader ---------------------
+// Reads a Controls log into the commands it records, for build/controlsAt and
+// for replaying a session's commands (commands/sequencer.cpp). Two formats:
+//  - the .jsonl journal, see commands/controlJournal.cpp
+//  - the older .csv logs, plain or .csv.gz: a header row starting with the
+//    time the log was opened, then "date, time" and a "1", "0" or nothing per
+//    control. They record the 13 switches only, and the GUI started with
+//    every one of them off. A rotated " part N" segment carries on from the
+//    one before it. sys_on turning off is read as the all-off group the GUI
+//    sends for it, 0x13 and then every rail's off command.
+#ifndef LOGGING_CONTROLS_LOG_CPP
+#define LOGGING_CONTROLS_LOG_CPP
+
+#include <stdint.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "../fltk-1.3.8/zlib/zlib.h"
+#include "../commands/commandNames.cpp"
+#include "logIndex.cpp"
+
+using namespace std;
+
+const int controlsLogSwitches = 13; // The first 13 of commandNames, the CONTROL_* order
+const int controlsLogSysOn = 3;      // sys_on, followed by the 7 rails it gates
+const int controlsLogRails = 7;
+
+struct ControlsLogEvent
+{
+    int64_t timestampMs;
+    int name;           // Index into commandNames, -1 for the starting state
+    int value;          // 1 or 0 for a switch, -1 for other commands
+    unsigned char command;
+    int count;          // Times the command was sent in a row
+    uint32_t state;     // Starting state: bit i is commandNames[i]
+    int line;
+};
+
+// The text of "key":"value" or the number of "key":N, empty if absent
+string jsonField(const string &line, const char *key)
+{
+    string quoted = string("\"") + key + "\":";
+    size_t start = line.find(quoted);
+    if (start == string::npos)
+    {
+        return "";
+    }
+    start += quoted.size();
+    if (line[start] == '"')
+    {
+        size_t end = line.find('"', start + 1);
+        return end == string::npos ? "" : line.substr(start + 1, end - start - 1);
+    }
+    size_t end = line.find_first_of(",}", start);
+    return end == string::npos ? "" : line.substr(start, end - start);
+}
+
+int commandNameIndex(const string &name)
+{
+    for (int i = 0; i < commandNameCount; i++)
+    {
+        if (name == commandNames[i].name)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+bool readJournalLine(const string &line, int lineNumber, vector<ControlsLogEvent> &events)
+{
+    string time = jsonField(line, "t");
+    if (time.empty())
+    {
+        return false;
+    }
+    ControlsLogEvent event = {atoll(time.c_str()), -1, -1, 0, 1, 0, lineNumber};
+    string state = jsonField(line, "state");
+    if (!state.empty())
+    {
+        event.state = (uint32_t)strtoul(state.c_str(), nullptr, 10);
+        events.push_back(event);
+        return true;
+    }
+    event.name = commandNameIndex(jsonField(line, "c"));
+    int command = commandByte(jsonField(line, "cmd"));
+    if (event.name == -1 || command == -1)
+    {
+        return false;
+    }
+    event.command = (unsigned char)command;
+    string value = jsonField(line, "v");
+    event.value = value.empty() ? -1 : value == "1";
+    string count = jsonField(line, "n");
+    event.count = count.empty() ? 1 : max(atoi(count.c_str()), 1);
+    events.push_back(event);
+    return true;
+}
+
+bool readCsvLine(const string &line, int lineNumber, bool continuation, vector<ControlsLogEvent> &events)
+{
+    ControlsLogEvent event = {0, -1, -1, 0, 1, 0, lineNumber};
+    if (!parseLogTimestamp(line.c_str(), line.size(), event.timestampMs))
+    {
+        return false;
+    }
+    if (line.find("pmt_on") != string::npos)
+    {
+        if (!continuation)
+        {
+            events.push_back(event); // A new session, everything off
+        }
+        return true;
+    }
+    size_t field = line.find(',', line.find(',') + 1);
+    bool railsOff = false; // Already turned off with sys_on in this row
+    for (int control = 0; control < controlsLogSwitches && field != string::npos; control++)
+    {
+        size_t start = line.find_first_not_of(' ', field + 1);
+        field = line.find(',', field + 1);
+        bool rail = control > controlsLogSysOn && control <= controlsLogSysOn + controlsLogRails;
+        if (start != string::npos && (field == string::npos || start < field) && (line[start] == '0' || line[start] == '1') &&
+            !(rail && railsOff && line[start] == '0'))
+        {
+            event.name = control;
+            event.value = line[start] == '1';
+            event.command = (unsigned char)(event.value ? commandNames[control].on : commandNames[control].off);
+            events.push_back(event);
+        }
+        if (control == controlsLogSysOn && event.name == control && !event.value)
+        {
+            // Sent as 0x13 to 0x1A in one write, see setControl()
+            for (int gated = control + 1; gated <= control + controlsLogRails; gated++)
+            {
+                event.name = gated;
+                event.command = (unsigned char)commandNames[gated].off;
+                events.push_back(event);
+            }
+            railsOff = true;
+        }
+    }
+    return true;
+}
+
+// Appends the events of the log at path; lines that do not parse are reported
+// on stderr and skipped
+bool readControlsLog(const char *path, vector<ControlsLogEvent> &events)
+{
+    gzFile in = gzopen(path, "rb"); // Reads plain files as they are
+    if (in == nullptr)
+    {
+        perror(path);
+        return false;
+    }
+    bool journal = strstr(path, ".jsonl") != nullptr;
+    bool continuation = strstr(path, " part ") != nullptr;
+    char buffer[1024];
+    int lineNumber = 0;
+    while (gzgets(in, buffer, sizeof(buffer)) != nullptr)
+    {
+        lineNumber++;
+        string line = buffer;
+        while (!line.empty() && (line.back() == '\n' || line.back() == '\r'))
+        {
+            line.pop_back();
+        }
+        if (line.empty())
+        {
+            continue;
+        }
+        if (!(journal ? readJournalLine(line, lineNumber, events) : readCsvLine(line, lineNumber, continuation, events)))
+        {
+            fprintf(stderr, "%s:%d: skipped \"%s\"\n", path, lineNumber, line.c_str());
+        }
+    }
+    gzclose(in);
+    return true;
+}
+
+#endif
@@ -0,0 +1,66 @@
+// ----------------------- Log Blocks ---------------------------
+// With --block-logs a log segment is a sequence of framed blocks instead of
+// bare CSV text, so a file cut short by a power loss (or damaged later) can be
+// checked and the intact parts recovered with tools/verifyLog.cpp.
+//
+// Block layout (little endian):
+//   0  uint32 magic     LOG_BLOCK_MAGIC, lets a reader find the next block after damage
+//   4  uint32 length    payload bytes
+//   8  uint64 sequence  0, 1, 2... within the segment
+//  16  uint32 crc       zlib crc32 of bytes 4..15 followed by the payload
+//  20  uint32 reserved  0
+//  24  payload          CSV rows, always whole lines
+#ifndef LOGGING_LOG_BLOCK_CPP
+#define LOGGING_LOG_BLOCK_CPP
+
+#include <stdint.h>
+#include <cstring>
+#include "../fltk-1.3.8/zlib/zlib.h"
+
+#define LOG_BLOCK_MAGIC 0x4B4C4249 // "IBLK"
+#define LOG_BLOCK_HEADER 24
+#define MAX_LOG_BLOCK_PAYLOAD (16 * 1024 * 1024)
+
+uint32_t logBlockCrc(const unsigned char *block, const unsigned char *payload, uint32_t length)
+{
+    uLong crc = crc32(0L, block + 4, 12);
+    return crc32(crc, payload, length);
+}
+
+void encodeLogBlockHeader(unsigned char *out, const unsigned char *payload, uint32_t length, uint64_t sequence)
+{
+    uint32_t magic = LOG_BLOCK_MAGIC;
+    uint32_t reserved = 0;
+    memcpy(out, &magic, 4);
+    memcpy(out + 4, &length, 4);
+    memcpy(out + 8, &sequence, 8);
+    uint32_t crc = logBlockCrc(out, payload, length);
+    memcpy(out + 16, &crc, 4);
+    memcpy(out + 20, &reserved, 4);
+}
+
+// Checks the block at data; returns its total size, or 0 if available bytes do
+// not hold an intact block there
+size_t checkLogBlock(const unsigned char *data, size_t available, uint64_t &sequence)
+{
+    if (available < LOG_BLOCK_HEADER)
+    {
+        return 0;
+    }
+    uint32_t magic, length, crc;
+    memcpy(&magic, data, 4);
+    memcpy(&length, data + 4, 4);
+    memcpy(&crc, data + 16, 4);
+    if (magic != LOG_BLOCK_MAGIC || length > MAX_LOG_BLOCK_PAYLOAD || length > available - LOG_BLOCK_HEADER)
+    {
+        return 0;
+    }
+    if (logBlockCrc(data, data + LOG_BLOCK_HEADER, length) != crc)
+    {
+        return 0;
+    }
+    memcpy(&sequence, data + 8, 8);
+    return LOG_BLOCK_HEADER + length;
+}
+
+#endif
@@ -0,0 +1,167 @@
+// ---------------------- Log Time Index ------------------------
+// Every plain .csv log segment gets a sparse sidecar "<segment>.csv.idx",
+// written while recording: one entry every logIndexEvery rows with the row's
+// time, its sequence number and the byte offset where the row starts. A reader
+// binary searches the entries and only scans at most logIndexEvery rows of the
+// CSV itself; see tools/sliceLog.cpp.
+//
+// Layout (little endian):
+//   header  uint32 magic LOG_INDEX_MAGIC, uint32 version, uint32 rows per entry, uint32 reserved
+//   entry   int64 timestampMs, uint64 byte offset, uint32 sequence, uint32 reserved
+#ifndef LOGGING_LOG_INDEX_CPP
+#define LOGGING_LOG_INDEX_CPP
+
+#include <stdint.h>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+using namespace std;
+
+#define LOG_INDEX_MAGIC 0x5844494C // "LIDX"
+#define LOG_INDEX_VERSION 1
+
+struct LogIndexHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t every;
+    uint32_t reserved;
+};
+
+struct LogIndexEntry
+{
+    int64_t timestampMs;
+    uint64_t offset;
+    uint32_t sequence;
+    uint32_t reserved;
+};
+
+// -------------------------- Writer ---------------------------
+FILE *createLogIndex(const string &csvPath, uint32_t every)
+{
+    FILE *index = fopen((csvPath + ".idx").c_str(), "wb");
+    if (index == nullptr)
+    {
+        return nullptr;
+    }
+    LogIndexHeader header = {LOG_INDEX_MAGIC, LOG_INDEX_VERSION, every, 0};
+    fwrite(&header, sizeof(header), 1, index);
+    fflush(index);
+    return index;
+}
+
+void appendLogIndex(FILE *index, int64_t timestampMs, uint64_t offset, uint32_t sequence)
+{
+    LogIndexEntry entry = {timestampMs, offset, sequence, 0};
+    fwrite(&entry, sizeof(entry), 1, index);
+    fflush(index); // Entries are rare, so keep the index as current as the CSV
+}
+
+// -------------------------- Reader ---------------------------
+// Loads csvPath + ".idx"; false if there is none or it is not an index
+bool loadLogIndex(const string &csvPath, vector<LogIndexEntry> &entries)
+{
+    entries.clear();
+    FILE *index = fopen((csvPath + ".idx").c_str(), "rb");
+    if (index == nullptr)
+    {
+        return false;
+    }
+    LogIndexHeader header;
+    bool ok = fread(&header, sizeof(header), 1, index) == 1 && header.magic == LOG_INDEX_MAGIC && header.version == LOG_INDEX_VERSION;
+    LogIndexEntry entry;
+    while (ok && fread(&entry, sizeof(entry), 1, index) == 1) // A torn last entry is simply left out
+    {
+        entries.push_back(entry);
+    }
+    fclose(index);
+    return ok;
+}
+
+// Offset to start scanning from to find the first row at or after timestampMs
+uint64_t seekLogTime(const vector<LogIndexEntry> &entries, int64_t timestampMs)
+{
+    vector<LogIndexEntry>::const_iterator after = lower_bound(entries.begin(), entries.end(), timestampMs,
+                                                              [](const LogIndexEntry &entry, int64_t ms)
+                                                              { return entry.timestampMs < ms; });
+    if (after == entries.begin())
+    {
+        return 0;
+    }
+    return (after - 1)->offset;
+}
+
+// Offset to start scanning from to find sequence number sequence. The counter
+// wraps, so this finds its first occurrence in the file.
+uint64_t seekLogSequence(const vector<LogIndexEntry> &entries, uint32_t sequence)
+{
+    uint64_t offset = 0;
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        if (entries[i].sequence > sequence || (i > 0 && entries[i].sequence < entries[i - 1].sequence))
+        {
+            break;
+        }
+        offset = entries[i].offset;
+    }
+    return offset;
+}
+
+// ---------------------- Row Timestamps -----------------------
+// Parses the "MM-DD-YYYY, HH:MM:SS:ms" at the start of a log row. mktime only
+// runs when the second differs from the previous call on the same thread.
+bool parseLogTimestamp(const char *row, size_t length, int64_t &timestampMs)
+{
+    static thread_local char lastPrefix[21] = "";
+    static thread_local int64_t lastSecondMs = 0;
+    const size_t prefixLength = 21; // Up to and including the ':' before the ms
+    if (length <= prefixLength || row[2] != '-' || row[10] != ',' || row[prefixLength - 1] != ':')
+    {
+        return false;
+    }
+    if (memcmp(row, lastPrefix, prefixLength) != 0)
+    {
+        char prefix[prefixLength + 1]; // sscanf needs a terminated string, rows are not
+        memcpy(prefix, row, prefixLength);
+        prefix[prefixLength] = '\0';
+        struct tm tm = {};
+        if (sscanf(prefix, "%d-%d-%d, %d:%d:%d", &tm.tm_mon, &tm.tm_mday, &tm.tm_year, &tm.tm_hour, &tm.tm_min, &tm.tm_sec) != 6)
+        {
+            return false;
+        }
+        tm.tm_mon -= 1;
+        tm.tm_year -= 1900;
+        tm.tm_isdst = -1;
+        lastSecondMs = (int64_t)mktime(&tm) * 1000;
+        memcpy(lastPrefix, row, prefixLength);
+    }
+    int ms = 0;
+    for (size_t i = prefixLength; i < length && row[i] >= '0' && row[i] <= '9'; i++)
+    {
+        ms = ms * 10 + row[i] - '0';
+    }
+    timestampMs = lastSecondMs + ms;
+    return true;
+}
+
+// "HH:MM:SS[.mmm]" on the given date, or "MM-DD-YYYY HH:MM:SS[.mmm]"
+bool parseTimeArgument(const string &argument, const char *dateRow, int64_t &timestampMs)
+{
+    string date = argument.find('-') != string::npos ? argument.substr(0, argument.find(' ')) : string(dateRow, 10);
+    string time = argument.find('-') != string::npos ? argument.substr(argument.find(' ') + 1) : argument;
+    string milliseconds = "0";
+    if (time.find('.') != string::npos)
+    {
+        milliseconds = time.substr(time.find('.') + 1);
+        time = time.substr(0, time.find('.'));
+        milliseconds = (milliseconds + "00").substr(0, 3);
+    }
+    string row = date + ", " + time + ":" + milliseconds;
+    return row.size() > 21 && parseLogTimestamp(row.c_str(), row.size(), timestampMs);
+}
+
+#endif
@@ -0,0 +1,400 @@
+// ------------------- Rotating Session Logs --------------------
+// The ERPA, PMT, HK and Commands logs are written through RotatingLog. The
+// Controls journal (commands/controlJournal.cpp) is not: it is a few lines a
+// session, and its first line holds the starting state.
+//
+// A log is split into segments by size (logRotateBytes) and/or age
+// (logRotateMs); the first segment keeps the usual "ERPA 2024-03-28
+// 12-51-37.csv" name and later ones get " part 2", " part 3"... Every segment
+// starts with its header, so it can be read on its own.
+//
+// Compression uses the zlib vendored in fltk-1.3.8/zlib, two ways:
+//  - compressClosedLogs: closed segments are gzipped on a low priority
+//    background thread and the .csv removed once the .csv.gz is complete.
+//    .csv.blk segments are left alone, verifyLog reads them as they are.
+//  - liveGzipLogs: the active segment is written as a .csv.gz directly, with a
+//    full flush every gzipFlushMs so a crash loses at most that much.
+// Writers never wait on the compression thread.
+//
+// With blockLogs the segment is a .csv.blk of checksummed blocks instead (see
+// logging/logBlock.cpp), written out every logBlockBytes or logBlockMs and
+// then synced to disk by a thread of its own, so a slow disk never holds up
+// the writer. The writer calls tickRotatingLog() regularly, so the last rows
+// also go out when no more arrive.
+//
+// Plain .csv segments also get a sparse time index, see logging/logIndex.cpp.
+#ifndef LOGGING_ROTATING_LOG_CPP
+#define LOGGING_ROTATING_LOG_CPP
+
+#include <sys/resource.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "../fltk-1.3.8/zlib/zlib.h"
+#include "../frames/frame.cpp"
+#include "logBlock.cpp"
+#include "logIndex.cpp"
+
+using namespace std;
+
+size_t logRotateBytes = 0;   // 0: no size limit
+int64_t logRotateMs = 0;     // 0: no age limit
+bool compressClosedLogs = false;
+bool liveGzipLogs = false;
+const int64_t gzipFlushMs = 2 * 1000;
+bool blockLogs = false;
+const size_t logBlockBytes = 64 * 1024;
+const int64_t logBlockMs = 1000;
+uint32_t logIndexEvery = 1000; // Rows per index entry, 0: no index
+
+struct RotatingLog
+{
+    string baseName;        // Path without ".csv", e.g. "logs/ERPA/ERPA 2024-03-28 12-51-37"
+    string header;          // Written at the top of every segment
+    string path;            // Current segment
+    FILE *file;
+    gzFile gz;
+    int segment;
+    size_t bytes;
+    int64_t openedMs;
+    int64_t flushedMs;
+    string block;           // Rows not yet written out as a block
+    uint64_t blockSequence;
+    FILE *index;            // Plain .csv segments only
+    uint64_t rows;
+};
+
+// ----------------- Background Compression --------------------
+std::thread compressorThread;
+std::mutex compressorMutex;
+std::condition_variable compressorWake;
+deque<string> compressorQueue;
+bool compressorStopping = false;
+
+bool gzipFile(const string &path)
+{
+    FILE *in = fopen(path.c_str(), "rb");
+    if (in == nullptr)
+    {
+        return false;
+    }
+    string gzPath = path + ".gz";
+    gzFile out = gzopen(gzPath.c_str(), "wb6");
+    if (out == nullptr)
+    {
+        fclose(in);
+        return false;
+    }
+    static char buffer[64 * 1024]; // Only ever used by the compressor thread
+    bool ok = true;
+    size_t length;
+    while (ok && (length = fread(buffer, 1, sizeof(buffer), in)) > 0)
+    {
+        ok = gzwrite(out, buffer, length) == (int)length;
+    }
+    ok = ok && !ferror(in);
+    fclose(in);
+    ok = gzclose(out) == Z_OK && ok;
+    if (ok)
+    {
+        unlink(path.c_str());
+        unlink((path + ".idx").c_str()); // Its offsets are into the .csv
+    }
+    else
+    {
+        fprintf(stderr, "Could not compress %s, left as is.\n", path.c_str());
+        unlink(gzPath.c_str());
+    }
+    return ok;
+}
+
+void runLogCompressor()
+{
+#ifdef __APPLE__
+    setpriority(PRIO_DARWIN_THREAD, 0, PRIO_DARWIN_BG);
+#else
+    setpriority(PRIO_PROCESS, 0, 19); // On Linux this only applies to the calling thread
+#endif
+    std::unique_lock<std::mutex> lock(compressorMutex);
+    while (true)
+    {
+        compressorWake.wait(lock, []
+                            { return compressorStopping || !compressorQueue.empty(); });
+        if (compressorQueue.empty())
+        {
+            return; // Stopping, and everything queued has been compressed
+        }
+        string path = compressorQueue.front();
+        compressorQueue.pop_front();
+        lock.unlock();
+        gzipFile(path);
+        lock.lock();
+    }
+}
+
+// Compresses whatever is still queued, then stops the thread
+void stopLogCompressor()
+{
+    {
+        std::lock_guard<std::mutex> lock(compressorMutex);
+        compressorStopping = true;
+    }
+    compressorWake.notify_one();
+    if (compressorThread.joinable())
+    {
+        compressorThread.join();
+    }
+}
+
+void queueCompression(const string &path)
+{
+    {
+        std::lock_guard<std::mutex> lock(compressorMutex);
+        if (compressorStopping)
+        {
+            return;
+        }
+        compressorQueue.push_back(path);
+        if (!compressorThread.joinable())
+        {
+            compressorThread = std::thread(runLogCompressor);
+            atexit(stopLogCompressor); // exit() with the thread still joinable would abort
+        }
+    }
+    compressorWake.notify_one();
+}
+
+// ----------------------- Background Sync ---------------------
+// fdatasync can take a long time on a busy disk, so the writer only hands over
+// a duplicate of the file's descriptor; it stays valid when the segment is
+// closed first.
+std::thread logSyncThread;
+std::mutex logSyncMutex;
+std::condition_variable logSyncWake;
+deque<int> logSyncQueue;
+bool logSyncStopping = false;
+
+void runLogSync()
+{
+    std::unique_lock<std::mutex> lock(logSyncMutex);
+    while (true)
+    {
+        logSyncWake.wait(lock, []
+                         { return logSyncStopping || !logSyncQueue.empty(); });
+        if (logSyncQueue.empty())
+        {
+            return; // Stopping, and everything queued has been synced
+        }
+        int fd = logSyncQueue.front();
+        logSyncQueue.pop_front();
+        lock.unlock();
+#ifdef __APPLE__
+        fsync(fd);
+#else
+        fdatasync(fd); // On disk, not only in the page cache, before a power cut
+#endif
+        close(fd);
+        lock.lock();
+    }
+}
+
+// Syncs what is queued, then stops the thread
+void stopLogSync()
+{
+    {
+        std::lock_guard<std::mutex> lock(logSyncMutex);
+        logSyncStopping = true;
+    }
+    logSyncWake.notify_one();
+    if (logSyncThread.joinable())
+    {
+        logSyncThread.join();
+    }
+}
+
+void queueLogSync(FILE *file)
+{
+    {
+        std::lock_guard<std::mutex> lock(logSyncMutex);
+        int fd = logSyncStopping ? -1 : dup(fileno(file));
+        if (fd == -1)
+        {
+            return;
+        }
+        logSyncQueue.push_back(fd);
+        if (!logSyncThread.joinable())
+        {
+            logSyncThread = std::thread(runLogSync);
+            atexit(stopLogSync);
+        }
+    }
+    logSyncWake.notify_one();
+}
+
+// ------------------------ Segments ---------------------------
+bool rawWriteLog(RotatingLog &log, const char *data, size_t length)
+{
+    if (blockLogs)
+    {
+        log.block.append(data, length);
+        return true;
+    }
+    if (log.gz != nullptr)
+    {
+        return gzwrite(log.gz, data, length) == (int)length;
+    }
+    return fwrite(data, 1, length, log.file) == length;
+}
+
+// Writes the pending rows as one block; a block is either all on disk or detectably not
+void flushLogBlock(RotatingLog &log)
+{
+    if (log.block.empty() || log.file == nullptr)
+    {
+        return;
+    }
+    unsigned char header[LOG_BLOCK_HEADER];
+    encodeLogBlockHeader(header, (const unsigned char *)log.block.data(), log.block.size(), log.blockSequence++);
+    fwrite(header, 1, sizeof(header), log.file);
+    fwrite(log.block.data(), 1, log.block.size(), log.file);
+    fflush(log.file);
+    queueLogSync(log.file);
+    log.block.clear();
+}
+
+bool openLogSegment(RotatingLog &log)
+{
+    log.path = log.baseName;
+    if (log.segment > 1)
+    {
+        log.path += " part " + to_string(log.segment);
+    }
+    log.path += blockLogs ? ".csv.blk" : liveGzipLogs ? ".csv.gz" : ".csv";
+    log.file = nullptr;
+    log.gz = nullptr;
+    log.block.clear();
+    log.blockSequence = 0;
+    if (liveGzipLogs && !blockLogs)
+    {
+        log.gz = gzopen(log.path.c_str(), "ab1"); // Fast level, this runs on the acquisition side
+    }
+    else
+    {
+        log.file = fopen(log.path.c_str(), "a");
+    }
+    if (log.file == nullptr && log.gz == nullptr)
+    {
+        fprintf(stderr, "Could not open %s.\n", log.path.c_str());
+        return false;
+    }
+    log.index = nullptr;
+    log.rows = 0;
+    if (log.file != nullptr && !blockLogs && logIndexEvery > 0)
+    {
+        log.index = createLogIndex(log.path, logIndexEvery);
+    }
+    log.bytes = 0;
+    log.openedMs = currentTimeMs();
+    log.flushedMs = log.openedMs;
+    string header = log.header + "\n";
+    rawWriteLog(log, header.data(), header.size());
+    log.bytes += header.size();
+    return true;
+}
+
+void closeLogSegment(RotatingLog &log)
+{
+    if (log.index != nullptr)
+    {
+        fclose(log.index);
+        log.index = nullptr;
+    }
+    if (log.gz != nullptr)
+    {
+        gzclose(log.gz);
+        log.gz = nullptr;
+    }
+    if (log.file != nullptr)
+    {
+        flushLogBlock(log);
+        fclose(log.file);
+        log.file = nullptr;
+        if (compressClosedLogs && !blockLogs)
+        {
+            queueCompression(log.path);
+        }
+    }
+}
+
+bool isLogOpen(const RotatingLog &log)
+{
+    return log.file != nullptr || log.gz != nullptr;
+}
+
+bool openRotatingLog(RotatingLog &log, const string &baseName, const string &header)
+{
+    log.baseName = baseName;
+    log.header = header;
+    log.segment = 1;
+    return openLogSegment(log);
+}
+
+// Flushes the live gzip stream and writes out the pending block once they are
+// due; from the thread that writes the log
+void tickRotatingLog(RotatingLog &log, int64_t now)
+{
+    if (log.gz != nullptr && now - log.flushedMs >= gzipFlushMs)
+    {
+        gzflush(log.gz, Z_FULL_FLUSH); // Everything so far can be decompressed even if we crash
+        log.flushedMs = now;
+    }
+    if (blockLogs && !log.block.empty() && now - log.flushedMs >= logBlockMs)
+    {
+        flushLogBlock(log);
+        log.flushedMs = now;
+    }
+}
+
+// Frame rows pass their time and sequence number for the index
+void writeRotatingLog(RotatingLog &log, const char *data, size_t length, int64_t timestampMs = -1, uint32_t sequence = 0)
+{
+    if (!isLogOpen(log))
+    {
+        return;
+    }
+    bool full = logRotateBytes > 0 && log.bytes + length > logRotateBytes && log.bytes > log.header.size() + 1;
+    int64_t now = logRotateMs > 0 || log.gz != nullptr || blockLogs ? currentTimeMs() : 0;
+    if (full || (logRotateMs > 0 && now - log.openedMs >= logRotateMs))
+    {
+        closeLogSegment(log);
+        log.segment++;
+        if (!openLogSegment(log))
+        {
+            return;
+        }
+    }
+    if (log.index != nullptr && timestampMs >= 0 && log.rows++ % logIndexEvery == 0)
+    {
+        appendLogIndex(log.index, timestampMs, log.bytes, sequence);
+    }
+    rawWriteLog(log, data, length);
+    log.bytes += length;
+    if (blockLogs && log.block.size() >= logBlockBytes)
+    {
+        flushLogBlock(log);
+        log.flushedMs = now;
+    }
+    tickRotatingLog(log, now);
+}
+
+void closeRotatingLog(RotatingLog &log)
+{
+    closeLogSegment(log);
+}
+
+#endif
@@ -0,0 +1,436 @@
+// ---------------------- Session Replay ------------------------
+// Plays recorded ERPA, PMT and HK logs back through the GUI. The files are
+// mmapped (.csv.gz ones inflated into memory) and merged by time on a replay
+// thread, which paces the frames by their recorded timestamps divided by
+// replaySpeed (0: as fast as the GUI takes them) and hands them to the main
+// loop as parsed frames. The main loop dispatches them with their recorded
+// timestamps, so triggers, the history, the pyramid and RECORD see the times
+// of the session, and fills the panels from them. Pause, speed changes and seeks are requests the thread picks up within
+// replayPollMs; seeks use the .idx sidecars from logging/logIndex.cpp when they
+// exist.
+//
+// A session is every segment logging/rotatingLog.cpp wrote for it: the first
+// one, " part 2", " part 3"..., plain or gzipped. .csv.blk segments cannot be
+// replayed, verifyLog -r turns them into a .csv first.
+#ifndef REPLAY_SESSION_REPLAY_CPP
+#define REPLAY_SESSION_REPLAY_CPP
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include "../fltk-1.3.8/zlib/zlib.h"
+#include "../frames/frame.cpp"
+#include "../logging/logIndex.cpp"
+
+using namespace std;
+
+struct ReplayFile
+{
+    string path;
+    int type;
+    const char *data;
+    size_t size;
+    bool mapped;   // Else inflated from a .csv.gz with malloc
+    size_t firstRow;
+    size_t offset; // Next row to read
+    vector<LogIndexEntry> index;
+    bool haveFrame;
+    Frame frame; // Next frame of this file, read ahead for the merge
+};
+
+vector<ReplayFile> replayFiles;
+int64_t replayStartMs = 0; // Time of the first and last row over all files
+int64_t replayEndMs = 0;
+std::atomic<double> replaySpeed(1.0);
+std::atomic<bool> replayPaused(false);
+std::atomic<int64_t> replaySeekMs(-1); // Pending seek, -1 for none
+std::atomic<int64_t> replayPositionMs(0);
+std::atomic<bool> replayFinished(false);
+std::atomic<bool> replayStopping(false);
+const int64_t replayPollMs = 20;
+const size_t maxPendingReplayFrames = 8 * 1024; // Beyond this the GUI is behind, wait for it
+
+std::thread replayThread;
+std::mutex replayMutex;
+std::condition_variable replayWake;
+vector<Frame> replayFrames; // Pending frames, taken by the main loop
+bool replaySeeked = false;  // The frames jump in time; the main loop drops what it holds
+
+size_t replayLineEnd(const ReplayFile &file, size_t offset)
+{
+    const char *newline = (const char *)memchr(file.data + offset, '\n', file.size - offset);
+    return newline == nullptr ? file.size : newline - file.data + 1;
+}
+
+// Parses the row at file.offset and following rows until one is a valid frame
+void readReplayFrame(ReplayFile &file)
+{
+    file.haveFrame = false;
+    while (!file.haveFrame && file.offset < file.size)
+    {
+        size_t end = replayLineEnd(file, file.offset);
+        const char *row = file.data + file.offset;
+        Frame &frame = file.frame;
+        if (parseLogTimestamp(row, end - file.offset, frame.timestampMs))
+        {
+            frame.type = file.type;
+            frame.count = frameFieldCounts[file.type];
+            const char *rowEnd = file.data + end;
+            const char *field = row;
+            int column = -2; // Date and time come first
+            while (field != nullptr && column < frame.count)
+            {
+                if (column >= 0)
+                {
+                    frame.values[column] = strtod(field, nullptr); // strtod reads the 0x sync word too
+                }
+                column++;
+                field = (const char *)memchr(field, ',', rowEnd - field);
+                field = field == nullptr ? nullptr : field + 1;
+            }
+            file.haveFrame = column == frame.count;
+        }
+        file.offset = end;
+    }
+}
+
+bool endsWith(const string &text, const char *suffix)
+{
+    size_t length = strlen(suffix);
+    return text.size() >= length && text.compare(text.size() - length, length, suffix) == 0;
+}
+
+// Decompresses a whole .csv.gz into memory; a live gzip segment cut short by a
+// crash is kept up to where it ends
+bool inflateReplayFile(ReplayFile &file)
+{
+    gzFile in = gzopen(file.path.c_str(), "rb");
+    if (in == nullptr)
+    {
+        perror(file.path.c_str());
+        return false;
+    }
+    size_t capacity = 1 << 20;
+    char *data = (char *)malloc(capacity);
+    size_t size = 0;
+    int got;
+    while (data != nullptr && (got = gzread(in, data + size, capacity - size)) > 0)
+    {
+        size += got;
+        if (size == capacity)
+        {
+            capacity *= 2;
+            char *grown = (char *)realloc(data, capacity);
+            if (grown == nullptr)
+            {
+                free(data);
+            }
+            data = grown;
+        }
+    }
+    int error;
+    gzerror(in, &error);
+    gzclose(in);
+    if (data == nullptr || size == 0)
+    {
+        fprintf(stderr, "%s: cannot decompress.\n", file.path.c_str());
+        free(data);
+        return false;
+    }
+    if (error != Z_OK)
+    {
+        fprintf(stderr, "%s is cut short, replaying the %zu bytes before that.\n", file.path.c_str(), size);
+    }
+    file.data = data;
+    file.size = size;
+    file.mapped = false;
+    return true;
+}
+
+void releaseReplayFile(ReplayFile &file)
+{
+    if (file.mapped)
+    {
+        munmap((void *)file.data, file.size);
+    }
+    else
+    {
+        free((void *)file.data);
+    }
+}
+
+bool openReplayFile(const string &path)
+{
+    ReplayFile file;
+    file.path = path;
+    if (endsWith(path, ".blk") || endsWith(path, ".blk.gz"))
+    {
+        fprintf(stderr, "%s is a block log and cannot be replayed, recover it with verifyLog -r first.\n", path.c_str());
+        return false;
+    }
+    if (endsWith(path, ".gz"))
+    {
+        if (!inflateReplayFile(file))
+        {
+            return false;
+        }
+    }
+    else
+    {
+        int fd = open(path.c_str(), O_RDONLY);
+        struct stat info;
+        if (fd == -1 || fstat(fd, &info) == -1 || info.st_size == 0)
+        {
+            perror(path.c_str());
+            if (fd != -1)
+            {
+                close(fd);
+            }
+            return false;
+        }
+        void *memory = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (memory == MAP_FAILED)
+        {
+            perror(path.c_str());
+            return false;
+        }
+        file.data = (const char *)memory;
+        file.size = info.st_size;
+        file.mapped = true;
+    }
+    file.firstRow = replayLineEnd(file, 0);
+
+    // The header tells the packet type: date, time and then the fields
+    int fields = -1;
+    for (size_t i = 0; i < file.firstRow; i++)
+    {
+        fields += file.data[i] == ',';
+    }
+    file.type = 0;
+    for (int type = ERPA_FRAME; type <= HK_FRAME; type++)
+    {
+        if (frameFieldCounts[type] == fields)
+        {
+            file.type = type;
+        }
+    }
+    if (file.type == 0)
+    {
+        fprintf(stderr, "%s is not an ERPA, PMT or HK log.\n", path.c_str());
+        releaseReplayFile(file);
+        return false;
+    }
+    loadLogIndex(path, file.index);
+
+    // Last row for the session length
+    size_t last = file.size - 1;
+    while (last > file.firstRow && file.data[last - 1] != '\n')
+    {
+        last--;
+    }
+    file.offset = last;
+    readReplayFrame(file);
+    int64_t lastMs = file.haveFrame ? file.frame.timestampMs : 0;
+    file.offset = file.firstRow;
+    readReplayFrame(file);
+    if (!file.haveFrame)
+    {
+        fprintf(stderr, "%s has no rows.\n", path.c_str());
+        releaseReplayFile(file);
+        return false;
+    }
+    replayStartMs = replayFiles.empty() ? file.frame.timestampMs : min(replayStartMs, file.frame.timestampMs);
+    replayEndMs = max(replayEndMs, lastMs);
+    replayFiles.push_back(file);
+    return true;
+}
+
+// The segment number of name if it is a segment of the log prefix, e.g.
+// "ERPA <session> part 3.csv.gz" is 3; 0 if it is not one
+int replaySegmentNumber(const string &name, const string &prefix)
+{
+    if (name.compare(0, prefix.size(), prefix) != 0)
+    {
+        return 0;
+    }
+    const char *rest = name.c_str() + prefix.size();
+    int segment = 1;
+    if (strncmp(rest, " part ", 6) == 0)
+    {
+        char *end;
+        segment = strtol(rest + 6, &end, 10);
+        rest = end;
+    }
+    return strncmp(rest, ".csv", 4) == 0 ? segment : 0;
+}
+
+// A .csv or .csv.gz path, or a session name like "2024-03-28 12-51-37" for
+// every segment of its ERPA, PMT and HK logs. False if any of them cannot be
+// replayed.
+bool addReplaySource(const string &source)
+{
+    if (endsWith(source, ".csv") || endsWith(source, ".gz") || endsWith(source, ".blk"))
+    {
+        return openReplayFile(source);
+    }
+    int segments = 0;
+    const char *types[3] = {"ERPA", "PMT", "HK"};
+    for (int i = 0; i < 3; i++)
+    {
+        string directory = string("logs/") + types[i];
+        string prefix = string(types[i]) + " " + source;
+        vector<pair<int, string>> names;
+        DIR *dir = opendir(directory.c_str());
+        struct dirent *entry;
+        while (dir != nullptr && (entry = readdir(dir)) != nullptr)
+        {
+            string name = entry->d_name;
+            int segment = replaySegmentNumber(name, prefix);
+            if (segment > 0 && !endsWith(name, ".idx"))
+            {
+                names.push_back(make_pair(segment, name));
+            }
+        }
+        if (dir != nullptr)
+        {
+            closedir(dir);
+        }
+        sort(names.begin(), names.end());
+        for (size_t n = 0; n < names.size(); n++)
+        {
+            if (!openReplayFile(directory + "/" + names[n].second))
+            {
+                return false; // Replaying the rest would leave a hole nobody sees
+            }
+            segments++;
+        }
+    }
+    if (segments == 0)
+    {
+        fprintf(stderr, "No logs found for session %s.\n", source.c_str());
+    }
+    return segments > 0;
+}
+
+void seekReplayFiles(int64_t timestampMs)
+{
+    for (size_t i = 0; i < replayFiles.size(); i++)
+    {
+        ReplayFile &file = replayFiles[i];
+        file.offset = max<size_t>(file.firstRow, seekLogTime(file.index, timestampMs));
+        do
+        {
+            readReplayFrame(file);
+        } while (file.haveFrame && file.frame.timestampMs < timestampMs);
+    }
+}
+
+void runReplay()
+{
+    int64_t anchorWallMs = currentTimeMs(); // Wall time at which anchorLogMs was due
+    int64_t anchorLogMs = replayStartMs;
+    double anchorSpeed = replaySpeed;
+    std::unique_lock<std::mutex> lock(replayMutex);
+    while (!replayStopping)
+    {
+        int64_t seek = replaySeekMs.exchange(-1);
+        if (seek >= 0)
+        {
+            replayFrames.clear(); // What was queued before the seek is stale
+            replaySeeked = true;
+            lock.unlock();
+            seekReplayFiles(seek);
+            lock.lock();
+            replayPositionMs = seek;
+            replayFinished = false;
+            anchorWallMs = currentTimeMs();
+            anchorLogMs = seek;
+        }
+        ReplayFile *next = nullptr;
+        for (size_t i = 0; i < replayFiles.size(); i++)
+        {
+            if (replayFiles[i].haveFrame && (next == nullptr || replayFiles[i].frame.timestampMs < next->frame.timestampMs))
+            {
+                next = &replayFiles[i];
+            }
+        }
+        replayFinished = next == nullptr;
+        if (replayPaused || next == nullptr || replayFrames.size() > maxPendingReplayFrames)
+        {
+            replayWake.wait_for(lock, chrono::milliseconds(replayFinished || replayPaused ? replayPollMs : 1));
+            anchorWallMs = currentTimeMs(); // Resume from where we stopped, not from where the clock got to
+            anchorLogMs = replayPositionMs;
+            continue;
+        }
+        double speed = replaySpeed;
+        if (speed != anchorSpeed)
+        {
+            anchorWallMs = currentTimeMs();
+            anchorLogMs = replayPositionMs;
+            anchorSpeed = speed;
+        }
+        if (speed > 0)
+        {
+            int64_t dueMs = anchorWallMs + (int64_t)((next->frame.timestampMs - anchorLogMs) / speed);
+            int64_t nowMs = currentTimeMs();
+            if (dueMs > nowMs)
+            {
+                replayWake.wait_for(lock, chrono::milliseconds(min(dueMs - nowMs, replayPollMs)));
+                continue;
+            }
+        }
+        replayFrames.push_back(next->frame);
+        replayPositionMs = next->frame.timestampMs;
+        readReplayFrame(*next);
+    }
+}
+
+void stopReplay()
+{
+    replayStopping = true;
+    replayWake.notify_one();
+    if (replayThread.joinable())
+    {
+        replayThread.join();
+    }
+}
+
+void startReplay()
+{
+    replayPositionMs = replayStartMs;
+    replayThread = std::thread(runReplay);
+    atexit(stopReplay);
+}
+
+// seeked is set if the frames start after a seek
+vector<Frame> takeReplayFrames(bool &seeked)
+{
+    vector<Frame> frames;
+    std::lock_guard<std::mutex> lock(replayMutex);
+    frames.swap(replayFrames);
+    seeked = replaySeeked;
+    replaySeeked = false;
+    return frames;
+}
+
+// Seeks to a time relative to the start of the session
+void seekReplay(int64_t offsetMs)
+{
+    replaySeekMs = replayStartMs + max<int64_t>(0, min(offsetMs, replayEndMs - replayStartMs));
+    replayWake.notify_one();
+}
+
+#endif
@@ -0,0 +1,243 @@
+// ---------------------- Legacy CSV Logs -----------------------
+// Reads ERPA, PMT and HK CSV logs in every header variant logs/ has seen:
+//   "date, time, sync, seq, ..."      current logs
+//   "11-28-2023, 10:44:08:132, ..."   Archive logs, a timestamp instead of date and time
+//   2v5mov / 2v5mon, 5vrefmon / 5refmon spellings of the HK columns
+// Columns are matched to frame fields by name, so the variants all end up as
+// the same Frames. Numbers go through parseFastDouble instead of strtod.
+#ifndef SESSIONS_LEGACY_CSV_CPP
+#define SESSIONS_LEGACY_CSV_CPP
+
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "../frames/frame.cpp"
+#include "../logging/logIndex.cpp"
+
+using namespace std;
+
+// ------------------------ Fast Floats ------------------------
+// Powers of ten that are exact in a double
+const double exactPowersOfTen[23] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                     1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+// Parses the number at p, skipping leading spaces: decimal ("-00.702", "1.5e-3")
+// or a "0xAAAA" sync word. Returns the end of the number, or nullptr if there
+// is none before end. The result is identical to strtod: when the digits fit
+// in 53 bits and the power of ten is exact, one multiply or divide rounds
+// correctly; anything else is handed to strtod.
+const char *parseFastDouble(const char *p, const char *end, double &value)
+{
+    while (p < end && *p == ' ')
+    {
+        p++;
+    }
+    const char *start = p;
+    bool negative = p < end && *p == '-';
+    if (p < end && (*p == '-' || *p == '+'))
+    {
+        p++;
+    }
+    if (end - p > 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X') && isxdigit((unsigned char)p[2]))
+    {
+        uint64_t hex = 0;
+        for (p += 2; p < end && isxdigit((unsigned char)*p) && hex < (1ULL << 52); p++)
+        {
+            hex = hex * 16 + (*p <= '9' ? *p - '0' : (*p | 0x20) - 'a' + 10);
+        }
+        if (p < end && isxdigit((unsigned char)*p))
+        {
+            return nullptr; // Far longer than any sync word
+        }
+        value = negative ? -(double)hex : (double)hex;
+        return p;
+    }
+    uint64_t mantissa = 0;
+    int digits = 0; // Significant digits in mantissa
+    int exponent = 0;
+    bool any = false;
+    for (; p < end && *p >= '0' && *p <= '9'; p++)
+    {
+        any = true;
+        if (mantissa != 0 || *p != '0')
+        {
+            mantissa = mantissa * 10 + (*p - '0');
+            digits++;
+        }
+    }
+    if (p < end && *p == '.')
+    {
+        for (p++; p < end && *p >= '0' && *p <= '9'; p++)
+        {
+            any = true;
+            if (mantissa != 0 || *p != '0')
+            {
+                mantissa = mantissa * 10 + (*p - '0');
+                digits++;
+            }
+            exponent--;
+        }
+    }
+    if (!any)
+    {
+        return nullptr;
+    }
+    if (p < end && (*p == 'e' || *p == 'E'))
+    {
+        const char *e = p + 1;
+        bool negativeExponent = e < end && *e == '-';
+        if (e < end && (*e == '-' || *e == '+'))
+        {
+            e++;
+        }
+        int power = 0;
+        if (e < end && *e >= '0' && *e <= '9')
+        {
+            for (; e < end && *e >= '0' && *e <= '9'; e++)
+            {
+                power = min(power * 10 + (*e - '0'), 100000);
+            }
+            exponent += negativeExponent ? -power : power;
+            p = e;
+        }
+    }
+    if (digits <= 15 && exponent >= -22 && exponent <= 22) // 10^15 < 2^53
+    {
+        double result = (double)mantissa;
+        result = exponent < 0 ? result / exactPowersOfTen[-exponent] : result * exactPowersOfTen[exponent];
+        value = negative ? -result : result;
+        return p;
+    }
+    char text[128]; // Rare: long mantissas or huge exponents
+    size_t length = min<size_t>(p - start, sizeof(text) - 1);
+    memcpy(text, start, length);
+    text[length] = '\0';
+    value = strtod(text, nullptr);
+    return p;
+}
+
+// ---------------------- Header Variants ----------------------
+struct CsvLayout
+{
+    int type;             // ERPA_FRAME, PMT_FRAME, HK_FRAME or 0 for none
+    int columns;          // Value columns after date and time
+    int field[32];        // Frame field of each value column, -1 to ignore it
+    bool timestampHeader; // Archive style header starting with a timestamp
+    string variant;       // Short description for reports
+};
+
+// Older spellings of field names
+const char *fieldAliases[2][2] = {{"2v5mov", "2v5mon"}, {"5vrefmon", "5refmon"}};
+
+string trimField(const char *start, const char *end)
+{
+    while (start < end && (*start == ' ' || *start == '\r'))
+    {
+        start++;
+    }
+    while (end > start && (end[-1] == ' ' || end[-1] == '\r' || end[-1] == '\n'))
+    {
+        end--;
+    }
+    return string(start, end);
+}
+
+// False if the header is not that of an ERPA, PMT or HK log
+bool detectCsvLayout(const char *header, size_t length, CsvLayout &layout)
+{
+    vector<string> names;
+    const char *end = header + length;
+    for (const char *start = header; start <= end;)
+    {
+        const char *comma = (const char *)memchr(start, ',', end - start);
+        comma = comma == nullptr ? end : comma;
+        names.push_back(trimField(start, comma));
+        start = comma + 1;
+    }
+    int64_t timestampMs;
+    layout.timestampHeader = parseLogTimestamp(header, length, timestampMs);
+    layout.type = 0;
+    layout.columns = (int)names.size() - 2;
+    if (names.size() < 3 || layout.columns > 32 || (!layout.timestampHeader && names[0] != "date" && names[0] != "Date"))
+    {
+        return false;
+    }
+    layout.variant = layout.timestampHeader ? "timestamp header" : "date, time header";
+    for (int type = ERPA_FRAME; type <= HK_FRAME && layout.type == 0; type++)
+    {
+        int matched = 0;
+        string aliases;
+        for (int column = 0; column < layout.columns; column++)
+        {
+            string name = names[column + 2];
+            for (int alias = 0; alias < 2; alias++)
+            {
+                if (name == fieldAliases[alias][0])
+                {
+                    aliases += string(", ") + name;
+                    name = fieldAliases[alias][1];
+                }
+            }
+            layout.field[column] = frameFieldIndex(type, name);
+            matched += layout.field[column] >= 0;
+        }
+        if (matched == frameFieldCounts[type] && layout.columns == frameFieldCounts[type])
+        {
+            layout.type = type;
+            layout.variant += aliases;
+        }
+    }
+    return layout.type != 0;
+}
+
+// ------------------------ Row Parsing ------------------------
+// Parses every row after the header into frames. Empty or unreadable values
+// are NaN; rows without a timestamp are rejected. rows counts all non-empty
+// lines after the header.
+void parseCsvFrames(const char *data, size_t size, const CsvLayout &layout, vector<Frame> &frames,
+                    size_t &rows, size_t &rejected)
+{
+    const char *end = data + size;
+    const char *newline = (const char *)memchr(data, '\n', size);
+    const char *row = newline == nullptr ? end : newline + 1;
+    while (row < end)
+    {
+        newline = (const char *)memchr(row, '\n', end - row);
+        const char *rowEnd = newline == nullptr ? end : newline;
+        if (rowEnd - row > 1 || (rowEnd - row == 1 && *row != '\r'))
+        {
+            rows++;
+            Frame frame = {};
+            if (!parseLogTimestamp(row, rowEnd - row, frame.timestampMs))
+            {
+                rejected++;
+                row = rowEnd + 1;
+                continue;
+            }
+            frame.type = layout.type;
+            frame.count = frameFieldCounts[layout.type];
+            for (int i = 0; i < frame.count; i++)
+            {
+                frame.values[i] = NAN;
+            }
+            const char *field = (const char *)memchr(row + 11, ',', rowEnd - row - 11); // Past the date's comma
+            for (int column = 0; field != nullptr && column < layout.columns; column++)
+            {
+                field++;
+                double value;
+                if (layout.field[column] >= 0 && parseFastDouble(field, rowEnd, value) != nullptr)
+                {
+                    frame.values[layout.field[column]] = value;
+                }
+                field = (const char *)memchr(field, ',', rowEnd - field);
+            }
+            frames.push_back(frame);
+        }
+        row = rowEnd + 1;
+    }
+}
+
+#endif
@@ -0,0 +1,136 @@
+// ----------------------- Session Files ------------------------
+// A whole session, ERPA, PMT and HK, in one binary "<session>.ses" file as
+// written by tools/importLogs.cpp. The frames are in time order and in the wire
+// encoding of frames/frame.cpp (values as float32), so loading a session is an
+// mmap and a copy instead of parsing text.
+//
+// Layout (little endian):
+//   header  uint32 magic SESSION_MAGIC, uint32 version, uint32 frames[3] (ERPA, PMT, HK),
+//           uint32 reserved, int64 first timestampMs, int64 last timestampMs
+//   frames  encodeFrame() records back to back, frames[0] + frames[1] + frames[2] of them
+#ifndef SESSIONS_SESSION_FILE_CPP
+#define SESSIONS_SESSION_FILE_CPP
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "../frames/frame.cpp"
+
+using namespace std;
+
+#define SESSION_MAGIC 0x31534553 // "SES1"
+#define SESSION_VERSION 1
+
+struct SessionHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t frames[3];
+    uint32_t reserved;
+    int64_t firstMs;
+    int64_t lastMs;
+};
+
+// frames must already be in time order. Written to path.tmp and renamed, so a
+// reader never sees half a session.
+bool writeSessionFile(const string &path, const vector<Frame> &frames)
+{
+    SessionHeader header = {SESSION_MAGIC, SESSION_VERSION, {0, 0, 0}, 0, 0, 0};
+    for (size_t i = 0; i < frames.size(); i++)
+    {
+        header.frames[frames[i].type - ERPA_FRAME]++;
+    }
+    if (!frames.empty())
+    {
+        header.firstMs = frames.front().timestampMs;
+        header.lastMs = frames.back().timestampMs;
+    }
+    string temporary = path + ".tmp";
+    FILE *out = fopen(temporary.c_str(), "wb");
+    if (out == nullptr)
+    {
+        return false;
+    }
+    static const size_t chunk = 256 * 1024;
+    vector<unsigned char> buffer(chunk + MAX_FRAME_WIRE_SIZE);
+    size_t used = 0;
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1;
+    for (size_t i = 0; ok && i < frames.size(); i++)
+    {
+        used += encodeFrame(frames[i], &buffer[used]);
+        if (used >= chunk || i + 1 == frames.size())
+        {
+            ok = fwrite(&buffer[0], 1, used, out) == used;
+            used = 0;
+        }
+    }
+    ok = fclose(out) == 0 && ok;
+    if (!ok || rename(temporary.c_str(), path.c_str()) != 0)
+    {
+        remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Appends the frames of a session to frames. False if the file is not a
+// session, or if its frames do not add up to the counts in its header.
+bool loadSessionFile(const string &path, vector<Frame> &frames, SessionHeader *headerOut = nullptr)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    struct stat info;
+    if (fd == -1 || fstat(fd, &info) == -1 || (size_t)info.st_size < sizeof(SessionHeader))
+    {
+        if (fd != -1)
+        {
+            close(fd);
+        }
+        return false;
+    }
+    void *memory = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED)
+    {
+        return false;
+    }
+    madvise(memory, info.st_size, MADV_SEQUENTIAL);
+    const unsigned char *data = (const unsigned char *)memory;
+    size_t size = info.st_size;
+    SessionHeader header;
+    memcpy(&header, data, sizeof(header));
+    bool ok = header.magic == SESSION_MAGIC && header.version == SESSION_VERSION;
+    uint32_t counts[3] = {0, 0, 0};
+    size_t offset = sizeof(header);
+    size_t needed = frames.size() + (size_t)header.frames[0] + header.frames[1] + header.frames[2];
+    if (ok && needed > frames.capacity())
+    {
+        frames.reserve(max(needed, 2 * frames.capacity())); // Loading many sessions into one vector stays linear
+    }
+    while (ok && offset < size)
+    {
+        long frameSize = encodedFrameSize(data + offset, size - offset);
+        if (frameSize <= 0)
+        {
+            ok = false;
+            break;
+        }
+        Frame frame;
+        decodeFrame(data + offset, frame);
+        frames.push_back(frame);
+        counts[frame.type - ERPA_FRAME]++;
+        offset += frameSize;
+    }
+    munmap(memory, size);
+    ok = ok && counts[0] == header.frames[0] && counts[1] == header.frames[1] && counts[2] == header.frames[2];
+    if (headerOut != nullptr)
+    {
+        *headerOut = header;
+    }
+    return ok;
+}
+
+#endif
@@ -0,0 +1,245 @@
+// ---------------- Shared Memory Frame Ring --------------------
+// Publishes decoded frames into a named POSIX shared memory ring so analysis
+// tools on the same machine can follow the live stream without going through
+// the CSVs in logs/. There is one writer (the acquisition loop) and any number
+// of readers; nobody ever waits on anybody.
+//
+// Layout (native endianness, see shm/frame_ring.py for a Python reader):
+//   FrameRingHeader                       64 bytes
+//   FrameRingSlot[capacity]               sizeof(FrameRingSlot) each
+// Frame number n lives in slot n % capacity. Each slot is a seqlock: its
+// sequence is 2n+1 while frame n is being written and 2n+2 once it is complete,
+// so a reader knows both that the copy is consistent and which frame it got.
+#ifndef SHM_FRAME_RING_CPP
+#define SHM_FRAME_RING_CPP
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstring>
+#include <atomic>
+#include <algorithm>
+#include <string>
+#include "../frames/frame.cpp"
+
+using namespace std;
+
+#define FRAME_RING_MAGIC 0x474E5246 // "FRNG"
+#define FRAME_RING_VERSION 1
+const uint32_t defaultFrameRingCapacity = 4096; // Slots, must be a power of two
+
+struct FrameRingHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t capacity;
+    uint32_t slotSize;
+    std::atomic<uint64_t> published; // Frames written so far, i.e. the next frame number
+    char padding[40];
+};
+
+struct FrameRingSlot
+{
+    std::atomic<uint64_t> sequence;
+    Frame frame;
+};
+
+struct FrameRing
+{
+    FrameRingHeader *header;
+    FrameRingSlot *slots;
+    size_t mappedBytes;
+    string name;
+};
+
+struct FrameRingReader
+{
+    FrameRing ring;
+    uint64_t next;               // Next frame number to hand out
+    unsigned long long skipped;  // Frames overwritten before this reader got to them
+};
+
+size_t frameRingBytes(uint32_t capacity)
+{
+    return sizeof(FrameRingHeader) + capacity * sizeof(FrameRingSlot);
+}
+
+// -------------------------- Writer ---------------------------
+FrameRing publishRing = {nullptr, nullptr, 0, ""};
+
+// name must start with '/', e.g. "/instrumentGUI"
+bool createFrameRing(const string &name, uint32_t capacity)
+{
+    if (capacity == 0 || (capacity & (capacity - 1)) != 0)
+    {
+        fprintf(stderr, "Frame ring capacity must be a power of two.\n");
+        return false;
+    }
+    int fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0644);
+    size_t bytes = frameRingBytes(capacity);
+    if (fd == -1 || ftruncate(fd, 0) == -1 || ftruncate(fd, bytes) == -1)
+    {
+        perror("Frame ring: shm_open");
+        if (fd != -1)
+        {
+            close(fd);
+        }
+        return false;
+    }
+    void *memory = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED)
+    {
+        perror("Frame ring: mmap");
+        return false;
+    }
+    publishRing.header = (FrameRingHeader *)memory;
+    publishRing.slots = (FrameRingSlot *)((char *)memory + sizeof(FrameRingHeader));
+    publishRing.mappedBytes = bytes;
+    publishRing.name = name;
+    // ftruncate zero-filled the mapping, so every slot starts at sequence 0 (never written)
+    publishRing.header->capacity = capacity;
+    publishRing.header->slotSize = sizeof(FrameRingSlot);
+    publishRing.header->version = FRAME_RING_VERSION;
+    publishRing.header->published.store(0, memory_order_relaxed);
+    std::atomic_thread_fence(memory_order_release);
+    publishRing.header->magic = FRAME_RING_MAGIC; // Written last so readers never see a half set up ring
+    return true;
+}
+
+void publishFrameRing(const Frame &frame)
+{
+    FrameRingHeader *header = publishRing.header;
+    if (header == nullptr)
+    {
+        return;
+    }
+    uint64_t number = header->published.load(memory_order_relaxed);
+    FrameRingSlot &slot = publishRing.slots[number & (header->capacity - 1)];
+    slot.sequence.store(2 * number + 1, memory_order_relaxed);
+    std::atomic_thread_fence(memory_order_release);
+    memcpy(&slot.frame, &frame, sizeof(Frame));
+    slot.sequence.store(2 * number + 2, memory_order_release);
+    header->published.store(number + 1, memory_order_release);
+}
+
+void destroyFrameRing()
+{ // Readers that are attached keep their mapping; new ones can no longer attach
+    if (publishRing.header == nullptr)
+    {
+        return;
+    }
+    munmap(publishRing.header, publishRing.mappedBytes);
+    shm_unlink(publishRing.name.c_str());
+    publishRing.header = nullptr;
+}
+
+// -------------------------- Readers --------------------------
+bool attachFrameRing(const string &name, FrameRingReader &reader)
+{
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd == -1)
+    {
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) == -1 || (size_t)info.st_size < sizeof(FrameRingHeader))
+    {
+        close(fd);
+        return false;
+    }
+    void *memory = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED)
+    {
+        return false;
+    }
+    FrameRingHeader *header = (FrameRingHeader *)memory;
+    if (header->magic != FRAME_RING_MAGIC || header->version != FRAME_RING_VERSION ||
+        header->slotSize != sizeof(FrameRingSlot) || frameRingBytes(header->capacity) > (size_t)info.st_size)
+    {
+        munmap(memory, info.st_size);
+        return false;
+    }
+    reader.ring.header = header;
+    reader.ring.slots = (FrameRingSlot *)((char *)memory + sizeof(FrameRingHeader));
+    reader.ring.mappedBytes = info.st_size;
+    reader.ring.name = name;
+    reader.next = header->published.load(memory_order_acquire); // Start at the live edge
+    reader.skipped = 0;
+    return true;
+}
+
+void detachFrameRing(FrameRingReader &reader)
+{
+    if (reader.ring.header != nullptr)
+    {
+        munmap(reader.ring.header, reader.ring.mappedBytes);
+        reader.ring.header = nullptr;
+    }
+}
+
+// Copies frame number `number` out of the ring; false if it is not there (yet or any more)
+bool copyRingFrame(const FrameRing &ring, uint64_t number, Frame &out)
+{
+    const FrameRingSlot &slot = ring.slots[number & (ring.header->capacity - 1)];
+    uint64_t expected = 2 * number + 2;
+    if (slot.sequence.load(memory_order_acquire) != expected)
+    {
+        return false;
+    }
+    memcpy(&out, &slot.frame, sizeof(Frame));
+    std::atomic_thread_fence(memory_order_acquire);
+    return slot.sequence.load(memory_order_relaxed) == expected;
+}
+
+// Follows the live stream: returns up to max frames published since the last call
+int readFrameRing(FrameRingReader &reader, Frame *out, int max)
+{
+    const FrameRing &ring = reader.ring;
+    uint64_t published = ring.header->published.load(memory_order_acquire);
+    uint64_t capacity = ring.header->capacity;
+    if (published > reader.next + capacity)
+    {
+        // Fell more than a ring behind; keep a little slack so the writer does not lap us again at once
+        uint64_t resume = published - capacity + capacity / 8;
+        reader.skipped += resume - reader.next;
+        reader.next = resume;
+    }
+    int count = 0;
+    while (count < max && reader.next < published)
+    {
+        if (copyRingFrame(ring, reader.next, out[count]))
+        {
+            count++;
+        }
+        else
+        {
+            reader.skipped++; // Overwritten while we were copying
+        }
+        reader.next++;
+    }
+    return count;
+}
+
+// Returns up to n of the most recent frames, oldest first, without moving the reader
+int latestFrameRing(const FrameRingReader &reader, Frame *out, int n)
+{
+    const FrameRing &ring = reader.ring;
+    uint64_t published = ring.header->published.load(memory_order_acquire);
+    uint64_t available = min<uint64_t>(published, ring.header->capacity);
+    uint64_t first = published - min<uint64_t>(available, n);
+    int count = 0;
+    for (uint64_t number = first; number < published; number++)
+    {
+        if (copyRingFrame(ring, number, out[count]))
+        {
+            count++;
+        }
+    }
+    return count;
+}
+
+#endif
@@ -0,0 +1,73 @@
+import struct
+import time
+from multiprocessing import resource_tracker, shared_memory
+
+#Python reader for the shared memory frame ring written by instrumentGUI --shm
+#(layout documented in shm/frameRing.cpp). Example:
+#   ring = FrameRing("/instrumentGUI")
+#   for frame in ring.latest(100): print(frame)
+#   while True: for frame in ring.follow(): ...
+
+HEADER = struct.Struct("=IIIIQ40x")
+SEQUENCE = struct.Struct("=Q")
+FRAME = struct.Struct("=BBHIq19d")
+MAGIC = 0x474E5246
+VERSION = 1
+TYPES = {1: "ERPA", 2: "PMT", 3: "HK"}
+
+class FrameRing:
+    def __init__(self, name):
+        #SharedMemory wants the name without the leading slash
+        self.shm = shared_memory.SharedMemory(name=name.lstrip("/"))
+        #otherwise Python unlinks the ring when this reader exits
+        resource_tracker.unregister(self.shm._name, "shared_memory")
+        magic, version, self.capacity, self.slot_size, published = HEADER.unpack_from(self.shm.buf, 0)
+        if magic != MAGIC or version != VERSION or self.slot_size != SEQUENCE.size + FRAME.size:
+            raise ValueError("not a version %d frame ring" % VERSION)
+        self.next = published
+        self.skipped = 0
+
+    def published(self):
+        return HEADER.unpack_from(self.shm.buf, 0)[4]
+
+    def read(self, number):
+        #seqlock read of frame `number`; None if it is not in the ring
+        offset = HEADER.size + (number % self.capacity) * self.slot_size
+        expected = 2 * number + 2
+        if SEQUENCE.unpack_from(self.shm.buf, offset)[0] != expected:
+            return None
+        fields = FRAME.unpack_from(self.shm.buf, offset + SEQUENCE.size)
+        if SEQUENCE.unpack_from(self.shm.buf, offset)[0] != expected:
+            return None
+        frame_type, count, _, _, timestamp_ms = fields[:5]
+        return (TYPES.get(frame_type, "?"), timestamp_ms, list(fields[5:5 + count]))
+
+    def latest(self, n):
+        published = self.published()
+        first = published - min(n, published, self.capacity)
+        frames = [self.read(number) for number in range(first, published)]
+        return [frame for frame in frames if frame is not None]
+
+    def follow(self, poll_interval=0.0002):
+        #yields every new frame as (type, timestamp_ms, values)
+        while True:
+            published = self.published()
+            if published > self.next + self.capacity:
+                resume = published - self.capacity + self.capacity // 8
+                self.skipped += resume - self.next
+                self.next = resume
+            if self.next == published:
+                time.sleep(poll_interval)
+                continue
+            frame = self.read(self.next)
+            if frame is None:
+                self.skipped += 1
+            else:
+                yield frame
+            self.next += 1
+
+if __name__ == "__main__":
+    import sys
+    ring = FrameRing(sys.argv[1] if len(sys.argv) > 1 else "/instrumentGUI")
+    for frame in ring.follow():
+        print(frame)
@@ -0,0 +1,438 @@
+// ------------------- Telemetry Fan-Out Server ------------------
+// Publishes every decoded frame to any number of local viewers over TCP and/or
+// a Unix-domain socket, using the wire encoding from frames/frame.cpp.
+//
+// publishTelemetryFrame() is called from the acquisition loop and never blocks:
+// it copies the encoded frame into each client's bounded queue and drops the
+// frame for any client whose queue is full. A separate thread drains the queues
+// with non-blocking sends, so one stuck viewer can only lose its own frames.
+// Clients that stay full for too long are disconnected.
+//
+// Viewers may send single-byte commands back, see readFromClient().
+#ifndef TELEMETRY_SERVER_CPP
+#define TELEMETRY_SERVER_CPP
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <cerrno>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <algorithm>
+#include "../frames/frame.cpp"
+
+using namespace std;
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0 // macOS: SO_NOSIGPIPE is set on each socket instead
+#endif
+
+const size_t telemetryQueueBytes = 256 * 1024; // Per client, roughly 10 s of full-rate frames
+const int telemetryStallLimitMs = 5000;        // Disconnect clients that stay full this long
+const int maxTelemetryClients = 64;
+
+struct TelemetryClient
+{
+    mutex lock; // Guards the queue; publishers and the sender only ever contend per client
+    int fd;
+    vector<unsigned char> queue; // Ring buffer of whole encoded frames
+    size_t head;
+    size_t size;
+    unsigned long long queuedFrames;
+    unsigned long long droppedFrames;
+    int64_t fullSinceMs; // 0 while the queue has room
+    bool closing;
+    bool warnedCommands;
+};
+
+mutex telemetryMutex; // Guards the client list; only the server thread adds or removes clients
+vector<TelemetryClient *> telemetryClients;
+vector<int> telemetryListeners;
+string telemetrySocketPath;
+int telemetryWakePipe[2] = {-1, -1};
+std::atomic<bool> telemetryRunning(false);
+std::thread telemetryThread;
+void (*telemetryCommandHandler)(unsigned char) = nullptr; // Set to accept commands from viewers
+
+// ------------------- Socket Helpers --------------------------
+void setNonBlocking(int fd)
+{
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+#ifdef SO_NOSIGPIPE
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+}
+
+int listenTcp(const string &address)
+{ // address is "port" or "host:port"; host defaults to 127.0.0.1
+    string host = "127.0.0.1";
+    string port = address;
+    size_t colon = address.rfind(':');
+    if (colon != string::npos)
+    {
+        host = address.substr(0, colon);
+        port = address.substr(colon + 1);
+    }
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)atoi(port.c_str()));
+    if (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1)
+    {
+        cerr << "Telemetry server: bad address " << address << endl;
+        return -1;
+    }
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    if (fd != -1)
+    {
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    }
+    if (fd == -1 || ::bind(fd, (sockaddr *)&addr, sizeof(addr)) == -1 || listen(fd, 16) == -1)
+    {
+        perror("Telemetry server: TCP listen");
+        if (fd != -1)
+        {
+            close(fd);
+        }
+        return -1;
+    }
+    setNonBlocking(fd);
+    return fd;
+}
+
+int listenUnix(const string &path)
+{
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path))
+    {
+        cerr << "Telemetry server: socket path too long " << path << endl;
+        return -1;
+    }
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    unlink(path.c_str()); // Left behind if the previous run crashed
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1 || ::bind(fd, (sockaddr *)&addr, sizeof(addr)) == -1 || listen(fd, 16) == -1)
+    {
+        perror("Telemetry server: Unix socket listen");
+        if (fd != -1)
+        {
+            close(fd);
+        }
+        return -1;
+    }
+    setNonBlocking(fd);
+    return fd;
+}
+
+// ----------------- Client Queue Handling ---------------------
+bool enqueueForClient(TelemetryClient *client, const unsigned char *data, size_t length, int64_t nowMs)
+{ // Whole frames only, so a dropped frame never leaves a torn message behind
+    size_t capacity = client->queue.size();
+    if (client->closing || capacity - client->size < length)
+    {
+        client->droppedFrames++;
+        if (client->fullSinceMs == 0)
+        {
+            client->fullSinceMs = nowMs;
+        }
+        return false;
+    }
+    client->fullSinceMs = 0;
+    size_t tail = (client->head + client->size) % capacity;
+    size_t first = min(length, capacity - tail);
+    memcpy(&client->queue[tail], data, first);
+    memcpy(&client->queue[0], data + first, length - first);
+    client->size += length;
+    return true;
+}
+
+void sendPending(TelemetryClient *client)
+{ // Called with client->lock held; never blocks
+    while (client->size > 0)
+    {
+        size_t capacity = client->queue.size();
+        size_t chunk = min(min(client->size, capacity - client->head), (size_t)16384); // Keeps each hold of the lock short
+        ssize_t sent = send(client->fd, &client->queue[client->head], chunk, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (sent <= 0)
+        {
+            if (sent == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            {
+                client->closing = true;
+            }
+            return;
+        }
+        client->head = (client->head + sent) % capacity;
+        client->size -= sent;
+    }
+}
+
+void acceptClients(int listener)
+{
+    while (true)
+    {
+        int fd = accept(listener, nullptr, nullptr);
+        if (fd == -1)
+        {
+            return;
+        }
+        lock_guard<mutex> lock(telemetryMutex);
+        if ((int)telemetryClients.size() >= maxTelemetryClients)
+        {
+            cerr << "Telemetry server: client limit reached, refusing connection." << endl;
+            close(fd);
+            continue;
+        }
+        setNonBlocking(fd);
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)); // Fails harmlessly on Unix sockets
+        TelemetryClient *client = new TelemetryClient();
+        client->fd = fd;
+        client->queue.resize(telemetryQueueBytes);
+        telemetryClients.push_back(client);
+    }
+}
+
+void dropClient(TelemetryClient *client)
+{ // Called from the server thread only, without any lock held
+    {
+        lock_guard<mutex> lock(telemetryMutex);
+        telemetryClients.erase(find(telemetryClients.begin(), telemetryClients.end(), client));
+    }
+    if (client->droppedFrames > 0)
+    {
+        cerr << "Telemetry server: client disconnected after " << client->queuedFrames << " frames, "
+             << client->droppedFrames << " dropped." << endl;
+    }
+    close(client->fd);
+    delete client;
+}
+
+// Incoming bytes from a client are single-byte instrument commands. They are
+// passed to telemetryCommandHandler, or ignored while it is unset.
+// Returns false once the client has gone away.
+bool readFromClient(TelemetryClient *client)
+{
+    unsigned char buffer[256];
+    while (true)
+    {
+        ssize_t bytesRead = recv(client->fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+        if (bytesRead == 0)
+        {
+            return false;
+        }
+        if (bytesRead < 0)
+        {
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+        }
+        for (ssize_t i = 0; i < bytesRead; i++)
+        {
+            if (telemetryCommandHandler != nullptr)
+            {
+                telemetryCommandHandler(buffer[i]);
+            }
+            else if (!client->warnedCommands)
+            {
+                cerr << "Telemetry server: ignoring commands from a viewer (start with --allow-remote-commands)." << endl;
+                client->warnedCommands = true;
+            }
+        }
+    }
+}
+
+// ------------------- Server Thread ---------------------------
+void runTelemetryServer()
+{
+    vector<pollfd> fds;
+    vector<TelemetryClient *> polled;
+    while (telemetryRunning)
+    {
+        fds.clear();
+        pollfd wake = {telemetryWakePipe[0], POLLIN, 0};
+        fds.push_back(wake);
+        for (size_t i = 0; i < telemetryListeners.size(); i++)
+        {
+            pollfd listener = {telemetryListeners[i], POLLIN, 0};
+            fds.push_back(listener);
+        }
+        size_t firstClient = fds.size();
+        {
+            // Clients are only deleted by this thread, so the copy stays valid for the pass
+            lock_guard<mutex> lock(telemetryMutex);
+            polled = telemetryClients;
+        }
+        for (size_t i = 0; i < polled.size(); i++)
+        {
+            lock_guard<mutex> lock(polled[i]->lock);
+            pollfd client = {polled[i]->fd, (short)(polled[i]->size > 0 ? POLLIN | POLLOUT : POLLIN), 0};
+            fds.push_back(client);
+        }
+
+        if (poll(&fds[0], fds.size(), 500) < 0 && errno != EINTR)
+        {
+            perror("Telemetry server: poll");
+            return;
+        }
+
+        if (fds[0].revents & POLLIN)
+        {
+            char drain[64];
+            while (read(telemetryWakePipe[0], drain, sizeof(drain)) > 0)
+            {
+            }
+        }
+        for (size_t i = 1; i < firstClient; i++)
+        {
+            if (fds[i].revents & POLLIN)
+            {
+                acceptClients(fds[i].fd);
+            }
+        }
+
+        int64_t nowMs = currentTimeMs();
+        for (size_t i = 0; i < polled.size(); i++)
+        {
+            TelemetryClient *client = polled[i];
+            short revents = fds[firstClient + i].revents;
+            bool closing;
+            {
+                lock_guard<mutex> lock(client->lock);
+                if ((revents & (POLLERR | POLLHUP | POLLNVAL)) || ((revents & POLLIN) && !readFromClient(client)))
+                {
+                    client->closing = true;
+                }
+                if (!client->closing)
+                {
+                    sendPending(client);
+                }
+                if (client->fullSinceMs != 0 && nowMs - client->fullSinceMs > telemetryStallLimitMs)
+                {
+                    cerr << "Telemetry server: disconnecting stalled client." << endl;
+                    client->closing = true;
+                }
+                closing = client->closing;
+            }
+            if (closing)
+            {
+                dropClient(client);
+            }
+        }
+    }
+}
+
+// ---------------------- Public Interface ---------------------
+void stopTelemetryServer();
+
+// tcpAddress is "port" or "host:port" (empty to skip), unixPath a socket path (empty to skip)
+bool startTelemetryServer(const string &tcpAddress, const string &unixPath)
+{
+    if (!tcpAddress.empty())
+    {
+        int fd = listenTcp(tcpAddress);
+        if (fd == -1)
+        {
+            return false;
+        }
+        telemetryListeners.push_back(fd);
+    }
+    if (!unixPath.empty())
+    {
+        int fd = listenUnix(unixPath);
+        if (fd == -1)
+        {
+            return false;
+        }
+        telemetryListeners.push_back(fd);
+        telemetrySocketPath = unixPath;
+    }
+    if (telemetryListeners.empty() || pipe(telemetryWakePipe) == -1)
+    {
+        return false;
+    }
+    fcntl(telemetryWakePipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(telemetryWakePipe[1], F_SETFL, O_NONBLOCK);
+    signal(SIGPIPE, SIG_IGN);
+    telemetryRunning = true;
+    telemetryThread = std::thread(runTelemetryServer);
+    atexit(stopTelemetryServer); // exit() with the thread still joinable would abort
+    return true;
+}
+
+void publishTelemetryFrame(const Frame &frame)
+{
+    if (!telemetryRunning)
+    {
+        return;
+    }
+    unsigned char encoded[MAX_FRAME_WIRE_SIZE];
+    size_t length = encodeFrame(frame, encoded);
+    int64_t nowMs = currentTimeMs(); // The stall limit is wall time; replayed frames carry their recorded times
+    bool queued = false;
+    {
+        lock_guard<mutex> lock(telemetryMutex);
+        for (size_t i = 0; i < telemetryClients.size(); i++)
+        {
+            TelemetryClient *client = telemetryClients[i];
+            lock_guard<mutex> clientLock(client->lock);
+            if (enqueueForClient(client, encoded, length, nowMs))
+            {
+                client->queuedFrames++;
+                queued = true;
+            }
+        }
+    }
+    if (queued)
+    {
+        char wake = 1;
+        ssize_t ignored = write(telemetryWakePipe[1], &wake, 1); // Full pipe already means a wake-up is pending
+        (void)ignored;
+    }
+}
+
+int telemetryClientCount()
+{
+    lock_guard<mutex> lock(telemetryMutex);
+    return telemetryClients.size();
+}
+
+void stopTelemetryServer()
+{
+    if (!telemetryRunning)
+    {
+        return;
+    }
+    telemetryRunning = false;
+    char wake = 1;
+    ssize_t ignored = write(telemetryWakePipe[1], &wake, 1);
+    (void)ignored;
+    telemetryThread.join();
+    while (!telemetryClients.empty())
+    {
+        dropClient(telemetryClients.back());
+    }
+    for (size_t i = 0; i < telemetryListeners.size(); i++)
+    {
+        close(telemetryListeners[i]);
+    }
+    telemetryListeners.clear();
+    if (!telemetrySocketPath.empty())
+    {
+        unlink(telemetrySocketPath.c_str());
+    }
+    close(telemetryWakePipe[0]);
+    close(telemetryWakePipe[1]);
+}
+
+#endif
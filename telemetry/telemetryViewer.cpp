@@ -0,0 +1,178 @@
+// --------------------- Telemetry Viewer ---------------------
+// Client side of telemetry/telemetryServer.cpp. Lets instrumentGUI run as a
+// pure viewer: frames arrive on a socket instead of the serial port and are
+// turned back into interpreter style strings for the usual panel code.
+// Frames are decoded in place in the receive buffer through FrameView.
+// Command bytes written to the socket are forwarded to the instrument by the
+// server if it was started with --allow-remote-commands. On quit the socket is
+// shut down, which wakes the reader thread, and the thread is joined.
+#ifndef TELEMETRY_VIEWER_CPP
+#define TELEMETRY_VIEWER_CPP
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <cerrno>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include "../frames/frame.cpp"
+
+using namespace std;
+
+mutex viewerMutex;
+vector<string> viewerStrings; // Pending panel updates, taken by the main loop
+std::atomic<bool> viewerConnected(false);
+std::atomic<bool> viewerStopping(false);
+std::thread viewerThread;
+int viewerSocket = -1;
+
+// address is "host:port" for TCP, anything containing '/' is a Unix socket path
+int connectTelemetry(const string &address)
+{
+    int fd = -1;
+    if (address.find('/') != string::npos)
+    {
+        sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, address.c_str(), sizeof(addr.sun_path) - 1);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd != -1 && connect(fd, (sockaddr *)&addr, sizeof(addr)) == -1)
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+    else
+    {
+        size_t colon = address.rfind(':');
+        string host = colon == string::npos ? "127.0.0.1" : address.substr(0, colon);
+        string port = colon == string::npos ? address : address.substr(colon + 1);
+        addrinfo hints = {};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo *results = nullptr;
+        if (getaddrinfo(host.c_str(), port.c_str(), &hints, &results) != 0)
+        {
+            return -1;
+        }
+        for (addrinfo *ai = results; ai != nullptr && fd == -1; ai = ai->ai_next)
+        {
+            fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+            if (fd != -1 && connect(fd, ai->ai_addr, ai->ai_addrlen) == -1)
+            {
+                close(fd);
+                fd = -1;
+            }
+        }
+        freeaddrinfo(results);
+    }
+#ifdef SO_NOSIGPIPE
+    if (fd != -1)
+    {
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+    }
+#endif
+    return fd;
+}
+
+// ------------- Decode Frames In The Receive Buffer ------------
+// Returns the number of bytes consumed; a trailing partial frame is left for the next read
+size_t consumeFrames(const unsigned char *data, size_t length, vector<string> &strings)
+{
+    size_t offset = 0;
+    while (offset < length)
+    {
+        long size = encodedFrameSize(data + offset, length - offset);
+        if (size == 0)
+        {
+            break;
+        }
+        if (size < 0)
+        {
+            offset++; // Not at a frame boundary, resynchronise on the next magic byte
+            continue;
+        }
+        FrameView view = {data + offset};
+        for (int column = 0; column < view.count(); column++)
+        {
+            strings.push_back(interpreterString(view.type(), column, view.value(column)));
+        }
+        offset += size;
+    }
+    return offset;
+}
+
+void readTelemetry(int fd)
+{
+    vector<unsigned char> buffer(64 * 1024);
+    size_t filled = 0;
+    vector<string> strings;
+    while (viewerConnected)
+    {
+        ssize_t bytesRead = recv(fd, &buffer[filled], buffer.size() - filled, 0);
+        if (bytesRead <= 0)
+        {
+            if (bytesRead == -1 && errno == EINTR)
+            {
+                continue;
+            }
+            if (viewerStopping)
+            {
+                break; // Shut down by stopTelemetryViewer()
+            }
+            std::cerr << "Telemetry connection lost." << std::endl;
+            viewerConnected = false;
+            break;
+        }
+        filled += bytesRead;
+        size_t consumed = consumeFrames(&buffer[0], filled, strings);
+        if (consumed > 0)
+        {
+            memmove(&buffer[0], &buffer[consumed], filled - consumed); // At most one partial frame
+            filled -= consumed;
+        }
+        if (!strings.empty())
+        {
+            lock_guard<mutex> lock(viewerMutex);
+            viewerStrings.insert(viewerStrings.end(), strings.begin(), strings.end());
+            strings.clear();
+        }
+    }
+}
+
+// ---------------------- Public Interface ---------------------
+void stopTelemetryViewer()
+{
+    if (!viewerThread.joinable())
+    {
+        return;
+    }
+    viewerStopping = true;
+    viewerConnected = false;
+    shutdown(viewerSocket, SHUT_RDWR); // recv() returns at once; the caller still owns the socket
+    viewerThread.join();
+}
+
+void startTelemetryViewer(int fd)
+{
+    viewerSocket = fd;
+    viewerConnected = true;
+    viewerThread = std::thread(readTelemetry, fd);
+    atexit(stopTelemetryViewer); // exit() with the thread still joinable would abort
+}
+
+vector<string> takeTelemetryStrings()
+{
+    vector<string> strings;
+    lock_guard<mutex> lock(viewerMutex);
+    strings.swap(viewerStrings);
+    return strings;
+}
+
+#endif
@@ -0,0 +1,172 @@
+// ------------------------- controlsAt -------------------------
+// Rebuilds the state of all 13 controls from Controls logs: the .jsonl
+// journals (commands/controlJournal.cpp) and the older 13-column .csv logs,
+// plain or .csv.gz.
+//
+//   build/controlsAt "logs/Controls/Controls2024-03-28 12-51-37.jsonl"
+//   build/controlsAt --at 14:32:05 --at 14:40:00.500 "logs/Controls/Controls2024-03-28 12-51-37.jsonl"
+//   build/controlsAt --at "03-05-2024 14:15:30" "logs/Controls/Controls2024-03-05 14-15-17.csv"
+//
+// Without --at, prints the full state after every change, with the change. With
+// --at, prints the state in force at each of those times. A time without a
+// date is on the date of the first entry. Several logs are read in the order
+// given as one timeline; each session starts from its recorded state, see
+// logging/controlsLog.cpp. Commands other than the switches, e.g. step_up, are
+// listed with the state unchanged.
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "../logging/controlsLog.cpp"
+
+using namespace std;
+
+const int controlCount = controlsLogSwitches;
+
+struct ControlsTimeline
+{
+    vector<int64_t> times;   // Ascending
+    vector<uint32_t> states; // State from times[i] on
+    vector<string> changes;  // What changed at times[i]
+};
+
+// "MM-DD-YYYY, HH:MM:SS:ms", as in the logs
+string formatTime(int64_t timestampMs)
+{
+    time_t seconds = timestampMs / 1000;
+    struct tm tm;
+    localtime_r(&seconds, &tm);
+    char text[40];
+    size_t length = strftime(text, sizeof(text), "%m-%d-%Y, %H:%M:%S:", &tm);
+    snprintf(text + length, sizeof(text) - length, "%d", (int)(timestampMs % 1000));
+    return text;
+}
+
+void addState(ControlsTimeline &timeline, int64_t timestampMs, uint32_t state, const string &change)
+{
+    timeline.times.push_back(timestampMs);
+    timeline.states.push_back(state);
+    timeline.changes.push_back(change);
+}
+
+uint32_t currentState(const ControlsTimeline &timeline)
+{
+    return timeline.states.empty() ? 0 : timeline.states.back();
+}
+
+void addEvent(ControlsTimeline &timeline, const ControlsLogEvent &event)
+{
+    if (event.name == -1)
+    {
+        addState(timeline, event.timestampMs, event.state, "start");
+        return;
+    }
+    uint32_t state = currentState(timeline);
+    string change = commandNames[event.name].name;
+    if (event.value != -1)
+    {
+        uint32_t bit = 1u << event.name;
+        state = event.value ? state | bit : state & ~bit;
+        change += event.value ? " on" : " off";
+    }
+    char command[16];
+    snprintf(command, sizeof(command), event.count > 1 ? " 0x%02X x%d" : " 0x%02X", event.command, event.count);
+    addState(timeline, event.timestampMs, state, change + command);
+}
+
+void printRow(int64_t timestampMs, uint32_t state, const string *change)
+{
+    string row = formatTime(timestampMs);
+    for (int control = 0; control < controlCount; control++)
+    {
+        row += (state >> control) & 1 ? ", 1" : ", 0";
+    }
+    if (change != nullptr)
+    {
+        row += ", " + *change;
+    }
+    puts(row.c_str());
+}
+
+int main(int argc, char **argv)
+{
+    vector<string> atTimes;
+    vector<const char *> paths;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--at") == 0 && i + 1 < argc)
+        {
+            atTimes.push_back(argv[++i]);
+        }
+        else
+        {
+            paths.push_back(argv[i]);
+        }
+    }
+    if (paths.empty())
+    {
+        fprintf(stderr, "Usage: %s [--at TIME]... CONTROLS_LOG...\n", argv[0]);
+        return 1;
+    }
+
+    vector<ControlsLogEvent> events;
+    for (size_t i = 0; i < paths.size(); i++)
+    {
+        if (!readControlsLog(paths[i], events))
+        {
+            return 1;
+        }
+    }
+    ControlsTimeline timeline;
+    for (size_t i = 0; i < events.size(); i++)
+    {
+        addEvent(timeline, events[i]);
+    }
+    if (timeline.times.empty())
+    {
+        fprintf(stderr, "No control changes in the logs.\n");
+        return 1;
+    }
+    if (!is_sorted(timeline.times.begin(), timeline.times.end()))
+    {
+        fprintf(stderr, "Warning: the logs go back in time, give them in order.\n");
+    }
+
+    string header = "date, time";
+    for (int control = 0; control < controlCount; control++)
+    {
+        header += string(", ") + commandNames[control].name;
+    }
+    puts((header + (atTimes.empty() ? ", change" : "")).c_str());
+
+    if (atTimes.empty())
+    {
+        for (size_t i = 0; i < timeline.times.size(); i++)
+        {
+            printRow(timeline.times[i], timeline.states[i], &timeline.changes[i]);
+        }
+        return 0;
+    }
+    string dateRow = formatTime(timeline.times[0]);
+    for (size_t i = 0; i < atTimes.size(); i++)
+    {
+        int64_t atMs;
+        if (!parseTimeArgument(atTimes[i], dateRow.c_str(), atMs))
+        {
+            fprintf(stderr, "Times are HH:MM:SS[.mmm] or \"MM-DD-YYYY HH:MM:SS[.mmm]\", not \"%s\".\n", atTimes[i].c_str());
+            return 1;
+        }
+        // The last change at or before atMs
+        size_t after = upper_bound(timeline.times.begin(), timeline.times.end(), atMs) - timeline.times.begin();
+        if (after == 0)
+        {
+            fprintf(stderr, "%s is before the first entry, %s.\n", atTimes[i].c_str(), dateRow.c_str());
+            continue;
+        }
+        printRow(atMs, timeline.states[after - 1], nullptr);
+    }
+    return 0;
+}
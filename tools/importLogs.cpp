@@ -0,0 +1,319 @@
+// ------------------------ importLogs --------------------------
+// Converts the CSV logs under logs/ into binary session files (see
+// sessions/sessionFile.cpp), one "<session>.ses" per session holding its ERPA,
+// PMT and HK frames in time order.
+//
+//   build/importLogs [--threads N] [--out DIR] [--force] [logs]
+//
+// Every header variant is understood (sessions/legacyCsv.cpp), including the
+// Archive logs without a .csv extension. Files are grouped into sessions by
+// name ("ERPA11-28-2023 10-44-08", "HK 2024-03-28 12-51-37.csv", rotated parts)
+// and sessions are converted by a pool of threads. Each .ses is read back and
+// its frame counts checked against the number of rows in the CSVs. Sessions
+// whose .ses is newer than all of their CSVs are skipped unless --force.
+// Output goes to <logs>/Sessions unless --out is given.
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <map>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <algorithm>
+#include "../sessions/legacyCsv.cpp"
+#include "../sessions/sessionFile.cpp"
+
+using namespace std;
+
+struct ImportSession
+{
+    string name;
+    vector<string> paths;
+    long long newestMtime;
+};
+
+struct ImportResult
+{
+    size_t rows;     // Non-empty lines after the header, over all files
+    size_t rejected; // Rows without a timestamp
+    size_t frames[3];
+    bool ok;
+};
+
+std::mutex reportMutex;
+
+bool hasSuffix(const string &text, const char *suffix)
+{
+    size_t length = strlen(suffix);
+    return text.size() >= length && text.compare(text.size() - length, length, suffix) == 0;
+}
+
+// "ERPA11-28-2023 10-44-08", "HK 2024-03-28 12-51-37 part 2.csv" -> the session name, or "" for other files
+string sessionName(string name)
+{
+    if (hasSuffix(name, ".csv"))
+    {
+        name.erase(name.size() - 4);
+    }
+    else if (name.find('.') != string::npos)
+    {
+        return ""; // .gz, .blk, .idx and anything else
+    }
+    const char *types[3] = {"ERPA", "PMT", "HK"};
+    bool typed = false;
+    for (int i = 0; i < 3 && !typed; i++)
+    {
+        size_t length = strlen(types[i]);
+        if (name.compare(0, length, types[i]) == 0)
+        {
+            name.erase(0, name[length] == ' ' ? length + 1 : length);
+            typed = true;
+        }
+    }
+    size_t part = name.find(" part ");
+    if (part != string::npos)
+    {
+        name.erase(part);
+    }
+    return typed ? name : "";
+}
+
+void findSessions(const string &directory, const string &outDirectory, map<string, ImportSession> &sessions)
+{
+    DIR *dir = opendir(directory.c_str());
+    if (dir == nullptr)
+    {
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != nullptr)
+    {
+        string name = entry->d_name;
+        string path = directory + "/" + name;
+        struct stat info;
+        if (name[0] == '.' || name == "Controls" || name == "Triggers" || path == outDirectory || stat(path.c_str(), &info) == -1)
+        {
+            continue;
+        }
+        if (S_ISDIR(info.st_mode))
+        {
+            findSessions(path, outDirectory, sessions);
+            continue;
+        }
+        string session = sessionName(name);
+        if (S_ISREG(info.st_mode) && !session.empty())
+        {
+            ImportSession &group = sessions[session];
+            group.name = session;
+            group.paths.push_back(path);
+            group.newestMtime = max(group.newestMtime, (long long)info.st_mtime);
+        }
+    }
+    closedir(dir);
+}
+
+// The Archive has some logs twice, with and without .csv
+bool sameContents(const string &a, const string &b)
+{
+    FILE *first = fopen(a.c_str(), "rb");
+    FILE *second = fopen(b.c_str(), "rb");
+    bool same = first != nullptr && second != nullptr;
+    char bufferA[64 * 1024], bufferB[64 * 1024];
+    while (same)
+    {
+        size_t lengthA = fread(bufferA, 1, sizeof(bufferA), first);
+        size_t lengthB = fread(bufferB, 1, sizeof(bufferB), second);
+        same = lengthA == lengthB && memcmp(bufferA, bufferB, lengthA) == 0;
+        if (lengthA == 0)
+        {
+            break;
+        }
+    }
+    if (first != nullptr)
+    {
+        fclose(first);
+    }
+    if (second != nullptr)
+    {
+        fclose(second);
+    }
+    return same;
+}
+
+// Appends the frames of one CSV; false if it cannot be read or is not a packet log
+bool importFile(const string &path, vector<Frame> &frames, ImportResult &result, string &variant)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    struct stat info;
+    if (fd == -1 || fstat(fd, &info) == -1 || info.st_size == 0)
+    {
+        if (fd != -1)
+        {
+            close(fd);
+        }
+        return false;
+    }
+    void *memory = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED)
+    {
+        return false;
+    }
+    const char *data = (const char *)memory;
+    size_t size = info.st_size;
+    madvise(memory, size, MADV_SEQUENTIAL);
+    const char *newline = (const char *)memchr(data, '\n', size);
+    size_t headerLength = newline == nullptr ? size : newline - data;
+    CsvLayout layout;
+    bool ok = detectCsvLayout(data, headerLength, layout);
+    if (ok)
+    {
+        variant = layout.variant;
+        parseCsvFrames(data, size, layout, frames, result.rows, result.rejected);
+    }
+    munmap(memory, size);
+    return ok;
+}
+
+void importSession(const ImportSession &session, const string &outDirectory, ImportResult &result)
+{
+    result = ImportResult();
+    vector<Frame> frames;
+    vector<string> notes;
+    vector<string> paths = session.paths;
+    sort(paths.begin(), paths.end()); // Rotated parts in order
+    for (size_t i = 0; i < paths.size(); i++)
+    {
+        string variant;
+        bool duplicate = false;
+        for (size_t j = 0; j < i && !duplicate; j++)
+        {
+            duplicate = sameContents(paths[i], paths[j]);
+        }
+        if (duplicate)
+        {
+            notes.push_back(paths[i] + " (skipped, a copy of another log)");
+        }
+        else if (importFile(paths[i], frames, result, variant))
+        {
+            notes.push_back(paths[i] + " (" + variant + ")");
+        }
+        else
+        {
+            notes.push_back(paths[i] + " (skipped, not an ERPA, PMT or HK log)");
+        }
+    }
+    stable_sort(frames.begin(), frames.end(), [](const Frame &a, const Frame &b)
+                { return a.timestampMs < b.timestampMs; });
+    string path = outDirectory + "/" + session.name + ".ses";
+    result.ok = writeSessionFile(path, frames);
+
+    // Read it back: every row that had a timestamp must be in the file, of the right type
+    vector<Frame> loaded;
+    SessionHeader header;
+    result.ok = result.ok && loadSessionFile(path, loaded, &header) && loaded.size() == result.rows - result.rejected;
+    for (size_t i = 0; i < frames.size(); i++)
+    {
+        result.frames[frames[i].type - ERPA_FRAME]++;
+    }
+    for (int type = 0; type < 3; type++)
+    {
+        result.ok = result.ok && header.frames[type] == result.frames[type];
+    }
+
+    std::lock_guard<std::mutex> lock(reportMutex);
+    printf("%s: ERPA %zu, PMT %zu, HK %zu frames from %zu rows, %zu rejected: %s\n", path.c_str(), result.frames[0],
+           result.frames[1], result.frames[2], result.rows, result.rejected, result.ok ? "OK" : "FAILED");
+    for (size_t i = 0; i < notes.size(); i++)
+    {
+        printf("    %s\n", notes[i].c_str());
+    }
+}
+
+int main(int argc, char **argv)
+{
+    string root = "logs";
+    string outDirectory;
+    int threads = max(1u, std::thread::hardware_concurrency());
+    bool force = false;
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if (arg == "--threads" && i + 1 < argc)
+        {
+            threads = max(1, atoi(argv[++i]));
+        }
+        else if (arg == "--out" && i + 1 < argc)
+        {
+            outDirectory = argv[++i];
+        }
+        else if (arg == "--force")
+        {
+            force = true;
+        }
+        else if (arg[0] == '-')
+        {
+            fprintf(stderr, "usage: %s [--threads N] [--out DIR] [--force] [logs]\n", argv[0]);
+            return 2;
+        }
+        else
+        {
+            root = arg;
+        }
+    }
+    if (outDirectory.empty())
+    {
+        outDirectory = root + "/Sessions";
+    }
+    mkdir(outDirectory.c_str(), 0755);
+    auto start = chrono::steady_clock::now();
+
+    map<string, ImportSession> found;
+    findSessions(root, outDirectory, found);
+    vector<ImportSession> sessions;
+    for (map<string, ImportSession>::iterator it = found.begin(); it != found.end(); ++it)
+    {
+        struct stat info;
+        string path = outDirectory + "/" + it->first + ".ses";
+        if (force || stat(path.c_str(), &info) == -1 || info.st_mtime < it->second.newestMtime)
+        {
+            sessions.push_back(it->second);
+        }
+    }
+
+    vector<ImportResult> results(sessions.size());
+    std::atomic<size_t> nextSession(0);
+    vector<std::thread> pool;
+    for (int t = 0; t < threads; t++)
+    {
+        pool.push_back(std::thread([&]
+                                   {
+            for (size_t i = nextSession++; i < sessions.size(); i = nextSession++)
+            {
+                importSession(sessions[i], outDirectory, results[i]);
+            } }));
+    }
+    for (size_t t = 0; t < pool.size(); t++)
+    {
+        pool[t].join();
+    }
+
+    size_t frames = 0, failed = 0;
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        frames += results[i].frames[0] + results[i].frames[1] + results[i].frames[2];
+        failed += !results[i].ok;
+    }
+    fprintf(stderr, "%zu sessions imported (%zu up to date), %zu frames, %zu failed, %.2f s, %d threads\n",
+            sessions.size(), found.size() - sessions.size(), frames, failed,
+            chrono::duration<double>(chrono::steady_clock::now() - start).count(), threads);
+    return failed == 0 ? 0 : 1;
+}
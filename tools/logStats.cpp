@@ -0,0 +1,546 @@
+// ------------------------- logStats ---------------------------
+// Per channel statistics (count, min, max, mean, stddev, percentiles) for every
+// ERPA, PMT and HK log under logs/, per file and overall per packet type.
+//
+//   build/logStats [--threads N] [--no-cache] [--summary] [logs]
+//
+// Reads .csv, .csv.gz and .csv.blk files, including the older Archive logs
+// whose header row starts with a timestamp; empty fields are not counted.
+// Files are processed by a pool of threads. Results are cached per file in
+// <root>/.logStats.cache keyed by size and modification time, so a rerun only
+// reads new or changed sessions. Overall percentiles are estimated by merging
+// the per file percentile sketches.
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <map>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include "../logging/logBlock.cpp"
+
+using namespace std;
+
+#define SKETCH_POINTS 101 // Percentiles 0, 1, ... 100
+
+struct ChannelStats
+{
+    string name;
+    unsigned long long count;
+    double min;
+    double max;
+    double mean;
+    double m2; // Sum of squared differences from the mean (Welford)
+    double sketch[SKETCH_POINTS];
+};
+
+struct FileStats
+{
+    string path;
+    long long size;
+    long long mtime;
+    string type; // ERPA, PMT or HK; empty if the file is not a packet log
+    unsigned long long rows;
+    vector<ChannelStats> channels;
+};
+
+const char *logTypes[3] = {"ERPA", "PMT", "HK"};
+const int logTypeFields[3] = {7, 3, 19};
+
+// ------------------------ Reading ----------------------------
+bool hasSuffix(const string &text, const char *suffix)
+{
+    size_t length = strlen(suffix);
+    return text.size() >= length && text.compare(text.size() - length, length, suffix) == 0;
+}
+
+// Whole file contents as text: .csv mapped, .csv.gz inflated, .csv.blk unframed
+bool loadLogText(const string &path, string &owned, const char *&data, size_t &size)
+{
+    if (hasSuffix(path, ".gz"))
+    {
+        gzFile gz = gzopen(path.c_str(), "rb");
+        if (gz == nullptr)
+        {
+            return false;
+        }
+        char buffer[256 * 1024];
+        int length;
+        while ((length = gzread(gz, buffer, sizeof(buffer))) > 0)
+        {
+            owned.append(buffer, length);
+        }
+        gzclose(gz); // A truncated live gzip still gives everything up to the last flush
+        data = owned.data();
+        size = owned.size();
+        return true;
+    }
+    int fd = open(path.c_str(), O_RDONLY);
+    struct stat info;
+    if (fd == -1 || fstat(fd, &info) == -1)
+    {
+        if (fd != -1)
+        {
+            close(fd);
+        }
+        return false;
+    }
+    size = info.st_size;
+    data = "";
+    if (size > 0)
+    {
+        void *memory = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (memory == MAP_FAILED)
+        {
+            close(fd);
+            return false;
+        }
+        data = (const char *)memory;
+    }
+    close(fd);
+    if (hasSuffix(path, ".blk"))
+    {
+        const unsigned char *blocks = (const unsigned char *)data;
+        size_t offset = 0;
+        uint64_t sequence;
+        size_t blockSize;
+        while ((blockSize = checkLogBlock(blocks + offset, size - offset, sequence)) > 0) // Stops at the first damage
+        {
+            owned.append(data + offset + LOG_BLOCK_HEADER, blockSize - LOG_BLOCK_HEADER);
+            offset += blockSize;
+        }
+        munmap((void *)data, size);
+        data = owned.data();
+        size = owned.size();
+    }
+    return true;
+}
+
+// Splits a header row into channel names, dropping "date, time" or the
+// timestamp older logs have in their place
+vector<string> headerChannels(const char *row, size_t length)
+{
+    vector<string> names;
+    string header(row, length);
+    size_t start = 0;
+    while (start < header.size())
+    {
+        size_t comma = header.find(',', start);
+        if (comma == string::npos)
+        {
+            comma = header.size();
+        }
+        string name = header.substr(start, comma - start);
+        name.erase(0, name.find_first_not_of(" \r\n"));
+        name.erase(name.find_last_not_of(" \r\n") + 1);
+        names.push_back(name);
+        start = comma + 1;
+    }
+    names.erase(names.begin(), names.begin() + min<size_t>(2, names.size()));
+    return names;
+}
+
+void finishSketch(ChannelStats &channel, vector<float> &values)
+{
+    sort(values.begin(), values.end());
+    for (int point = 0; point < SKETCH_POINTS; point++)
+    {
+        channel.sketch[point] = values.empty() ? 0 : values[(size_t)((values.size() - 1) * point / (SKETCH_POINTS - 1.0) + 0.5)];
+    }
+}
+
+void analyseFile(FileStats &file)
+{
+    string owned;
+    const char *data;
+    size_t size;
+    if (!loadLogText(file.path, owned, data, size) || size == 0)
+    {
+        return;
+    }
+    const char *end = data + size;
+    const char *newline = (const char *)memchr(data, '\n', size);
+    const char *row = newline == nullptr ? end : newline + 1;
+    vector<string> names = headerChannels(data, row - data);
+    for (int type = 0; type < 3; type++)
+    {
+        if ((int)names.size() == logTypeFields[type])
+        {
+            file.type = logTypes[type];
+        }
+    }
+    if (!file.type.empty())
+    {
+        int channelCount = names.size();
+        vector<vector<float>> values(channelCount);
+        file.channels.assign(channelCount, ChannelStats());
+        for (int c = 0; c < channelCount; c++)
+        {
+            file.channels[c].name = names[c];
+            file.channels[c].min = INFINITY;
+            file.channels[c].max = -INFINITY;
+        }
+        while (row < end)
+        {
+            newline = (const char *)memchr(row, '\n', end - row);
+            const char *rowEnd = newline == nullptr ? end : newline;
+            const char *field = row;
+            int column = -2; // Date and time come first
+            while (field != nullptr && column < channelCount)
+            {
+                if (column >= 0)
+                {
+                    char *parsed;
+                    double value = strtod(field, &parsed); // Reads the 0x sync word too
+                    if (parsed != field && parsed <= rowEnd && !std::isnan(value))
+                    {
+                        ChannelStats &channel = file.channels[column];
+                        channel.count++;
+                        double delta = value - channel.mean;
+                        channel.mean += delta / channel.count;
+                        channel.m2 += delta * (value - channel.mean);
+                        channel.min = min(channel.min, value);
+                        channel.max = max(channel.max, value);
+                        values[column].push_back(value);
+                    }
+                }
+                column++;
+                field = (const char *)memchr(field, ',', rowEnd - field);
+                field = field == nullptr ? nullptr : field + 1;
+            }
+            file.rows++;
+            row = rowEnd + 1;
+        }
+        for (int c = 0; c < channelCount; c++)
+        {
+            finishSketch(file.channels[c], values[c]);
+        }
+    }
+    if (owned.empty())
+    {
+        munmap((void *)data, size);
+    }
+}
+
+// ------------------------- Cache -----------------------------
+map<string, FileStats> loadCache(const string &path)
+{
+    map<string, FileStats> cache;
+    FILE *in = fopen(path.c_str(), "r");
+    if (in == nullptr)
+    {
+        return cache;
+    }
+    char line[8192];
+    FileStats *current = nullptr;
+    while (fgets(line, sizeof(line), in) != nullptr)
+    {
+        line[strcspn(line, "\n")] = '\0';
+        if (line[0] == 'F')
+        {
+            FileStats file;
+            char type[8] = "";
+            int consumed = 0;
+            if (sscanf(line, "F\t%lld\t%lld\t%7[^\t]\t%llu\t%n", &file.size, &file.mtime, type, &file.rows, &consumed) < 4)
+            {
+                current = nullptr;
+                continue;
+            }
+            file.path = line + consumed;
+            file.type = strcmp(type, "-") == 0 ? "" : type;
+            current = &(cache[file.path] = file);
+        }
+        else if (line[0] == 'C' && current != nullptr)
+        {
+            ChannelStats channel;
+            char name[64];
+            int consumed = 0;
+            if (sscanf(line, "C\t%63[^\t]\t%llu\t%lg\t%lg\t%lg\t%lg%n", name, &channel.count, &channel.min, &channel.max,
+                       &channel.mean, &channel.m2, &consumed) < 6)
+            {
+                continue;
+            }
+            channel.name = name;
+            char *point = line + consumed;
+            for (int i = 0; i < SKETCH_POINTS; i++)
+            {
+                channel.sketch[i] = strtod(point, &point);
+            }
+            current->channels.push_back(channel);
+        }
+    }
+    fclose(in);
+    return cache;
+}
+
+void saveCache(const string &path, const vector<FileStats> &files)
+{
+    string temporary = path + ".tmp";
+    FILE *out = fopen(temporary.c_str(), "w");
+    if (out == nullptr)
+    {
+        return;
+    }
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        const FileStats &file = files[i];
+        fprintf(out, "F\t%lld\t%lld\t%s\t%llu\t%s\n", file.size, file.mtime, file.type.empty() ? "-" : file.type.c_str(),
+                file.rows, file.path.c_str());
+        for (size_t c = 0; c < file.channels.size(); c++)
+        {
+            const ChannelStats &channel = file.channels[c];
+            fprintf(out, "C\t%s\t%llu\t%.17g\t%.17g\t%.17g\t%.17g", channel.name.c_str(), channel.count, channel.min,
+                    channel.max, channel.mean, channel.m2);
+            for (int point = 0; point < SKETCH_POINTS; point++)
+            {
+                fprintf(out, " %.9g", channel.sketch[point]);
+            }
+            fprintf(out, "\n");
+        }
+    }
+    fclose(out);
+    rename(temporary.c_str(), path.c_str()); // Never leave a half written cache behind
+}
+
+// ------------------------ Listing ----------------------------
+void findLogs(const string &directory, vector<FileStats> &files)
+{
+    DIR *dir = opendir(directory.c_str());
+    if (dir == nullptr)
+    {
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != nullptr)
+    {
+        string name = entry->d_name;
+        string path = directory + "/" + name;
+        struct stat info;
+        // Not frame logs, though a Sweeps log is as wide as an ERPA one
+        if (name[0] == '.' || name == "Controls" || name == "Triggers" || name == "Commands" || name == "Scripts" || name == "Sweeps" ||
+            stat(path.c_str(), &info) == -1)
+        {
+            continue;
+        }
+        if (S_ISDIR(info.st_mode))
+        {
+            findLogs(path, files);
+        }
+        else if (S_ISREG(info.st_mode) && name.compare(0, 8, "Controls") != 0 && !hasSuffix(name, ".idx") && !hasSuffix(name, ".tmp"))
+        {
+            FileStats file;
+            file.path = path;
+            file.size = info.st_size;
+            file.mtime = info.st_mtime;
+            file.rows = 0;
+            files.push_back(file);
+        }
+    }
+    closedir(dir);
+}
+
+// ------------------------ Reporting --------------------------
+double sketchPercentile(const double *sketch, double percent)
+{
+    double position = percent * (SKETCH_POINTS - 1) / 100.0;
+    int below = (int)position;
+    if (below >= SKETCH_POINTS - 1)
+    {
+        return sketch[SKETCH_POINTS - 1];
+    }
+    return sketch[below] + (sketch[below + 1] - sketch[below]) * (position - below);
+}
+
+void printChannel(const ChannelStats &channel)
+{
+    if (channel.count == 0)
+    {
+        printf("  %-10s %10d\n", channel.name.c_str(), 0);
+        return;
+    }
+    double stddev = channel.count > 1 ? sqrt(channel.m2 / (channel.count - 1)) : 0;
+    printf("  %-10s %10llu %12.6g %12.6g %12.6g %12.6g %12.6g %12.6g %12.6g\n", channel.name.c_str(), channel.count,
+           channel.min, channel.max, channel.mean, stddev, sketchPercentile(channel.sketch, 5),
+           sketchPercentile(channel.sketch, 50), sketchPercentile(channel.sketch, 95));
+}
+
+void printColumns()
+{
+    printf("  %-10s %10s %12s %12s %12s %12s %12s %12s %12s\n", "channel", "count", "min", "max", "mean", "stddev", "p5", "p50", "p95");
+}
+
+// Combines channel statistics of many files; percentiles come from the weighted union of the sketches
+ChannelStats mergeChannels(const vector<const ChannelStats *> &parts)
+{
+    ChannelStats total = ChannelStats();
+    total.name = parts.empty() ? "" : parts[0]->name;
+    total.min = INFINITY;
+    total.max = -INFINITY;
+    vector<pair<double, double>> points; // value, weight
+    for (size_t i = 0; i < parts.size(); i++)
+    {
+        const ChannelStats &part = *parts[i];
+        if (part.count == 0)
+        {
+            continue;
+        }
+        double delta = part.mean - total.mean;
+        unsigned long long count = total.count + part.count;
+        total.m2 += part.m2 + delta * delta * total.count * part.count / count; // Chan et al. parallel update
+        total.mean += delta * part.count / count;
+        total.count = count;
+        total.min = min(total.min, part.min);
+        total.max = max(total.max, part.max);
+        for (int point = 0; point < SKETCH_POINTS; point++)
+        {
+            points.push_back(make_pair(part.sketch[point], part.count / (double)SKETCH_POINTS));
+        }
+    }
+    sort(points.begin(), points.end());
+    double weight = 0;
+    for (size_t i = 0; i < points.size(); i++)
+    {
+        weight += points[i].second;
+    }
+    double seen = 0;
+    size_t next = 0;
+    for (int point = 0; point < SKETCH_POINTS; point++)
+    {
+        double wanted = weight * point / (SKETCH_POINTS - 1);
+        while (next + 1 < points.size() && seen + points[next].second < wanted)
+        {
+            seen += points[next++].second;
+        }
+        total.sketch[point] = points.empty() ? 0 : points[next].first;
+    }
+    return total;
+}
+
+int main(int argc, char **argv)
+{
+    string root = "logs";
+    int threads = max(1u, std::thread::hardware_concurrency());
+    bool useCache = true;
+    bool summaryOnly = false;
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if (arg == "--threads" && i + 1 < argc)
+        {
+            threads = max(1, atoi(argv[++i]));
+        }
+        else if (arg == "--no-cache")
+        {
+            useCache = false;
+        }
+        else if (arg == "--summary")
+        {
+            summaryOnly = true;
+        }
+        else if (arg[0] == '-')
+        {
+            fprintf(stderr, "usage: %s [--threads N] [--no-cache] [--summary] [logs]\n", argv[0]);
+            return 2;
+        }
+        else
+        {
+            root = arg;
+        }
+    }
+
+    vector<FileStats> files;
+    findLogs(root, files);
+    sort(files.begin(), files.end(), [](const FileStats &a, const FileStats &b)
+         { return a.path < b.path; });
+    string cachePath = root + "/.logStats.cache";
+    map<string, FileStats> cache;
+    if (useCache)
+    {
+        cache = loadCache(cachePath);
+    }
+    vector<size_t> work;
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        map<string, FileStats>::iterator cached = cache.find(files[i].path);
+        if (cached != cache.end() && cached->second.size == files[i].size && cached->second.mtime == files[i].mtime)
+        {
+            files[i] = cached->second;
+        }
+        else
+        {
+            work.push_back(i);
+        }
+    }
+
+    std::atomic<size_t> nextFile(0);
+    vector<std::thread> pool;
+    for (int t = 0; t < threads; t++)
+    {
+        pool.push_back(std::thread([&]
+                                   {
+            for (size_t i = nextFile++; i < work.size(); i = nextFile++)
+            {
+                analyseFile(files[work[i]]);
+            } }));
+    }
+    for (size_t t = 0; t < pool.size(); t++)
+    {
+        pool[t].join();
+    }
+    if (useCache)
+    {
+        saveCache(cachePath, files);
+    }
+
+    // Older logs spell 2v5mon as 2v5mov and 5refmon as 5vrefmon, so channels are merged by position
+    map<string, vector<vector<const ChannelStats *>>> byType;
+    map<string, int> filesPerType;
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        const FileStats &file = files[i];
+        if (file.type.empty())
+        {
+            continue;
+        }
+        filesPerType[file.type]++;
+        if (!summaryOnly)
+        {
+            printf("%s (%s, %llu rows)\n", file.path.c_str(), file.type.c_str(), file.rows);
+            printColumns();
+        }
+        vector<vector<const ChannelStats *>> &parts = byType[file.type];
+        parts.resize(max(parts.size(), file.channels.size()));
+        for (size_t c = 0; c < file.channels.size(); c++)
+        {
+            if (!summaryOnly)
+            {
+                printChannel(file.channels[c]);
+            }
+            parts[c].push_back(&file.channels[c]);
+        }
+    }
+    for (int type = 0; type < 3; type++)
+    {
+        if (filesPerType.count(logTypes[type]) == 0)
+        {
+            continue;
+        }
+        printf("OVERALL %s (%d files)\n", logTypes[type], filesPerType[logTypes[type]]);
+        printColumns();
+        vector<vector<const ChannelStats *>> &parts = byType[logTypes[type]];
+        for (size_t c = 0; c < parts.size(); c++)
+        {
+            printChannel(mergeChannels(parts[c]));
+        }
+    }
+    fprintf(stderr, "%zu files, %zu read, %zu from cache, %d threads\n", files.size(), work.size(), files.size() - work.size(), threads);
+    return 0;
+}
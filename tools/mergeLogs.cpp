@@ -0,0 +1,335 @@
+// ------------------------- mergeLogs --------------------------
+// Merges the ERPA, PMT and HK logs of a session into one time ordered table.
+//
+//   build/mergeLogs "2024-03-28 12-51-37" > merged.csv
+//   build/mergeLogs --long "logs/PMT/PMT 2024-03-28 12-51-37.csv" "logs/HK/HK 2024-03-28 12-51-37.csv"
+//   build/mergeLogs --asof HK --max-age 2000 "2024-03-28 12-51-37"
+//
+// Inputs are session names (their ERPA, PMT and HK logs, rotated parts
+// included) or log files, plain or .csv.gz. Each input is read a row at a
+// time and the rows are merged on their timestamps with a heap, so memory use
+// does not depend on the size of the logs.
+//
+// Output is wide by default: date, time, type and then the columns of every
+// type, with only the columns of the row's own type filled. --long prints one
+// "date, time, type, channel, value" row per value instead. --asof TYPE drops
+// the rows of TYPE and instead attaches its latest values (and their age in
+// ms) to every other row; with --max-age MS values older than that are left
+// empty. Field text is copied as it is in the logs.
+#include <dirent.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <queue>
+#include <algorithm>
+#include "../fltk-1.3.8/zlib/zlib.h"
+#include "../logging/logIndex.cpp"
+
+using namespace std;
+
+const char *logTypes[4] = {"", "ERPA", "PMT", "HK"};
+const int logTypeFields[4] = {0, 7, 3, 19};
+
+struct MergeSource
+{
+    string path;
+    gzFile in;
+    int type;
+    string row;
+    vector<string> fields; // Values of the current row, without date and time
+    string stamp;          // "date, time" of the current row
+    int64_t timestampMs;
+};
+
+struct MergeEntry
+{
+    int64_t timestampMs;
+    size_t source;
+};
+
+// Earliest row first; ties go to the source given first
+struct LaterEntry
+{
+    bool operator()(const MergeEntry &a, const MergeEntry &b) const
+    {
+        return a.timestampMs != b.timestampMs ? a.timestampMs > b.timestampMs : a.source > b.source;
+    }
+};
+
+vector<MergeSource> sources;
+vector<string> channelNames[4]; // From the header of the first log of each type
+
+bool readLine(gzFile in, string &line)
+{
+    line.clear();
+    char buffer[4096];
+    while (gzgets(in, buffer, sizeof(buffer)) != nullptr)
+    {
+        line += buffer;
+        if (!line.empty() && line[line.size() - 1] == '\n')
+        {
+            break;
+        }
+    }
+    while (!line.empty() && (line[line.size() - 1] == '\n' || line[line.size() - 1] == '\r'))
+    {
+        line.erase(line.size() - 1);
+    }
+    return !line.empty() || !gzeof(in);
+}
+
+void splitFields(const string &row, vector<string> &fields)
+{
+    fields.clear();
+    size_t start = 0;
+    while (start <= row.size())
+    {
+        size_t comma = row.find(',', start);
+        if (comma == string::npos)
+        {
+            comma = row.size();
+        }
+        size_t first = row.find_first_not_of(' ', start);
+        size_t last = row.find_last_not_of(' ', comma - 1);
+        fields.push_back(first < comma && last != string::npos && last >= first ? row.substr(first, last - first + 1) : "");
+        start = comma + 1;
+    }
+}
+
+// Reads rows until one has a timestamp and the full set of fields
+bool nextRow(MergeSource &source)
+{
+    while (readLine(source.in, source.row))
+    {
+        if (!parseLogTimestamp(source.row.c_str(), source.row.size(), source.timestampMs))
+        {
+            continue;
+        }
+        splitFields(source.row, source.fields);
+        if ((int)source.fields.size() < logTypeFields[source.type] + 2)
+        {
+            continue;
+        }
+        source.stamp = source.fields[0] + ", " + source.fields[1];
+        source.fields.erase(source.fields.begin(), source.fields.begin() + 2);
+        source.fields.resize(logTypeFields[source.type]);
+        return true;
+    }
+    return false;
+}
+
+bool addSourceFile(const string &path)
+{
+    MergeSource source;
+    source.path = path;
+    source.in = gzopen(path.c_str(), "rb"); // Reads plain files as they are
+    if (source.in == nullptr)
+    {
+        perror(path.c_str());
+        return false;
+    }
+    gzbuffer(source.in, 256 * 1024);
+    string header;
+    readLine(source.in, header);
+    vector<string> names;
+    splitFields(header, names);
+    source.type = 0;
+    for (int type = 1; type <= 3; type++)
+    {
+        if ((int)names.size() == logTypeFields[type] + 2)
+        {
+            source.type = type;
+        }
+    }
+    if (source.type == 0)
+    {
+        fprintf(stderr, "%s is not an ERPA, PMT or HK log.\n", path.c_str());
+        gzclose(source.in);
+        return false;
+    }
+    if (channelNames[source.type].empty())
+    {
+        channelNames[source.type].assign(names.begin() + 2, names.end()); // Older headers start with a timestamp
+    }
+    sources.push_back(source);
+    return true;
+}
+
+// A session name stands for logs/<TYPE>/<TYPE> <session>.csv and its rotated parts
+bool addSession(const string &session)
+{
+    bool any = false;
+    for (int type = 1; type <= 3; type++)
+    {
+        string directory = string("logs/") + logTypes[type];
+        string prefix = string(logTypes[type]) + " " + session;
+        vector<string> names;
+        DIR *dir = opendir(directory.c_str());
+        struct dirent *entry;
+        while (dir != nullptr && (entry = readdir(dir)) != nullptr)
+        {
+            string name = entry->d_name;
+            bool plain = name.size() > 4 && name.compare(name.size() - 4, 4, ".csv") == 0;
+            bool gzipped = name.size() > 7 && name.compare(name.size() - 7, 7, ".csv.gz") == 0;
+            if (name.compare(0, prefix.size(), prefix) == 0 && (plain || gzipped))
+            {
+                names.push_back(name);
+            }
+        }
+        if (dir != nullptr)
+        {
+            closedir(dir);
+        }
+        sort(names.begin(), names.end());
+        for (size_t i = 0; i < names.size(); i++)
+        {
+            any = addSourceFile(directory + "/" + names[i]) || any;
+        }
+    }
+    if (!any)
+    {
+        fprintf(stderr, "No logs found for session %s.\n", session.c_str());
+    }
+    return any;
+}
+
+int main(int argc, char **argv)
+{
+    bool longTable = false;
+    int asofType = 0;
+    int64_t maxAgeMs = -1;
+    vector<string> inputs;
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if (arg == "--long")
+        {
+            longTable = true;
+        }
+        else if (arg == "--asof" && i + 1 < argc)
+        {
+            string type = argv[++i];
+            for (int t = 1; t <= 3; t++)
+            {
+                asofType = type == logTypes[t] ? t : asofType;
+            }
+        }
+        else if (arg == "--max-age" && i + 1 < argc)
+        {
+            maxAgeMs = atoll(argv[++i]);
+        }
+        else
+        {
+            inputs.push_back(arg);
+        }
+    }
+    if (inputs.empty() || (longTable && asofType != 0))
+    {
+        fprintf(stderr, "usage: %s [--long | --asof ERPA|PMT|HK [--max-age MS]] session|file.csv[.gz]...\n", argv[0]);
+        return 2;
+    }
+    for (size_t i = 0; i < inputs.size(); i++)
+    {
+        string &input = inputs[i];
+        bool file = input.find(".csv") != string::npos;
+        if (!(file ? addSourceFile(input) : addSession(input)))
+        {
+            return 1;
+        }
+    }
+
+    // Ties go to the source given first, so the as-of logs go first: a row sees values stamped in the same ms
+    stable_partition(sources.begin(), sources.end(), [asofType](const MergeSource &source)
+                     { return source.type == asofType; });
+
+    static char outBuffer[1 << 20];
+    setvbuf(stdout, outBuffer, _IOFBF, sizeof(outBuffer));
+    if (longTable)
+    {
+        printf("date, time, type, channel, value\n");
+    }
+    else
+    {
+        printf("date, time, type");
+        for (int type = 1; type <= 3; type++)
+        {
+            if (type == asofType)
+            {
+                printf(", %s age ms", logTypes[type]);
+            }
+            for (size_t c = 0; c < channelNames[type].size(); c++)
+            {
+                printf(", %s %s", logTypes[type], channelNames[type][c].c_str());
+            }
+        }
+        printf("\n");
+    }
+
+    priority_queue<MergeEntry, vector<MergeEntry>, LaterEntry> heap;
+    for (size_t i = 0; i < sources.size(); i++)
+    {
+        if (nextRow(sources[i]))
+        {
+            heap.push({sources[i].timestampMs, i});
+        }
+    }
+    vector<string> latest(asofType == 0 ? 0 : logTypeFields[asofType]); // Last row of the as-of type
+    int64_t latestMs = INT64_MIN;
+    unsigned long long rows = 0;
+    while (!heap.empty())
+    {
+        MergeSource &source = sources[heap.top().source];
+        size_t index = heap.top().source;
+        heap.pop();
+        if (source.type == asofType)
+        {
+            latest = source.fields;
+            latestMs = source.timestampMs;
+        }
+        else if (longTable)
+        {
+            for (size_t c = 0; c < source.fields.size(); c++)
+            {
+                printf("%s, %s, %s, %s\n", source.stamp.c_str(), logTypes[source.type],
+                       channelNames[source.type].size() > c ? channelNames[source.type][c].c_str() : "", source.fields[c].c_str());
+            }
+            rows++;
+        }
+        else
+        {
+            printf("%s, %s", source.stamp.c_str(), logTypes[source.type]);
+            for (int type = 1; type <= 3; type++)
+            {
+                if (type == asofType)
+                {
+                    bool fresh = latestMs != INT64_MIN && (maxAgeMs < 0 || source.timestampMs - latestMs <= maxAgeMs);
+                    printf(fresh ? ", %lld" : ", ", (long long)(source.timestampMs - latestMs));
+                    for (size_t c = 0; c < latest.size(); c++)
+                    {
+                        printf(", %s", fresh ? latest[c].c_str() : "");
+                    }
+                    continue;
+                }
+                for (size_t c = 0; c < channelNames[type].size(); c++)
+                {
+                    printf(", %s", type == source.type ? source.fields[c].c_str() : "");
+                }
+            }
+            printf("\n");
+            rows++;
+        }
+        if (nextRow(source))
+        {
+            heap.push({source.timestampMs, index});
+        }
+    }
+    fflush(stdout);
+    for (size_t i = 0; i < sources.size(); i++)
+    {
+        gzclose(sources[i].in);
+    }
+    fprintf(stderr, "%llu rows from %zu logs\n", rows, sources.size());
+    return 0;
+}
@@ -0,0 +1,228 @@
+// ----------------------- safeModeStress -------------------------
+// Stress test for the safe mode lane (commands/safeMode.cpp): how long after a
+// request the safe bytes reach the far end of the port while the command
+// queue is flooded and every core is busy.
+//
+//   build/safeModeStress [--runs N] [--baud B] [--max-ms MS] [--no-flood]
+//
+// The port is a socketpair standing in for the serial port. Unlike a
+// pseudo-terminal it reports its unsent bytes (TIOCOUTQ), so the transmit
+// thread keeps at most commandPortLimit bytes in it, as on a real UART. The far
+// end reads at the line rate of --baud (default 57600, 10 bits a byte) and
+// times when it sees 14 16 0C. A flooder keeps the command queue full and a
+// thread per core spins. The runs alternate between SIGUSR1 and a direct
+// request, 20 to 50 ms apart so the queue and the port fill up again.
+//
+// Prints the worst time from the request to the bytes being written (as on
+// quit in the GUI) and the median, 99th percentile and worst time to them
+// arriving at the far end. Exits with 1 if a run never arrived or one took
+// longer than --max-ms; the default is the line time of what may be ahead of
+// the safe bytes (commandPortLimit plus one write of commandBatchLimit) and of
+// the bytes themselves, plus 10 ms. The runs are logged to
+// logs/Commands/Safe safe mode stress.csv.
+#include <sys/socket.h>
+#include <poll.h>
+#include <unistd.h>
+#include <signal.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <random>
+#include <algorithm>
+#include "../commands/safeMode.cpp"
+
+using namespace std;
+
+std::atomic<bool> stressDone(false);   // Stops the flooder and the spinning threads
+std::atomic<bool> farEndDone(false);   // Stops the far end, after the queue
+std::atomic<int64_t> requestedNs(0); // Of the run in flight, 0 once it arrived
+std::mutex arrivedMutex;
+vector<double> arrivedUs;
+
+int64_t steadyNs()
+{
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// The far end: reads at the line rate and times each 14 16 0C
+void drainPort(int fd, double bytesPerSecond)
+{
+    unsigned char bytes[8];
+    size_t matched = 0;
+    double credit = 0;
+    chrono::steady_clock::time_point last = chrono::steady_clock::now();
+    while (!farEndDone)
+    {
+        chrono::steady_clock::time_point now = chrono::steady_clock::now();
+        credit = min(credit + chrono::duration<double>(now - last).count() * bytesPerSecond, (double)sizeof(bytes));
+        last = now;
+        if (credit < 1)
+        {
+            usleep(200);
+            continue;
+        }
+        struct pollfd ready = {fd, POLLIN, 0};
+        if (poll(&ready, 1, 5) <= 0)
+        {
+            continue;
+        }
+        ssize_t got = read(fd, bytes, (size_t)credit);
+        if (got <= 0)
+        {
+            continue;
+        }
+        credit -= got;
+        for (ssize_t i = 0; i < got; i++)
+        {
+            matched = bytes[i] == safeModeCommands[matched] ? matched + 1 : bytes[i] == safeModeCommands[0] ? 1 : 0;
+            if (matched == sizeof(safeModeCommands))
+            {
+                matched = 0;
+                int64_t requested = requestedNs.exchange(0);
+                if (requested != 0)
+                {
+                    std::lock_guard<std::mutex> lock(arrivedMutex);
+                    arrivedUs.push_back((steadyNs() - requested) / 1000.0);
+                }
+            }
+        }
+    }
+}
+
+void printLatency(const char *what, vector<double> &us)
+{
+    sort(us.begin(), us.end());
+    if (!us.empty())
+    {
+        printf("%s: median %.0f us, p99 %.0f us, max %.0f us\n", what, us[us.size() / 2], us[us.size() * 99 / 100], us.back());
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int runs = 200;
+    int baud = 57600;
+    double maxMs = -1;
+    bool flood = true;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc)
+        {
+            runs = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--baud") == 0 && i + 1 < argc)
+        {
+            baud = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--max-ms") == 0 && i + 1 < argc)
+        {
+            maxMs = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--no-flood") == 0)
+        {
+            flood = false;
+        }
+        else
+        {
+            fprintf(stderr, "Usage: %s [--runs N] [--baud B] [--max-ms MS] [--no-flood]\n", argv[0]);
+            return 1;
+        }
+    }
+    double bytesPerSecond = baud / 10.0;
+    if (maxMs < 0)
+    {
+        maxMs = (commandPortLimit + commandBatchLimit + sizeof(safeModeCommands)) * 1000.0 / bytesPerSecond + 10;
+    }
+
+    int pair[2];
+    if (runs <= 0 || baud <= 0 || socketpair(AF_UNIX, SOCK_STREAM, 0, pair) != 0)
+    {
+        fprintf(stderr, "Cannot set up the test.\n");
+        return 1;
+    }
+    mkdir("logs", 0755);
+    std::thread farEnd(drainPort, pair[1], bytesPerSecond);
+    startCommandQueue(pair[0], "safe mode stress");
+    startSafeMode(pair[0], "safe mode stress");
+
+    vector<std::thread> burners;
+    for (unsigned i = 0; i < std::thread::hardware_concurrency(); i++)
+    {
+        burners.push_back(std::thread([]()
+                                      {
+                                          volatile double spin = 0;
+                                          while (!stressDone)
+                                          {
+                                              spin = spin + 1;
+                                          } }));
+    }
+    std::thread flooder([flood]()
+                        {
+                            unsigned char bytes[64];
+                            memset(bytes, 0x0F, sizeof(bytes)); // Request HK, harmless
+                            while (!stressDone)
+                            {
+                                if (flood && commandQueueStats().depth + sizeof(bytes) < commandQueueLimit)
+                                {
+                                    queueCommands(bytes, sizeof(bytes));
+                                }
+                                else
+                                {
+                                    usleep(500);
+                                }
+                            } });
+
+    std::mt19937 random(7);
+    int missing = 0;
+    for (int run = 0; run < runs; run++)
+    {
+        usleep(20000 + random() % 30000);
+        if (requestedNs.exchange(0) != 0)
+        {
+            missing++; // The last run never arrived
+        }
+        unsigned before = safeModeCount;
+        requestedNs = steadyNs();
+        if (run % 2)
+        {
+            kill(getpid(), SIGUSR1);
+        }
+        else
+        {
+            requestSafeMode(SAFE_FROM_BUTTON);
+        }
+        while (safeModeCount == before)
+        {
+            usleep(100);
+        }
+        followSafeMode(); // As the GUI's main loop does; lets the flooder queue again
+    }
+    usleep(300000);
+    missing += requestedNs.exchange(0) != 0;
+
+    stressDone = true;
+    flooder.join();
+    for (size_t i = 0; i < burners.size(); i++)
+    {
+        burners[i].join();
+    }
+    stopSafeMode(); // Prints the worst time to the bytes being written
+    dropQueuedCommands();
+    stopCommandQueue();
+    farEndDone = true;
+    farEnd.join();
+
+    CommandQueueStats stats = commandQueueStats();
+    printf("%d runs at %d baud, %s, %u cores busy; %llu queued bytes sent, %llu cleared by safe mode\n", runs, baud,
+           flood ? "queue flooded" : "queue idle", std::thread::hardware_concurrency(), stats.sent, stats.cleared);
+    printLatency("arrived", arrivedUs);
+    double worstMs = arrivedUs.empty() ? 0 : arrivedUs.back() / 1000.0;
+    bool pass = missing == 0 && worstMs <= maxMs;
+    printf("%s: %d of %d arrived, worst %.1f ms against a bound of %.1f ms\n", pass ? "PASS" : "FAIL", runs - missing, runs, worstMs, maxMs);
+    return pass ? 0 : 1;
+}
@@ -0,0 +1,213 @@
+// ------------------------- sliceLog ---------------------------
+// Prints the rows of an ERPA, PMT, HK or Controls log that fall in a time (or
+// sequence number) range, using the .idx sidecar to jump close to the start
+// instead of reading the file from the top.
+//
+//   build/sliceLog "logs/HK/HK 2024-03-28 12-51-37.csv" 14:32:05 14:32:10
+//   build/sliceLog "logs/HK/HK 2024-03-28 12-51-37.csv" "03-28-2024 14:32:05.500" "03-28-2024 14:33:00"
+//   build/sliceLog --seq 5990 6010 "logs/HK/HK 2024-03-28 12-51-37.csv"
+//   build/sliceLog --index logs/HK/*.csv      (index logs recorded without one)
+//
+// A time without a date is on the date of the file's first row. The end of the
+// range is exclusive and optional. The header row is always printed first.
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "../logging/logIndex.cpp"
+
+using namespace std;
+
+struct MappedLog
+{
+    const char *data;
+    size_t size;
+};
+
+bool mapLog(const char *path, MappedLog &log)
+{
+    int fd = open(path, O_RDONLY);
+    struct stat info;
+    if (fd == -1 || fstat(fd, &info) == -1 || info.st_size == 0)
+    {
+        perror(path);
+        if (fd != -1)
+        {
+            close(fd);
+        }
+        return false;
+    }
+    void *memory = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED)
+    {
+        perror(path);
+        return false;
+    }
+    log.data = (const char *)memory;
+    log.size = info.st_size;
+    return true;
+}
+
+size_t lineEnd(const MappedLog &log, size_t offset)
+{
+    const char *newline = (const char *)memchr(log.data + offset, '\n', log.size - offset);
+    return newline == nullptr ? log.size : newline - log.data + 1;
+}
+
+// Sequence number is the fourth field: date, time, sync, seq
+bool parseLogSequence(const char *row, size_t length, uint32_t &sequence)
+{
+    const char *field = row;
+    const char *end = row + length;
+    for (int commas = 0; commas < 3; commas++)
+    {
+        field = (const char *)memchr(field, ',', end - field);
+        if (field == nullptr)
+        {
+            return false;
+        }
+        field++;
+    }
+    char *parsed;
+    sequence = strtoul(field, &parsed, 10);
+    return parsed != field;
+}
+
+int buildIndex(const char *path)
+{
+    MappedLog log;
+    if (!mapLog(path, log))
+    {
+        return 1;
+    }
+    FILE *index = createLogIndex(path, 1000);
+    if (index == nullptr)
+    {
+        perror(path);
+        return 1;
+    }
+    uint64_t rows = 0;
+    for (size_t offset = lineEnd(log, 0); offset < log.size; offset = lineEnd(log, offset))
+    {
+        int64_t timestampMs;
+        uint32_t sequence = 0;
+        size_t length = lineEnd(log, offset) - offset;
+        if (parseLogTimestamp(log.data + offset, length, timestampMs) && rows++ % 1000 == 0)
+        {
+            parseLogSequence(log.data + offset, length, sequence);
+            appendLogIndex(index, timestampMs, offset, sequence);
+        }
+    }
+    fclose(index);
+    munmap((void *)log.data, log.size);
+    fprintf(stderr, "%s: indexed %llu rows\n", path, (unsigned long long)rows);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 2 && strcmp(argv[1], "--index") == 0)
+    {
+        int failed = 0;
+        for (int i = 2; i < argc; i++)
+        {
+            failed |= buildIndex(argv[i]);
+        }
+        return failed;
+    }
+    bool bySequence = argc > 1 && strcmp(argv[1], "--seq") == 0;
+    if ((bySequence && argc != 5) || (!bySequence && (argc < 3 || argc > 4)))
+    {
+        fprintf(stderr, "usage: %s file.csv FROM [TO]\n"
+                        "       %s --seq FROM TO file.csv\n"
+                        "       %s --index file.csv...\n", argv[0], argv[0], argv[0]);
+        return 2;
+    }
+    const char *path = bySequence ? argv[4] : argv[1];
+    auto start = chrono::steady_clock::now();
+    MappedLog log;
+    if (!mapLog(path, log))
+    {
+        return 1;
+    }
+    size_t firstRow = lineEnd(log, 0);
+    fwrite(log.data, 1, firstRow, stdout);
+    if (firstRow >= log.size)
+    {
+        return 0;
+    }
+
+    int64_t fromMs = 0, toMs = INT64_MAX;
+    uint32_t fromSequence = 0, toSequence = 0;
+    if (bySequence)
+    {
+        fromSequence = strtoul(argv[2], nullptr, 10);
+        toSequence = strtoul(argv[3], nullptr, 10);
+    }
+    else if (!parseTimeArgument(argv[2], log.data + firstRow, fromMs) ||
+             (argc == 4 && !parseTimeArgument(argv[3], log.data + firstRow, toMs)))
+    {
+        fprintf(stderr, "Times are HH:MM:SS[.mmm] or \"MM-DD-YYYY HH:MM:SS[.mmm]\".\n");
+        return 2;
+    }
+
+    vector<LogIndexEntry> entries;
+    bool indexed = loadLogIndex(path, entries);
+    size_t offset = firstRow;
+    if (indexed)
+    {
+        offset = max<size_t>(offset, bySequence ? seekLogSequence(entries, fromSequence) : seekLogTime(entries, fromMs));
+    }
+
+    unsigned long long printed = 0;
+    bool inRange = false;
+    for (; offset < log.size; offset = lineEnd(log, offset))
+    {
+        size_t length = lineEnd(log, offset) - offset;
+        const char *row = log.data + offset;
+        if (bySequence)
+        {
+            uint32_t sequence;
+            if (!parseLogSequence(row, length, sequence))
+            {
+                continue;
+            }
+            if (!inRange && sequence != fromSequence)
+            {
+                continue;
+            }
+            inRange = true;
+            fwrite(row, 1, length, stdout);
+            printed++;
+            if (sequence == toSequence)
+            {
+                break;
+            }
+            continue;
+        }
+        int64_t timestampMs;
+        if (!parseLogTimestamp(row, length, timestampMs) || timestampMs < fromMs)
+        {
+            continue;
+        }
+        if (timestampMs >= toMs)
+        {
+            break;
+        }
+        fwrite(row, 1, length, stdout);
+        printed++;
+    }
+    fflush(stdout);
+    fprintf(stderr, "%llu rows in %.2f ms (%s)\n", printed,
+            chrono::duration<double, milli>(chrono::steady_clock::now() - start).count(),
+            indexed ? "indexed" : "no index, scanned from the top");
+    munmap((void *)log.data, log.size);
+    return 0;
+}
@@ -0,0 +1,190 @@
+// ----------------------- telemetryFanout -------------------------
+// Benchmark for the telemetry fan-out server (telemetry/telemetryServer.cpp):
+// what publishing a frame costs the decode loop with many viewers connected,
+// and whether one viewer that never reads slows it down or costs the others
+// frames.
+//
+//   build/telemetryFanout [--clients N] [--stalled N] [--frames N] [--gap-us US]
+//
+// --clients viewers (default 40) connect over a Unix-domain socket, and
+// --stalled of them (default 1) never read. --frames HK frames (default
+// 200000) are published from this thread, as the GUI's main loop would,
+// --gap-us apart (default 20, about a hundred times the instrument's rate; 0
+// publishes back to back, which outruns the readers' queues so they lose
+// frames). Every other viewer counts the frames it gets on a thread of its own.
+//
+// Prints the mean and worst time of publishTelemetryFrame(), the fewest frames
+// a reader got, and how many stalled viewers were disconnected. It waits up to
+// the stall limit plus a second for the readers to catch up and the stalled
+// viewers to go. Exits with 1 if a reader lost frames or a stalled viewer was
+// kept.
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include "../telemetry/telemetryServer.cpp"
+
+using namespace std;
+
+std::atomic<bool> readersDone(false);
+
+int connectViewer(const string &path)
+{
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path.c_str());
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd != -1 && connect(fd, (sockaddr *)&addr, sizeof(addr)) == -1)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Counts whole frames until the server hangs up or the test ends
+void readFrames(int fd, std::atomic<unsigned long long> *frames)
+{
+    unsigned char buffer[64 * 1024];
+    unsigned long long bytes = 0;
+    size_t frameBytes = frameWireSize(frameFieldCounts[HK_FRAME]);
+    while (!readersDone)
+    {
+        ssize_t got = recv(fd, buffer, sizeof(buffer), 0);
+        if (got <= 0)
+        {
+            return;
+        }
+        bytes += got;
+        *frames = bytes / frameBytes;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int clients = 40;
+    int stalled = 1;
+    long frameCount = 200000;
+    int gapUs = 20;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--clients") == 0 && i + 1 < argc)
+        {
+            clients = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--stalled") == 0 && i + 1 < argc)
+        {
+            stalled = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+        {
+            frameCount = atol(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--gap-us") == 0 && i + 1 < argc)
+        {
+            gapUs = atoi(argv[++i]);
+        }
+        else
+        {
+            fprintf(stderr, "Usage: %s [--clients N] [--stalled N] [--frames N] [--gap-us US]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (clients <= 0 || clients > maxTelemetryClients || stalled < 0 || stalled > clients || frameCount <= 0 || gapUs < 0)
+    {
+        fprintf(stderr, "Between 1 and %d clients, at most all of them stalled.\n", maxTelemetryClients);
+        return 1;
+    }
+
+    string path = "/tmp/telemetryFanout." + to_string(getpid()) + ".sock";
+    if (!startTelemetryServer("", path))
+    {
+        return 1;
+    }
+    vector<int> fds;
+    for (int i = 0; i < clients; i++)
+    {
+        int fd = connectViewer(path);
+        if (fd == -1)
+        {
+            perror(path.c_str());
+            return 1;
+        }
+        fds.push_back(fd);
+    }
+    while (telemetryClientCount() < clients)
+    {
+        usleep(1000); // The server thread accepts them
+    }
+    int readers = clients - stalled;
+    vector<std::atomic<unsigned long long>> received(readers);
+    vector<std::thread> readerThreads;
+    for (int i = 0; i < readers; i++)
+    {
+        received[i] = 0;
+        readerThreads.push_back(std::thread(readFrames, fds[stalled + i], &received[i]));
+    }
+
+    Frame frame = {};
+    frame.type = HK_FRAME;
+    frame.count = frameFieldCounts[HK_FRAME];
+    double totalUs = 0;
+    double worstUs = 0;
+    for (long n = 0; n < frameCount; n++)
+    {
+        frame.timestampMs = currentTimeMs();
+        frame.values[1] = n % 65536; // seq
+        chrono::steady_clock::time_point before = chrono::steady_clock::now();
+        publishTelemetryFrame(frame);
+        double us = chrono::duration<double, micro>(chrono::steady_clock::now() - before).count();
+        totalUs += us;
+        worstUs = max(worstUs, us);
+        if (gapUs > 0)
+        {
+            usleep(gapUs);
+        }
+    }
+
+    // The readers catch up, the stalled viewers hit the stall limit
+    unsigned long long fewest = 0;
+    int64_t deadlineMs = currentTimeMs() + telemetryStallLimitMs + 1000;
+    do
+    {
+        usleep(10000);
+        fewest = frameCount;
+        for (int i = 0; i < readers; i++)
+        {
+            fewest = min(fewest, (unsigned long long)received[i]);
+        }
+    } while ((fewest < (unsigned long long)frameCount || telemetryClientCount() > readers) && currentTimeMs() < deadlineMs);
+    int dropped = clients - telemetryClientCount();
+
+    readersDone = true;
+    stopTelemetryServer(); // Hangs up on the readers
+    for (size_t i = 0; i < readerThreads.size(); i++)
+    {
+        readerThreads[i].join();
+    }
+    for (size_t i = 0; i < fds.size(); i++)
+    {
+        close(fds[i]);
+    }
+
+    printf("%ld HK frames to %d clients, %d stalled%s\n", frameCount, clients, stalled,
+           gapUs > 0 ? (", " + to_string(gapUs) + " us apart").c_str() : ", back to back");
+    printf("publish: mean %.2f us, max %.1f us\n", totalUs / frameCount, worstUs);
+    if (readers > 0)
+    {
+        printf("fewest frames a reader got: %llu of %ld\n", fewest, frameCount);
+    }
+    bool pass = (readers == 0 || fewest == (unsigned long long)frameCount) && dropped == stalled;
+    printf("%s: %d of %d stalled clients disconnected, %d readers kept\n", pass ? "PASS" : "FAIL", dropped, stalled, clients - dropped);
+    return pass ? 0 : 1;
+}
@@ -0,0 +1,115 @@
+// ----------------------- timestampBench -------------------------
+// Microbenchmark for the log row timestamps (formatLogTimestamp in
+// frames/frame.cpp) against the time, localtime, system_clock and put_time
+// sequence every row used to go through.
+//
+//   build/timestampBench [--rows N]
+//
+// Both write N rows' timestamps (default 1000000) into an ostringstream. The
+// old sequence reads the clock itself, as it did in the GUI. The cached
+// formatter is given the times, as rows get them from frame.timestampMs, ten
+// rows a millisecond so it crosses seconds the way a fast log does.
+//
+// Prints the nanoseconds per row of each, then checks the formatter against
+// put_time at times around the second, minute, day and year boundaries. Exits
+// with 1 if any of them differ.
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <sstream>
+#include <iomanip>
+#include <chrono>
+#include "../frames/frame.cpp"
+
+using namespace std;
+
+// What the GUI did per row before the cached formatter
+void writeOldTimestamp(ostream &out)
+{
+    auto t = std::time(nullptr);
+    auto tm = *std::localtime(&t);
+
+    auto now = chrono::system_clock::now();
+    time_t now_c = chrono::system_clock::to_time_t(now);
+    (void)now_c;
+    auto ms = chrono::duration_cast<chrono::milliseconds>(now.time_since_epoch()) % 1000;
+    out << put_time(&tm, "%m-%d-%Y, %H:%M:%S:") << ms.count();
+}
+
+string putTimeTimestamp(int64_t timestampMs)
+{
+    time_t seconds = timestampMs / 1000;
+    struct tm tm;
+    localtime_r(&seconds, &tm);
+    ostringstream out;
+    out << put_time(&tm, "%m-%d-%Y, %H:%M:%S:") << timestampMs % 1000;
+    return out.str();
+}
+
+int main(int argc, char **argv)
+{
+    long rows = 1000000;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--rows") == 0 && i + 1 < argc)
+        {
+            rows = atol(argv[++i]);
+        }
+        else
+        {
+            fprintf(stderr, "Usage: %s [--rows N]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (rows <= 0)
+    {
+        fprintf(stderr, "--rows must be positive.\n");
+        return 1;
+    }
+
+    ostringstream oldRows;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (long i = 0; i < rows; i++)
+    {
+        writeOldTimestamp(oldRows);
+    }
+    double oldNs = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / rows;
+
+    ostringstream newRows;
+    char timestamp[32];
+    int64_t firstMs = currentTimeMs();
+    start = chrono::steady_clock::now();
+    for (long i = 0; i < rows; i++)
+    {
+        newRows.write(timestamp, formatLogTimestamp(firstMs + i / 10, timestamp));
+    }
+    double newNs = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / rows;
+
+    printf("%ld rows: put_time %.0f ns a row, formatLogTimestamp %.0f ns a row (%.0fx), %zu and %zu bytes\n", rows, oldNs,
+           newNs, oldNs / newNs, oldRows.str().size(), newRows.str().size());
+
+    // Around a second, a minute, midnight and New Year in local time
+    struct tm newYear = {};
+    newYear.tm_year = 2025 - 1900;
+    newYear.tm_mday = 1;
+    newYear.tm_isdst = -1;
+    int64_t yearMs = (int64_t)mktime(&newYear) * 1000;
+    const int64_t samples[] = {firstMs, firstMs - firstMs % 1000 + 999, firstMs - firstMs % 60000 - 1, yearMs - 1, yearMs,
+                               yearMs + 7, yearMs + 50, yearMs + 86400 * 1000 - 1, yearMs + 86400 * 1000 + 123};
+    int mismatches = 0;
+    for (size_t i = 0; i < sizeof(samples) / sizeof(samples[0]); i++)
+    {
+        string expected = putTimeTimestamp(samples[i]);
+        string formatted(timestamp, formatLogTimestamp(samples[i], timestamp));
+        if (formatted != expected)
+        {
+            printf("%lld: \"%s\", put_time gives \"%s\"\n", (long long)samples[i], formatted.c_str(), expected.c_str());
+            mismatches++;
+        }
+    }
+    printf("%s: %d of %zu sample times differ from put_time\n", mismatches == 0 ? "PASS" : "FAIL", mismatches,
+           sizeof(samples) / sizeof(samples[0]));
+    return mismatches == 0 ? 0 : 1;
+}
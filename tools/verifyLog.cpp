@@ -0,0 +1,156 @@
+// ------------------------ verifyLog ---------------------------
+// Checks block framed logs (.csv.blk, written with --block-logs) and optionally
+// recovers them to plain CSV.
+//
+//   build/verifyLog [-r recovered.csv] "logs/HK/HK 2024-03-28 12-51-37.csv.blk" ...
+//
+// For every file it reports the number of intact blocks, the first bad block
+// and every damaged byte range. Damage never stops the scan: the next intact
+// block is found by its magic and checksum, so with -r every intact block from
+// before and after the damage ends up in the recovered CSV, in file order.
+// Exits with 1 if any file was damaged.
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <string>
+#include "../logging/logBlock.cpp"
+
+using namespace std;
+
+// Next offset after from where an intact block starts, or size if there is none
+size_t findNextBlock(const unsigned char *data, size_t size, size_t from)
+{
+    const unsigned char first = LOG_BLOCK_MAGIC & 0xFF;
+    for (size_t offset = from; offset + LOG_BLOCK_HEADER <= size; offset++)
+    {
+        const unsigned char *candidate = (const unsigned char *)memchr(data + offset, first, size - offset);
+        if (candidate == nullptr)
+        {
+            break;
+        }
+        offset = candidate - data;
+        uint64_t sequence;
+        if (checkLogBlock(candidate, size - offset, sequence) > 0)
+        {
+            return offset;
+        }
+    }
+    return size;
+}
+
+// Returns true if the file is intact
+bool verifyFile(const char *path, FILE *recovered, double &scannedBytes)
+{
+    int fd = open(path, O_RDONLY);
+    struct stat info;
+    if (fd == -1 || fstat(fd, &info) == -1)
+    {
+        perror(path);
+        if (fd != -1)
+        {
+            close(fd);
+        }
+        return false;
+    }
+    size_t size = info.st_size;
+    const unsigned char *data = nullptr;
+    if (size > 0)
+    {
+        void *memory = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (memory == MAP_FAILED)
+        {
+            perror(path);
+            close(fd);
+            return false;
+        }
+        madvise(memory, size, MADV_SEQUENTIAL);
+        data = (const unsigned char *)memory;
+    }
+    close(fd);
+
+    unsigned long long blocks = 0, missingBlocks = 0, damagedBytes = 0;
+    uint64_t expected = 0;
+    bool intact = true;
+    size_t offset = 0;
+    while (offset < size)
+    {
+        uint64_t sequence;
+        size_t blockSize = checkLogBlock(data + offset, size - offset, sequence);
+        if (blockSize == 0)
+        {
+            size_t next = findNextBlock(data, size, offset + 1);
+            if (intact)
+            {
+                printf("%s: first bad block at byte %zu (block %llu)\n", path, offset, (unsigned long long)expected);
+            }
+            printf("%s: bytes %zu-%zu damaged%s\n", path, offset, next, next == size ? " (truncated end)" : "");
+            damagedBytes += next - offset;
+            intact = false;
+            offset = next;
+            continue;
+        }
+        if (sequence != expected)
+        {
+            printf("%s: blocks %llu-%llu missing\n", path, (unsigned long long)expected, (unsigned long long)sequence - 1);
+            missingBlocks += sequence > expected ? sequence - expected : 0;
+            intact = false;
+        }
+        if (recovered != nullptr)
+        {
+            fwrite(data + offset + LOG_BLOCK_HEADER, 1, blockSize - LOG_BLOCK_HEADER, recovered);
+        }
+        expected = sequence + 1;
+        blocks++;
+        offset += blockSize;
+    }
+    printf("%s: %llu intact blocks, %llu missing, %llu damaged bytes of %zu: %s\n", path, blocks, missingBlocks,
+           damagedBytes, size, intact ? "OK" : "DAMAGED");
+    if (data != nullptr)
+    {
+        munmap((void *)data, size);
+    }
+    scannedBytes += size;
+    return intact;
+}
+
+int main(int argc, char **argv)
+{
+    FILE *recovered = nullptr;
+    int first = 1;
+    if (argc > 2 && strcmp(argv[1], "-r") == 0)
+    {
+        recovered = fopen(argv[2], "w");
+        if (recovered == nullptr)
+        {
+            perror(argv[2]);
+            return 2;
+        }
+        first = 3;
+    }
+    if (first >= argc)
+    {
+        fprintf(stderr, "usage: %s [-r recovered.csv] file.csv.blk...\n", argv[0]);
+        return 2;
+    }
+    bool allIntact = true;
+    double scannedBytes = 0;
+    auto start = chrono::steady_clock::now();
+    for (int i = first; i < argc; i++)
+    {
+        allIntact = verifyFile(argv[i], recovered, scannedBytes) && allIntact;
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    if (seconds > 0)
+    {
+        printf("scanned %.1f MB in %.3f s (%.2f GB/s)\n", scannedBytes / 1e6, seconds, scannedBytes / 1e9 / seconds);
+    }
+    if (recovered != nullptr)
+    {
+        fclose(recovered);
+    }
+    return allIntact ? 0 : 1;
+}
@@ -0,0 +1,254 @@
+// ---------------------- Capture Triggers ----------------------
+// Oscilloscope style triggers on any decoded channel. Each trigger is armed
+// from the command line with a spec such as
+//   "PMT adc > 0.5"        value crosses above a threshold
+//   "HK temp1 < -10"       value crosses below a threshold
+//   "HK busimon rise 0.02" value goes up by at least this much between packets
+//   "HK busimon fall 0.02" value goes down by at least this much between packets
+//   "ERPA seq gap"         sequence counter skipped a packet
+// When one fires, the frames of every packet type from the preceding
+// triggerPreMs (out of the frame history) and the following triggerPostMs are
+// written to their own CSV in logs/Triggers. Threshold triggers fire on the
+// crossing only, so a channel that stays out of range captures once.
+//
+// The pre-trigger frames are written by the history flush thread
+// (history/historyFlush.cpp), as RECORD's are; while it is busy the rows that
+// follow, and closing the capture, are handed to it as well.
+//
+// A trigger armed with --safe-on is a limit: when it fires it also calls
+// triggerSafeModeHandler, see commands/safeMode.cpp.
+#ifndef TRIGGERS_TRIGGER_CPP
+#define TRIGGERS_TRIGGER_CPP
+
+#include <sys/stat.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+#include "../frames/frame.cpp"
+#include "../history/frameHistory.cpp"
+#include "../history/historyFlush.cpp"
+
+using namespace std;
+
+#define TRIGGER_ABOVE 1
+#define TRIGGER_BELOW 2
+#define TRIGGER_RISE 3
+#define TRIGGER_FALL 4
+#define TRIGGER_GAP 5
+
+#define TRIGGER_DIRECTORY "logs/Triggers"
+
+struct Trigger
+{
+    string spec;
+    int type;
+    int column;
+    int condition;
+    double threshold;
+    bool conditionWasTrue; // For threshold crossings
+    bool havePrevious;
+    double previous;       // Last value seen, for rise/fall/gap
+    int fired;
+    bool safeMode;         // A limit, firing also calls triggerSafeModeHandler
+    ofstream capture;      // Written by the flush thread while it is busy
+    bool capturing;        // The post-trigger window is being written
+    int64_t captureUntilMs;
+};
+
+vector<Trigger> triggers;
+int64_t triggerPreMs = 5 * 1000;
+int64_t triggerPostMs = 5 * 1000;
+void (*triggerSafeModeHandler)(const Trigger &) = nullptr;
+
+bool addTrigger(const string &spec, bool safeMode = false)
+{
+    istringstream words(spec);
+    string typeName, field, condition;
+    words >> typeName >> field >> condition;
+    Trigger trigger;
+    trigger.spec = spec;
+    trigger.type = frameTypeFromName(typeName);
+    trigger.column = frameFieldIndex(trigger.type, field);
+    trigger.threshold = 0;
+    if (trigger.type == 0 || trigger.column == -1)
+    {
+        std::cerr << "Trigger \"" << spec << "\": unknown packet or field." << std::endl;
+        return false;
+    }
+    if (condition == "gap" && field == "seq")
+    {
+        trigger.condition = TRIGGER_GAP;
+    }
+    else if (condition == ">" || condition == "<" || condition == "rise" || condition == "fall")
+    {
+        if (!(words >> trigger.threshold))
+        {
+            std::cerr << "Trigger \"" << spec << "\": missing value." << std::endl;
+            return false;
+        }
+        trigger.condition = condition == ">" ? TRIGGER_ABOVE : condition == "<" ? TRIGGER_BELOW : condition == "rise" ? TRIGGER_RISE : TRIGGER_FALL;
+    }
+    else
+    {
+        std::cerr << "Trigger \"" << spec << "\": expected >, <, rise, fall or seq gap." << std::endl;
+        return false;
+    }
+    trigger.conditionWasTrue = false;
+    trigger.havePrevious = false;
+    trigger.previous = 0;
+    trigger.fired = 0;
+    trigger.capturing = false;
+    trigger.safeMode = safeMode;
+    trigger.captureUntilMs = 0;
+    triggers.push_back(std::move(trigger));
+    return true;
+}
+
+// Feeds one value of the trigger's channel; true when the trigger fires on it
+bool testTrigger(Trigger &trigger, double value)
+{
+    bool fire = false;
+    switch (trigger.condition)
+    {
+    case TRIGGER_ABOVE:
+    case TRIGGER_BELOW:
+    {
+        bool conditionTrue = trigger.condition == TRIGGER_ABOVE ? value > trigger.threshold : value < trigger.threshold;
+        fire = conditionTrue && !trigger.conditionWasTrue;
+        trigger.conditionWasTrue = conditionTrue;
+        break;
+    }
+    case TRIGGER_RISE:
+        fire = trigger.havePrevious && value - trigger.previous >= trigger.threshold;
+        break;
+    case TRIGGER_FALL:
+        fire = trigger.havePrevious && trigger.previous - value >= trigger.threshold;
+        break;
+    case TRIGGER_GAP:
+        // The counter wraps to 0 after 0xFFFF
+        fire = trigger.havePrevious && value != trigger.previous + 1 && value != 0;
+        break;
+    }
+    trigger.previous = value;
+    trigger.havePrevious = true;
+    return fire;
+}
+
+void writeTriggerRow(ofstream &capture, const Frame &frame)
+{
+    capture << frameTypeNames[frame.type] << ", ";
+    writeFrameRow(capture, frame);
+}
+
+// Straight to the capture, or behind the flush thread's tasks if it has any
+void writeCaptureRow(Trigger &trigger, const Frame &frame)
+{
+    if (historyFlushing)
+    {
+        Trigger *target = &trigger;
+        flushInBackground([target, frame]()
+                          { writeTriggerRow(target->capture, frame); });
+    }
+    else
+    {
+        writeTriggerRow(trigger.capture, frame);
+    }
+}
+
+void closeCapture(Trigger &trigger)
+{
+    trigger.capturing = false;
+    if (historyFlushing)
+    {
+        Trigger *target = &trigger;
+        flushInBackground([target]()
+                          { target->capture.close(); });
+    }
+    else
+    {
+        trigger.capture.close();
+    }
+}
+
+void startCapture(Trigger &trigger, int number, const Frame &frame)
+{
+    time_t seconds = frame.timestampMs / 1000;
+    struct tm tm;
+    localtime_r(&seconds, &tm);
+    char stamp[32];
+    strftime(stamp, sizeof(stamp), "%Y-%m-%d %H-%M-%S", &tm);
+    string path = TRIGGER_DIRECTORY "/Trigger " + to_string(number) + " " + stamp + ".csv";
+
+    trigger.fired++;
+    trigger.capturing = true;
+    trigger.captureUntilMs = frame.timestampMs + triggerPostMs;
+    std::cout << "Trigger \"" << trigger.spec << "\" fired, capturing to " << path << std::endl;
+
+    vector<Frame> before;
+    for (int type = ERPA_FRAME; type <= HK_FRAME; type++)
+    {
+        vector<Frame> frames = historySince(type, frame.timestampMs - triggerPreMs);
+        before.insert(before.end(), frames.begin(), frames.end());
+    }
+    Trigger *target = &trigger;
+    flushInBackground([target, path, before, frame]() mutable
+                      {
+                          mkdir(TRIGGER_DIRECTORY, 0755);
+                          target->capture.open(path, ios::app);
+                          if (!target->capture.is_open())
+                          {
+                              std::cerr << "Trigger \"" << target->spec << "\": cannot open " << path << "." << std::endl;
+                              return;
+                          }
+                          target->capture << "# trigger: " << target->spec << "\n";
+                          target->capture << "type, date, time, values\n";
+                          stable_sort(before.begin(), before.end(), [](const Frame &a, const Frame &b)
+                                      { return a.timestampMs < b.timestampMs; });
+                          for (size_t i = 0; i < before.size(); i++)
+                          {
+                              writeTriggerRow(target->capture, before[i]);
+                          }
+                          writeTriggerRow(target->capture, frame); });
+}
+
+// Called for every frame before it goes into the history
+void evaluateTriggers(const Frame &frame)
+{
+    for (size_t i = 0; i < triggers.size(); i++)
+    {
+        Trigger &trigger = triggers[i];
+        if (trigger.capturing && frame.timestampMs > trigger.captureUntilMs)
+        {
+            closeCapture(trigger);
+        }
+        bool capturing = trigger.capturing;
+        if (capturing)
+        {
+            writeCaptureRow(trigger, frame);
+        }
+        if (frame.type == trigger.type && testTrigger(trigger, frame.values[trigger.column]))
+        {
+            if (trigger.safeMode && triggerSafeModeHandler != nullptr)
+            {
+                triggerSafeModeHandler(trigger); // Before the capture, which writes to disk
+            }
+            if (!capturing)
+            {
+                startCapture(trigger, i + 1, frame);
+            }
+        }
+    }
+}
+
+// After finishHistoryFlush()
+void closeTriggers()
+{
+    for (size_t i = 0; i < triggers.size(); i++)
+    {
+        triggers[i].capture.close();
+    }
+}
+
+#endif